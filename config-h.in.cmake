@@ -15,9 +15,15 @@
 #cmakedefine _HAVE_GSSAPI 1
 #cmakedefine HAVE_STRING_H 1
 #cmakedefine HAVE_STRINGS_H 1
+#cmakedefine HAVE_UCONTEXT_H 1
+#cmakedefine HAVE_RECVMMSG 1
+#cmakedefine HAVE_SENDMMSG 1
+#cmakedefine HAVE_GETCPU 1
+#cmakedefine HAVE_MSG_ZEROCOPY 1
 #cmakedefine LITTLEEND 1
 #cmakedefine BIGEND 1
 #cmakedefine TIRPC_EPOLL 1
+#cmakedefine TIRPC_IOURING 1
 #cmakedefine USE_RPC_RDMA 1
 #cmakedefine USE_LTTNG_NTIRPC 1
 
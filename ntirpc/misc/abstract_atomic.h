@@ -78,6 +78,7 @@
 
 #ifndef _ABSTRACT_ATOMIC_H
 #define _ABSTRACT_ATOMIC_H
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <time.h>
@@ -2207,6 +2208,34 @@ static inline void atomic_store_uint64_t(uint64_t *var, uint64_t val)
 }
 #endif
 
+/**
+ * @brief Atomically compare and swap a uint64_t
+ *
+ * This function stores a new value only when the variable still holds
+ * the expected value.
+ *
+ * @param[in,out] var    Pointer to the variable to modify
+ * @param[in]     oldval The expected value
+ * @param[in]     newval The value to store
+ *
+ * @return true if the value was stored.
+ */
+
+#ifdef GCC_ATOMIC_FUNCTIONS
+static inline bool atomic_cas_uint64_t(uint64_t *var, uint64_t oldval,
+				       uint64_t newval)
+{
+	return __atomic_compare_exchange_n(var, &oldval, newval, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#elif defined(GCC_SYNC_FUNCTIONS)
+static inline bool atomic_cas_uint64_t(uint64_t *var, uint64_t oldval,
+				       uint64_t newval)
+{
+	return __sync_bool_compare_and_swap(var, oldval, newval);
+}
+#endif
+
 /**
  * @brief Atomically fetch an int32_t
  *
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file timer_wheel.h
+ * @brief Hierarchical timing wheel
+ *
+ * @section DESCRIPTION
+ *
+ * Each level has 64 slots, each 64 times the span of the slots below.
+ * Insert and remove are O(1).  Advancing the wheel moves the expired
+ * entries onto a caller list in bulk, and cascades the higher levels
+ * down as their slots come due.  Entries beyond the top level wait in
+ * its last slot, and are re-placed as it cascades.  Entries already
+ * due when inserted expire at the next tick.
+ *
+ * Ticks are in whatever unit the caller keeps; the wheel is not locked.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <misc/opr_queue.h>
+
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS	4
+#define TIMER_WHEEL_SPAN \
+	((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+#define TIMER_WHEEL_NONE	UINT16_MAX
+
+struct timer_wheel_entry {
+	struct opr_queue te_q;
+	uint64_t te_expire;	/* ticks */
+	uint16_t te_slot;	/* level * TIMER_WHEEL_SLOTS + slot */
+};
+
+struct timer_wheel {
+	struct opr_queue tw_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	uint64_t tw_occupied[TIMER_WHEEL_LEVELS];	/* slot bitmaps */
+	uint64_t tw_now;	/* ticks processed through */
+	uint32_t tw_count;
+};
+
+static inline void
+timer_wheel_entry_init(struct timer_wheel_entry *te)
+{
+	opr_queue_Zero(&te->te_q);
+	te->te_expire = 0;
+	te->te_slot = TIMER_WHEEL_NONE;
+}
+
+static inline bool
+timer_wheel_entry_armed(struct timer_wheel_entry *te)
+{
+	return (te->te_slot != TIMER_WHEEL_NONE);
+}
+
+void timer_wheel_init(struct timer_wheel *, uint64_t now);
+void timer_wheel_insert(struct timer_wheel *, struct timer_wheel_entry *,
+			uint64_t expire);
+void timer_wheel_remove(struct timer_wheel *, struct timer_wheel_entry *);
+uint32_t timer_wheel_advance(struct timer_wheel *, uint64_t now,
+			     struct opr_queue *expired);
+uint64_t timer_wheel_next(struct timer_wheel *);
+
+#endif				/* TIMER_WHEEL_H */
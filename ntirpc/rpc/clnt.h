@@ -49,6 +49,7 @@
 #define _TIRPC_CLNT_H_
 
 #include <misc/rbtree.h>
+#include <misc/timer_wheel.h>
 #include <misc/wait_queue.h>
 #include <rpc/svc.h>
 #include <rpc/rpc_err.h>
@@ -131,7 +132,7 @@ typedef struct rpc_client {
 struct clnt_req {
 	struct work_pool_entry cc_wpe;
 	struct opr_rbtree_node cc_dplx;
-	struct opr_rbtree_node cc_rqst;
+	struct timer_wheel_entry cc_rqst;
 	struct waitq_entry cc_we;
 	struct opaque_auth cc_verf;
 
@@ -97,6 +97,20 @@ enum xprt_stat {
 #define SVC_INIT_EPOLL          0x0002
 #define SVC_INIT_NOREG_XPRTS    0x0008
 #define SVC_INIT_BLKIN          0x0010
+#define SVC_INIT_IOURING        0x0020	/* io_uring poll evchans, else epoll */
+#define SVC_INIT_EPOLL_ET       0x0040	/* edge-triggered vc receive */
+#define SVC_INIT_WORK_STEAL     0x0080	/* per-worker work deques */
+#define SVC_INIT_AFFINITY       0x0100	/* evchans tied to cpus */
+#define SVC_INIT_SO_BUSY_POLL   0x0200	/* SO_BUSY_POLL on xprt sockets */
+#define SVC_INIT_FAIR           0x0400	/* per-client fair receive */
+#define SVC_INIT_WORK_ADAPT     0x0800	/* worker count by controller */
+#define SVC_INIT_WORK_HANDOFF   0x1000	/* workers park, handed work */
+#define SVC_INIT_CORO           0x2000	/* requests on coroutines */
+#define SVC_INIT_BUF_POOL       0x4000	/* pooled receive buffers */
+#define SVC_INIT_DG_SENDMMSG    0x8000	/* udp replies by sendmmsg */
+#define SVC_INIT_UDP_GSO        0x10000	/* SVC_INIT_DG_SENDMMSG by GSO */
+#define SVC_INIT_UDP_GRO        0x20000	/* coalesced udp receive */
+#define SVC_INIT_ZEROCOPY       0x40000	/* large vc replies by MSG_ZEROCOPY */
 
 #define SVC_SHUTDOWN_FLAG_NONE  0x0000
 
@@ -128,6 +142,13 @@ typedef enum xprt_stat (*svc_xprt_fun_t) (SVCXPRT *);
 typedef void (*svc_xprt_void_fun_t) (SVCXPRT *);
 typedef struct svc_req *(*svc_xprt_alloc_fun_t) (SVCXPRT *, XDR *);
 typedef void (*svc_xprt_free_fun_t) (struct svc_req *, enum xprt_stat);
+/* event channel for a new connection, given its incoming cpu (or -1);
+ * negative for the default placement */
+typedef int (*svc_xprt_evchan_fun_t) (SVCXPRT *, int);
+/* fair queueing key of a transport (for example, from xp_u1), setting
+ * its weight when not 1 */
+typedef uint64_t (*svc_xprt_fair_fun_t) (SVCXPRT *, uint32_t *);
+typedef void (*svc_fair_each_fun_t) (uint64_t, uint32_t, uint32_t, void *);
 
 typedef struct svc_init_params {
 	svc_xprt_fun_t disconnect_cb;
@@ -151,11 +172,37 @@ typedef struct svc_init_params {
 	uint16_t nfs_rdma_port; /* Shared with Ganesha */
 	uint32_t max_rdma_connections;
 #endif
+	/* new members after this point, leaving the layout above as is */
+	svc_xprt_evchan_fun_t evchan_cb;	/* SVC_INIT_AFFINITY */
+	uint32_t busy_poll_us;	/* max epoll busy poll, 0 to block */
+	svc_xprt_fair_fun_t fair_cb;	/* SVC_INIT_FAIR, else by address */
+	uint32_t fair_workers;	/* SVC_INIT_FAIR, 0 for half ioq_thrd_max */
+	uint32_t work_weights[WORK_POOL_PRIO_MAX];	/* all 0 for strict */
+	uint32_t work_wait_us;	/* SVC_INIT_WORK_ADAPT queue wait, 0 default */
+	uint32_t work_spin_us;	/* SVC_INIT_WORK_HANDOFF max spin, 0 none */
+	uint32_t coro_stack_size;	/* SVC_INIT_CORO, 0 default */
+	uint32_t coro_cache;	/* SVC_INIT_CORO stacks kept, 0 default */
+	uint32_t buf_pool_max;	/* SVC_INIT_BUF_POOL bytes kept, 0 default */
+	uint32_t buf_pool_cache;	/* SVC_INIT_BUF_POOL per thread, 0 default */
+	uint32_t dg_batch;	/* datagrams per udp wakeup, 0 default */
+	uint32_t dg_send_us;	/* SVC_INIT_DG_SENDMMSG max lead, 0 default */
+	uint32_t accept_batch;	/* connections per accept wakeup, 0 default */
+	uint32_t zerocopy_min;	/* SVC_INIT_ZEROCOPY reply bytes, 0 default */
 } svc_init_params;
 
 /* Svc param flags */
 #define SVC_FLAG_NONE             0x0000
 #define SVC_FLAG_NOREG_XPRTS      0x0001
+#define SVC_FLAG_EPOLL_ET         0x0002
+#define SVC_FLAG_AFFINITY         0x0004
+#define SVC_FLAG_SO_BUSY_POLL     0x0008
+#define SVC_FLAG_FAIR             0x0010
+#define SVC_FLAG_CORO             0x0020
+#define SVC_FLAG_BUF_POOL         0x0040
+#define SVC_FLAG_DG_SENDMMSG      0x0080
+#define SVC_FLAG_UDP_GSO          0x0100
+#define SVC_FLAG_UDP_GRO          0x0200
+#define SVC_FLAG_ZEROCOPY         0x0400
 
 #define SVC_PARAM_HAS_THR_STACK_SIZE 1
 
@@ -222,6 +269,7 @@ typedef enum xprt_type {
 
 struct SVCAUTH;			/* forward decl. */
 struct svc_req;			/* forward decl. */
+struct svc_coro;		/* forward decl. */
 
 typedef enum xprt_stat (*svc_req_fun_t) (struct svc_req *);
 
@@ -378,6 +426,7 @@ struct svc_req {
 	struct blkin_trace bl_trace;
 #endif
 	uint32_t rq_refcnt;
+	struct svc_coro *rq_coro;	/* SVC_INIT_CORO */
 };
 
 /*
@@ -390,6 +439,9 @@ struct svc_req {
 
 extern void svc_resume(struct svc_req *req);
 
+/* SVC_INIT_CORO handlers, until svc_resume() */
+extern bool svc_suspend(struct svc_req *req);
+
 /*
  * Ganesha.  Get connected transport type.
  */
@@ -570,6 +622,10 @@ __BEGIN_DECLS
 extern struct work_pool svc_work_pool;
 
 bool svc_init(struct svc_init_params *);
+
+/* SVC_INIT_FAIR flows: key, queue depth, and weight of each backlogged
+ * client, returning the total depth */
+uint32_t svc_fair_foreach(svc_fair_each_fun_t, void *);
 __END_DECLS
 /*
  * Service shutdown (optional).
@@ -37,6 +37,7 @@
  *  svc_rqst_init -- init module; usually called by svc_init()
  *  svc_rqst_new_evchan -- create event channel
  *  svc_rqst_evchan_reg -- set {xprt, dispatcher} mapping
+ *  svc_rqst_reuseport_ncreate -- SO_REUSEPORT listeners, one per channel
  *  svc_rqst_foreach_xprt -- scan registered xprts at id (or 0 for all)
  *  svc_rqst_thrd_signal -- request thread to run a callout function
  *			 (which can cause the thread to return)
@@ -59,11 +60,15 @@
 #define SVC_RQST_FLAG_LOCKED		SVC_XPRT_FLAG_LOCKED
 #define SVC_RQST_FLAG_UNLOCK		SVC_XPRT_FLAG_UNLOCK
 #define SVC_RQST_FLAG_EPOLL		0x00080000
+#define SVC_RQST_FLAG_REUSEPORT_CPU	0x00100000 /* steer by cpu */
 
 void svc_rqst_init(uint32_t);
 int svc_rqst_new_evchan(uint32_t *chan_id /* OUT */ , void *u_data,
 			uint32_t flags);
 int svc_rqst_evchan_reg(uint32_t chan_id, SVCXPRT *xprt, uint32_t flags);
+int svc_rqst_reuseport_ncreate(const struct sockaddr *addr, socklen_t addrlen,
+			       int type, u_int sendsz, u_int recvsz,
+			       uint32_t flags, SVCXPRT **xprts, u_int count);
 
 int svc_rqst_thrd_signal(uint32_t chan_id, uint32_t flags);
 void svc_rqst_shutdown(void);
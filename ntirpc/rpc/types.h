@@ -115,6 +115,8 @@ typedef int32_t rpc_inline_t;
 #define TIRPC_SET_DEBUG_FLAGS		3
 #define TIRPC_GET_OTHER_FLAGS		4
 #define TIRPC_SET_OTHER_FLAGS		5
+#define TIRPC_GET_WORK_POOL_STATS	6	/* struct work_pool_stats */
+#define TIRPC_GET_BUF_POOL_STATS	7	/* struct xdr_ioq_pool_stats */
 
 /*
  * Debug flags support
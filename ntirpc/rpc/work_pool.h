@@ -33,6 +33,25 @@
  *
  * This provides simple work queues using pthreads and TAILQ primitives.
  *
+ * Each submission has a priority class.  By default the shared queue
+ * serves them in strict priority order; with weights, each class with
+ * work in turn runs up to its weight of entries before the lower classes
+ * have theirs, so none starves.
+ *
+ * With WORK_POOL_FLAG_STEAL, each worker also has a bounded lock-free
+ * deque.  Normal priority submissions from a worker go to its own deque,
+ * and idle workers steal from the others.  Other threads and classes
+ * still submit to the shared queue, and queued high priority work is
+ * taken before the deques.
+ *
+ * With WORK_POOL_FLAG_HANDOFF, idle workers of the shared queue spin a
+ * while, then park on a futex word of their own.  A submission with a
+ * worker parked hands the entry straight to it, so that the woken worker
+ * runs without taking the queue lock.
+ *
+ * With WORK_POOL_FLAG_ADAPT, a controller sizes the pool between
+ * thrd_min and thrd_max instead.  See work_pool_adapt() for the rules.
+ *
  * @note    Loosely based upon previous thrdpool by
  *          Matt Benjamin <matt@cohortfs.com>
  */
@@ -42,51 +61,169 @@
 
 #include <rpc/pool_queue.h>
 
+enum work_pool_prio {
+	WORK_POOL_PRIO_HIGH,	/* completions, that drain and free */
+	WORK_POOL_PRIO_NORMAL,	/* new work */
+	WORK_POOL_PRIO_LOW,	/* background */
+	WORK_POOL_PRIO_MAX
+};
+
 struct work_pool_params {
 	int32_t thrd_max;
 	int32_t thrd_min;
 	uint32_t thr_stack_size;
+	uint32_t flags;
+	uint32_t weights[WORK_POOL_PRIO_MAX];	/* all 0 for strict */
+	uint32_t adapt_ms;	/* WORK_POOL_FLAG_ADAPT interval, 0 default */
+	uint32_t adapt_wait_us;	/* queue wait budget, 0 default */
+	uint32_t spin_us;	/* WORK_POOL_FLAG_HANDOFF, 0 to park at once */
+};
+
+#define WORK_POOL_FLAG_NONE		0x0000
+#define WORK_POOL_FLAG_STEAL		0x0001	/* per-worker deques */
+#define WORK_POOL_FLAG_ADAPT		0x0002	/* sized by controller */
+#define WORK_POOL_FLAG_HANDOFF		0x0004	/* futex park, direct handoff */
+
+struct work_pool_entry;
+
+typedef void (*work_pool_fun_t) (struct work_pool_entry *);
+
+#define WORK_POOL_HIST_BUCKETS	32	/* log2 ns, the last to infinity */
+#define WORK_POOL_STATS_FUNS	16	/* tracked apart, then others */
+
+/*
+ * Per task function.  Bucket b counts [2^b, 2^(b+1)) nanoseconds.
+ */
+struct work_pool_fun_stats {
+	work_pool_fun_t fun;	/* NULL for the others */
+	uint64_t tasks;
+	uint64_t wait_ns;	/* submit to start */
+	uint64_t run_ns;
+	uint64_t wait_hist[WORK_POOL_HIST_BUCKETS];
+	uint64_t run_hist[WORK_POOL_HIST_BUCKETS];
+};
+
+/*
+ * Kept by each worker without atomics, and summed when read.
+ */
+struct work_pool_counters {
+	uint64_t tasks;
+	uint64_t wait_ns;
+	uint64_t run_ns;
+	uint64_t idle_ns;	/* waiting for work */
+	struct work_pool_fun_stats funs[WORK_POOL_STATS_FUNS + 1];
+};
+
+/*
+ * WORK_POOL_FLAG_ADAPT controller state, and its decisions.  The first
+ * field is atomic, the others under qmutex.
+ */
+struct work_pool_adapt {
+	uint64_t next_ms;	/* next interval */
+
+	uint64_t last_ms;
+	uint64_t done_last;
+	uint64_t idle_last;
+	uint32_t backlog_last;
+	uint32_t throughput_last;
+	int32_t step;		/* last change of target */
+	uint32_t target;	/* threads wanted */
+
+	/* last interval */
+	uint32_t throughput;	/* tasks per second */
+	uint32_t wait_us;	/* estimated queue wait */
+	uint32_t util;		/* percent of worker time busy */
+	uint32_t backlog;	/* queued at the end */
+
+	/* decisions */
+	uint64_t grows;		/* over the wait budget, or backlog rising */
+	uint64_t shrinks;	/* idle workers, no backlog */
+	uint64_t climbs;	/* kept or reversed by throughput */
+};
+
+/*
+ * work_pool_stats(), and TIRPC_GET_WORK_POOL_STATS for svc_work_pool
+ */
+struct work_pool_stats {
+	uint32_t n_threads;
+	uint32_t n_waiting;	/* idle workers */
+	uint32_t queued;
+	uint32_t flags;		/* params */
+	uint64_t spawned;
+	uint64_t retired;
+	struct work_pool_counters counters;	/* since init */
+	struct work_pool_adapt adapt;	/* WORK_POOL_FLAG_ADAPT */
 };
 
 struct work_pool_thread;
+struct work_pool_deque;
+
+struct work_pool_class {
+	TAILQ_HEAD(work_pool_q, poolq_entry) qh;
+	uint32_t weight;	/* entries per turn, 0 unlimited */
+	uint32_t credit;	/* left this turn */
+};
 
 struct work_pool {
-	struct poolq_head pqh;
+	struct poolq_head pqh;		/* qmutex, and waiting workers */
+	struct work_pool_class wpc[WORK_POOL_PRIO_MAX];
 	TAILQ_HEAD(work_pool_s, work_pool_thread) wptqh;
+	TAILQ_HEAD(work_pool_a, work_pool_thread) wpt_all;
 	char *name;
 	pthread_attr_t attr;
 	struct work_pool_params params;
 	long timeout_ms;
 	uint32_t n_threads;
 	uint32_t worker_index;
-};
+	uint32_t n_idle;		/* STEAL and HANDOFF hint */
+	uint32_t n_shared;		/* entries on wpc */
+	uint32_t n_high;		/* of those, WORK_POOL_PRIO_HIGH */
 
-struct work_pool_entry;
+	struct work_pool_deque *wpdq;	/* WORK_POOL_FLAG_STEAL */
+	uint32_t wpdq_max;
+	uint32_t wpdq_hw;		/* high water of claimed deques */
+	uint32_t wpdq_numa;		/* some deque has a node */
+
+	struct work_pool_adapt adapt;	/* WORK_POOL_FLAG_ADAPT */
+
+	uint64_t spawned;
+	uint64_t retired;
+	struct work_pool_counters counters;	/* of retired workers */
+};
 
 struct work_pool_thread {
 	struct poolq_entry pqe;		/*** 1st ***/
 	TAILQ_ENTRY(work_pool_thread) wptq;
+	TAILQ_ENTRY(work_pool_thread) wpt_allq;
 	pthread_cond_t pqcond;
+	struct work_pool_counters counters;	/* written by this worker */
 
 	struct work_pool *pool;
 	struct work_pool_entry *work;
+	struct work_pool_deque *wpdq;	/* own deque, or NULL */
 	char worker_name[16];
 	pthread_t pt;
 	uint32_t worker_index;
+	uint32_t park;			/* WORK_POOL_FLAG_HANDOFF futex */
+	uint32_t spin_ns;		/* adaptive, before parking */
 	bool wakeup;
 };
 
-typedef void (*work_pool_fun_t) (struct work_pool_entry *);
-
 struct work_pool_entry {
 	struct poolq_entry pqe;		/*** 1st ***/
 	struct work_pool_thread *wpt;
 	work_pool_fun_t fun;
 	void *arg;
+	uint64_t submit_ns;		/* stats */
 };
 
 int work_pool_init(struct work_pool *, const char *, struct work_pool_params *);
-int work_pool_submit(struct work_pool *, struct work_pool_entry *);
+int work_pool_submit(struct work_pool *, struct work_pool_entry *,
+		     enum work_pool_prio);
+int work_pool_submit_batch(struct work_pool *, struct work_pool_entry **,
+			   int, enum work_pool_prio);
 int work_pool_shutdown(struct work_pool *);
+void work_pool_stats(struct work_pool *, struct work_pool_stats *);
+void work_pool_set_node(int);
 
 #endif				/* WORK_POOL_H */
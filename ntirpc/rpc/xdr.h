@@ -123,6 +123,7 @@ typedef enum vio_type {
 	VIO_DATA,               /* data buffer */
 	VIO_TRAILER_LEN,	/* length field for following TRAILER buffer */
 	VIO_TRAILER,            /* trailer buffer after data */
+	VIO_FILE,		/* file range, see UIO_FLAG_FILE */
 } vio_type;
 
 /* XDR buffer vector descriptors */
@@ -145,6 +146,13 @@ typedef struct xdr_vio {
 #define UIO_FLAG_MORE		0x0008
 #define UIO_FLAG_REALLOC	0x0010
 #define UIO_FLAG_REFER		0x0020
+/* The vectors are ranges of the file uio_fd: their vio_head, vio_tail and
+ * vio_wrap hold file offsets instead of addresses (see xdr_vio_file()).
+ * xdr_ioq sends them with sendfile(), other streams read them in.  Not
+ * being in memory, XDR_IOVCOUNT and XDR_FILLBUFS refuse them, so RPCSEC_GSS
+ * integrity or privacy fails instead of wrapping them.
+ */
+#define UIO_FLAG_FILE		0x0040
 
 struct xdr_uio;
 typedef void (*xdr_uio_release)(struct xdr_uio *, u_int);
@@ -161,9 +169,28 @@ typedef struct xdr_uio {
 				 * 0: not allocated */
 	u_int	uio_flags;
 	int32_t uio_references;
+	int	uio_fd;		/* UIO_FLAG_FILE */
 	xdr_vio	uio_vio[0];	/* appended vectors */
 } xdr_uio;
 
+/* Describe length bytes of the UIO_FLAG_FILE file at offset; false when
+ * the range does not fit in a pointer (above 4GB on 32-bit systems).
+ */
+static inline bool
+xdr_vio_file(xdr_vio *v, off_t offset, uint32_t length)
+{
+	if (offset < 0 || (uintmax_t)offset > UINTPTR_MAX - length)
+		return (false);
+
+	v->vio_base = NULL;
+	v->vio_head = (uint8_t *)(uintptr_t)offset;
+	v->vio_tail = v->vio_head + length;
+	v->vio_wrap = v->vio_tail;
+	v->vio_length = length;
+	v->vio_type = VIO_FILE;
+	return (true);
+}
+
 /* Op flags */
 #define XDR_PUTBUFS_FLAG_NONE    0x0000
 #define XDR_PUTBUFS_FLAG_RDNLY   0x0001
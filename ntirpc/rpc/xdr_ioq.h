@@ -105,6 +105,8 @@ struct xdr_ioq {
 	uint32_t write_start; /* Position to start write at */
 	int frag_hdr_bytes_sent; /* Indicates a fragment header has been sent */
 	bool has_blocked;
+	uint32_t frag_hdr[3]; /* record marks, referenced until sent */
+	uint32_t zc_seq; /* MSG_ZEROCOPY sends through this one, or 0 */
 
 #ifdef USE_RPC_RDMA
 	bool rdma_ioq;
@@ -121,11 +123,29 @@ struct xdr_ioq {
 /* ioq_s.qflags */
 #define IOQ_FLAG_SEGMENT	0x0100
 #define IOQ_FLAG_WORKING	0x0200	/* (atomic) using ioq_wpe */
+#define IOQ_FLAG_POOLED		0x0400	/* from xdr_ioq_pool */
+#define IOQ_FLAG_ZEROCOPY	0x0800	/* sent by MSG_ZEROCOPY, see zc_seq */
 /* uint32_t instructions */
 #define IOQ_FLAG_LOCKED		0x00010000
 #define IOQ_FLAG_UNLOCK		0x00020000
 #define IOQ_FLAG_BALLOC		0x00040000
 
+/* header class, then buffer classes of 512 bytes to 64K */
+#define XDR_IOQ_POOL_CLASSES 9
+
+struct xdr_ioq_pool_stats {
+	uint64_t held;		/* bytes idle in the caches and shared lists */
+	uint64_t max;
+	struct {
+		uint32_t size;
+		uint32_t idle;
+		uint64_t allocs;	/* from the allocator */
+		uint64_t reuses;	/* from the shared list */
+		uint64_t cached;	/* from a thread cache */
+		uint64_t frees;		/* to the allocator, list full */
+	} cls[XDR_IOQ_POOL_CLASSES];
+};
+
 extern struct xdr_ioq_uv *xdr_ioq_uv_create(size_t size, u_int uio_flags);
 extern struct poolq_entry *xdr_ioq_uv_fetch(struct xdr_ioq *xioq,
 					     struct poolq_head *ioqh,
@@ -148,6 +168,10 @@ extern void xdr_ioq_setup(struct xdr_ioq *xioq);
 extern void xdr_ioq_destroy(struct xdr_ioq *xioq, size_t qsize);
 extern void xdr_ioq_destroy_pool(struct poolq_head *ioqh);
 
+/* XDR_IOVCOUNT and XDR_FILLBUFS, with files true for the sender only */
+extern int xdr_ioq_vcount(XDR *, u_int, u_int, bool);
+extern bool xdr_ioq_vfill(XDR *, u_int, xdr_vio *, u_int, bool);
+
 extern const struct xdr_ops xdr_ioq_ops;
 
 #ifdef USE_RPC_RDMA
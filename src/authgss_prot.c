@@ -293,6 +293,7 @@ xdr_rpc_gss_wrap(XDR *xdrs, xdrproc_t xdr_func, void *xdr_ptr,
 		data_count = XDR_IOVCOUNT(xdrs, start + 4, databuflen);
 
 		if (data_count < 0) {
+			/* also a file range (UIO_FLAG_FILE), not in memory */
 			__warnx(TIRPC_DEBUG_FLAG_RPCSEC_GSS,
 				"%s() data_count = %d",
 				__func__, data_count);
@@ -363,7 +364,14 @@ xdr_rpc_gss_wrap(XDR *xdrs, xdrproc_t xdr_func, void *xdr_ptr,
 		 *   vio_tail, vio_wrap, vio_length, and vio_type) on exit.
 		 * No other buffers are touched at this point.
 		 */
-		xdr_stat = XDR_FILLBUFS(xdrs, start + 4, data, databuflen);
+		if (!XDR_FILLBUFS(xdrs, start + 4, data, databuflen)) {
+			/* e.g. a file range (UIO_FLAG_FILE), not in memory */
+			__warnx(TIRPC_DEBUG_FLAG_RPCSEC_GSS,
+				"%s() XDR_FILLBUFS failed",
+				__func__);
+			xdr_stat = FALSE;
+			goto out;
+		}
 
 		/* Now show the gss_iov and xdr_iov */
 		show_gss_xdr_iov(gss_iov, gv_count, xdr_iov, xv_count,
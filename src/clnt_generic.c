@@ -521,6 +521,7 @@ clnt_req_setup(struct clnt_req *cc, struct timespec timeout)
 	cc->cc_error.re_errno = 0;
 	cc->cc_error.re_status = RPC_SUCCESS;
 	cc->cc_flags = CLNT_REQ_FLAG_NONE;
+	timer_wheel_entry_init(&cc->cc_rqst);
 	cc->cc_process_cb = clnt_req_callback_default;
 	cc->cc_refreshes = 2;
 	cc->cc_timeout = timeout;
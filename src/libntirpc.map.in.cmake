@@ -132,6 +132,7 @@ NTIRPC_${NTIRPC_VERSION_BASE} {
     svc_auth_authenticate;
     svc_auth_reg;
     svc_dg_ncreatef;
+    svc_fair_foreach;
     svc_fd_ncreatef;
     svc_init;
     svc_ncreate;
@@ -141,11 +142,13 @@ NTIRPC_${NTIRPC_VERSION_BASE} {
     svc_rqst_new_evchan;
     svc_rqst_evchan_reg;
     svc_rqst_evchan_unreg;
+    svc_rqst_reuseport_ncreate;
     svc_rqst_shutdown;
     svc_rqst_thrd_run;
     svc_rqst_thrd_signal;
     svc_sendreply;
     svc_shutdown;
+    svc_suspend;
     svc_tli_ncreate;
     svc_tp_ncreate;
     svc_unreg;
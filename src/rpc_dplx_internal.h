@@ -29,6 +29,7 @@
 
 #include <misc/queue.h>
 #include <misc/rbtree.h>
+#include <misc/timer_wheel.h>
 #include <misc/wait_queue.h>
 #include <rpc/svc.h>
 #include <rpc/xdr_ioq.h>
@@ -37,7 +38,8 @@
 /* Svc event strategy */
 enum svc_event_type {
 	SVC_EVENT_FDSET /* trad. using select and poll (currently unhooked) */ ,
-	SVC_EVENT_EPOLL		/* Linux epoll interface */
+	SVC_EVENT_EPOLL,	/* Linux epoll interface */
+	SVC_EVENT_IOURING	/* Linux io_uring interface */
 };
 
 typedef struct rpc_dplx_lock {
@@ -57,6 +59,7 @@ struct rpc_dplx_rec {
 	struct poolq_head writeq;	/**< poolq for write requests */
 	struct opr_rbtree call_replies;
 	struct opr_rbtree_node fd_node;
+	struct timer_wheel_entry idle_te;	/* by last receive, seconds */
 	struct {
 		rpc_dplx_lock_t lock;
 		struct timespec ts;
@@ -86,10 +89,16 @@ struct rpc_dplx_rec {
 	u_int sendsz;
 	uint32_t call_xid;		/**< current call xid */
 	uint32_t ev_count;		/**< atomic count of waiting events */
+	uint32_t ev_state;		/**< atomic edge-triggered recv state */
 	struct svc_req *svc_req;	/**< svc_req we are processing */
 };
 #define REC_XPRT(p) (opr_containerof((p), struct rpc_dplx_rec, xprt))
 
+/* ev_state, replaces EPOLLONESHOT for edge-triggered receive */
+#define RPC_DPLX_EV_EDGE	0x0001	/* hooked EPOLLET, stays hooked */
+#define RPC_DPLX_EV_ACTIVE	0x0002	/* one task owns the receive side */
+#define RPC_DPLX_EV_PENDING	0x0004	/* edge (or more data) while owned */
+
 /* > SVC_XPRT_FLAG_LOCKED */
 #define RPC_DPLX_LOCKED		0x00100000
 #define RPC_DPLX_UNLOCK		0x00200000
@@ -122,6 +131,7 @@ rpc_dplx_rec_init(struct rpc_dplx_rec *rec)
 	TAILQ_INIT(&rec->writeq.qh);
 	mutex_init(&rec->writeq.qmutex, NULL);
 	rec->writeq.qcount = 0;
+	timer_wheel_entry_init(&rec->idle_te);
 	/* Stop this xprt being cleaned immediately */
 	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &(rec->recv.ts));
 
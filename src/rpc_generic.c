@@ -64,6 +64,8 @@
 
 #include "rpc_com.h"
 #include "strl.h"
+#include "svc_internal.h"
+#include "xdr_ioq_pool.h"
 
 void
 thr_keyfree(void *k)
@@ -161,6 +163,13 @@ tirpc_control(const u_int rq, void *in)
 	case TIRPC_SET_OTHER_FLAGS:
 		__ntirpc_pkg_params.other_flags = *(int *)in;
 		break;
+	case TIRPC_GET_WORK_POOL_STATS:
+		if (!__svc_params->initialized)
+			return (false);
+		work_pool_stats(&svc_work_pool, (struct work_pool_stats *)in);
+		break;
+	case TIRPC_GET_BUF_POOL_STATS:
+		return (xdr_ioq_pool_stats((struct xdr_ioq_pool_stats *)in));
 	default:
 		return (false);
 	}
@@ -733,6 +733,7 @@ static int
 rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 {
 	struct ibv_wc wc[IBV_POLL_EVENTS];
+	struct work_pool_entry *wpev[IBV_POLL_EVENTS];
 	struct ibv_cq *ev_cq;
 	void *ev_ctx;
 	struct rpc_rdma_cbc *cbc;
@@ -740,6 +741,7 @@ rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 	int i;
 	int rc;
 	int npoll = 0;
+	int n_wpe;
 	uint32_t len;
 
 	rc = ibv_get_cq_event(rdma_xprt->comp_channel, &ev_cq, &ev_ctx);
@@ -770,6 +772,7 @@ rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 
 	while (rc == 0
 	       && (npoll = ibv_poll_cq(rdma_xprt->cq, IBV_POLL_EVENTS, wc)) > 0) {
+		n_wpe = 0;
 		for (i = 0; i < npoll; i++) {
 			if (rdma_xprt->bad_recv_wr) {
 				__warnx(TIRPC_DEBUG_FLAG_RPC_RDMA,
@@ -817,7 +820,7 @@ rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 					rpc_rdma_worker_callback(&cbc->wpe);
 				} else {
 					SVC_REF(&rdma_xprt->sm_dr.xprt, SVC_REF_FLAG_NONE);
-					work_pool_submit(&svc_work_pool, &cbc->wpe);
+					wpev[n_wpe++] = &cbc->wpe;
 				}
 
 				continue;
@@ -850,7 +853,7 @@ rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 					rpc_rdma_worker_callback(&cbc->wpe);
 				} else {
 					SVC_REF(&rdma_xprt->sm_dr.xprt, SVC_REF_FLAG_NONE);
-					work_pool_submit(&svc_work_pool, &cbc->wpe);
+					wpev[n_wpe++] = &cbc->wpe;
 				}
 				break;
 
@@ -897,7 +900,7 @@ rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 					rpc_rdma_worker_callback(&cbc->wpe);
 				} else {
 					SVC_REF(&rdma_xprt->sm_dr.xprt, SVC_REF_FLAG_NONE);
-					work_pool_submit(&svc_work_pool, &cbc->wpe);
+					wpev[n_wpe++] = &cbc->wpe;
 				}
 				break;
 
@@ -908,6 +911,11 @@ rpc_rdma_cq_event_handler(RDMAXPRT *rdma_xprt)
 				rc = EINVAL;
 			}
 		}
+		/* one queue lock for the whole poll, new requests among
+		 * the completions
+		 */
+		work_pool_submit_batch(&svc_work_pool, wpev, n_wpe,
+				       WORK_POOL_PRIO_NORMAL);
 	}
 
 	if (npoll < 0) {
@@ -76,6 +76,9 @@
 #include "rpc_rdma.h"
 #endif
 #include "svc_ioq.h"
+#include "svc_fair.h"
+#include "svc_coro.h"
+#include "xdr_ioq_pool.h"
 
 #define SVC_VERSQUIET 0x0001	/* keep quiet about vers mismatch */
 #define version_keepquiet(xp) ((u_long)(xp)->xp_p3 & SVC_VERSQUIET)
@@ -157,20 +160,78 @@ svc_init(svc_init_params *params)
 #endif
 
 #if defined(TIRPC_EPOLL)
-	if (params->flags & SVC_INIT_EPOLL) {
+	if (params->flags & (SVC_INIT_EPOLL | SVC_INIT_IOURING)) {
 		__svc_params->ev_type = SVC_EVENT_EPOLL;
 		__svc_params->ev_u.evchan.max_events = params->max_events;
 	}
+#if defined(TIRPC_IOURING)
+	/* each channel falls back to epoll if the kernel refuses the ring */
+	if (params->flags & SVC_INIT_IOURING)
+		__svc_params->ev_type = SVC_EVENT_IOURING;
+#endif
 #else
 	/* XXX formerly select/fd_set case, now placeholder for new
 	 * event systems, reworked select, etc. */
 #endif
 	__svc_params->idle_timeout = params->idle_timeout;
 
+	/* spin before blocking in epoll_wait, adapted per channel; not on
+	 * a single cpu, where it would only delay the sender
+	 */
+	if (sysconf(_SC_NPROCESSORS_ONLN) >= 2)
+		__svc_params->busy_poll_ns = params->busy_poll_us * 1000;
+
+	/* accepts per listener wakeup */
+	__svc_params->accept_batch = params->accept_batch
+				    ? params->accept_batch
+				    : SVC_VC_ACCEPT_BATCH;
+
+	/* udp receive with recvmmsg(), bounded by the stack arrays */
+	__svc_params->dg_batch = params->dg_batch
+				? MIN(params->dg_batch, SVC_DG_BATCH_MAX)
+				: SVC_DG_BATCH;
+#ifdef HAVE_SENDMMSG
+	/* udp replies on a socket gathered for sendmmsg() */
+	if (params->flags & SVC_INIT_DG_SENDMMSG) {
+		__svc_params->flags |= SVC_FLAG_DG_SENDMMSG;
+		__svc_params->dg_send_ns = (params->dg_send_us
+					    ? MIN(params->dg_send_us, 1000000)
+					    : SVC_DG_SEND_US) * 1000;
+		if (params->flags & SVC_INIT_UDP_GSO)
+			__svc_params->flags |= SVC_FLAG_UDP_GSO;
+	}
+#endif
+#ifdef HAVE_MSG_ZEROCOPY
+	/* vc replies at least this large are sent without copying */
+	if (params->flags & SVC_INIT_ZEROCOPY) {
+		__svc_params->flags |= SVC_FLAG_ZEROCOPY;
+		__svc_params->zerocopy_min = params->zerocopy_min
+					    ? params->zerocopy_min
+					    : SVC_VC_ZEROCOPY_MIN;
+	}
+#endif
+	if (params->flags & SVC_INIT_UDP_GRO)
+		__svc_params->flags |= SVC_FLAG_UDP_GRO;
+	if (params->busy_poll_us && (params->flags & SVC_INIT_SO_BUSY_POLL)) {
+		/* the kernel polls the device itself, even on one cpu */
+		__svc_params->flags |= SVC_FLAG_SO_BUSY_POLL;
+		__svc_params->so_busy_poll_us = params->busy_poll_us;
+	}
+
 	/* allow consumers to manage all xprt registration */
 	if (params->flags & SVC_INIT_NOREG_XPRTS)
 		__svc_params->flags |= SVC_FLAG_NOREG_XPRTS;
 
+	/* connected vc xprts stay hooked, without a rearm per record */
+	if (params->flags & SVC_INIT_EPOLL_ET)
+		__svc_params->flags |= SVC_FLAG_EPOLL_ET;
+
+	/* evchans tied to cpus, connections placed by incoming cpu */
+	if (params->flags & SVC_INIT_AFFINITY) {
+		__svc_params->flags |= SVC_FLAG_AFFINITY;
+		__svc_params->evchan_cb = params->evchan_cb;
+	}
+
 	if (params->ioq_send_max)
 		__svc_params->ioq.send_max = params->ioq_send_max;
 	else
@@ -187,6 +248,15 @@ svc_init(svc_init_params *params)
 	work_pool_params.thrd_min = __svc_params->ioq.thrd_min;
 	work_pool_params.thrd_max = __svc_params->ioq.thrd_max;
 	work_pool_params.thr_stack_size = params->thr_stack_size;
+	if (params->flags & SVC_INIT_WORK_STEAL)
+		work_pool_params.flags |= WORK_POOL_FLAG_STEAL;
+	if (params->flags & SVC_INIT_WORK_HANDOFF) {
+		work_pool_params.flags |= WORK_POOL_FLAG_HANDOFF;
+		work_pool_params.spin_us = params->work_spin_us;
+	}
+	/* completions ahead of new work, strictly unless weighted */
+	memcpy(work_pool_params.weights, params->work_weights,
+	       sizeof(work_pool_params.weights));
 	/*
 	 * thrd_max should > channels.
 	 */
@@ -195,6 +265,13 @@ svc_init(svc_init_params *params)
 		work_pool_params.thrd_max = work_pool_params.thrd_min +
 					    channels;
 
+	/* sized between, never less than the event loops and a reserve */
+	if (params->flags & SVC_INIT_WORK_ADAPT) {
+		work_pool_params.flags |= WORK_POOL_FLAG_ADAPT;
+		work_pool_params.thrd_min += channels;
+		work_pool_params.adapt_wait_us = params->work_wait_us;
+	}
+
 	if (work_pool_init(&svc_work_pool, "svc_", &work_pool_params)) {
 		mutex_unlock(&__svc_params->mtx);
 		return false;
@@ -203,6 +280,25 @@ svc_init(svc_init_params *params)
 	/* uses svc_work_pool */
 	svc_rqst_init(channels);
 
+	/* receive tasks through per-client flows, by a share of workers */
+	if (params->flags & SVC_INIT_FAIR) {
+		__svc_params->flags |= SVC_FLAG_FAIR;
+		__svc_params->fair_cb = params->fair_cb;
+		svc_fair_init(params->fair_workers
+			      ? params->fair_workers
+			      : __svc_params->ioq.thrd_max / 2);
+	}
+
+	/* requests on coroutines, suspended without their threads */
+	if ((params->flags & SVC_INIT_CORO)
+	 && svc_coro_init(params->coro_stack_size, params->coro_cache))
+		__svc_params->flags |= SVC_FLAG_CORO;
+
+	/* receive buffers and headers by size class */
+	if ((params->flags & SVC_INIT_BUF_POOL)
+	 && xdr_ioq_pool_init(params->buf_pool_max, params->buf_pool_cache))
+		__svc_params->flags |= SVC_FLAG_BUF_POOL;
+
 	if (svc_xprt_init()) {
 		mutex_unlock(&__svc_params->mtx);
 		return false;
@@ -757,6 +853,11 @@ svc_shutdown(u_long flags)
 	/* release workers after event channels */
 	work_pool_shutdown(&svc_work_pool);
 
+	/* after the workers that run them */
+	svc_fair_shutdown();
+	svc_coro_shutdown();
+	xdr_ioq_pool_shutdown();
+
 	/* XXX assert quiescent */
 
 	return (code);
@@ -0,0 +1,599 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file svc_coro.c
+ * @brief Requests on pooled coroutine stacks
+ *
+ * @section DESCRIPTION
+ *
+ * With SVC_INIT_CORO, each request is decoded and dispatched on a
+ * coroutine of its own, run by the work pool thread that received it.
+ * A handler waiting for asynchronous work calls svc_suspend(), which
+ * returns that thread to the pool, and continues when the completion
+ * calls svc_resume().  So in-flight requests cost a stack each rather
+ * than a thread each, and handlers need no state machine around
+ * rq_resume_cb.
+ *
+ * A request resumed by a thread already running coroutines continues
+ * on that thread, after the current one suspends or finishes, without
+ * a work pool submission.  Otherwise it is submitted as before.
+ *
+ * On x86_64 and aarch64, a switch saves only the callee-saved registers
+ * on the stack being left, and makes no system call.  Elsewhere it is
+ * swapcontext(), which also saves and restores the signal mask, a
+ * sigprocmask() each time.  A coroutine that finishes its request waits
+ * in its loop for the next one, so a cached stack needs no setup, and a
+ * request that never suspends costs two switches.  A coroutine runs
+ * with the signal mask of the thread it is on.
+ *
+ * Stacks are mapped with a guard page, and a bounded number are kept
+ * for reuse.  Each takes two of the process's memory mappings, so well
+ * beyond 30k suspended requests Linux needs vm.max_map_count raised.
+ * Without a stack, a request is dispatched directly, and svc_suspend()
+ * returns false.
+ *
+ * Handlers that return XPRT_SUSPEND are resumed by rq_resume_cb as
+ * before, without their coroutine.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <misc/abstract_atomic.h>
+#include <rpc/rpc.h>
+#include "svc_internal.h"
+#include "svc_coro.h"
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SVC_CORO_SWAP_ASM
+#define SVC_CORO_SUPPORTED
+#elif defined(HAVE_UCONTEXT_H)
+#include <ucontext.h>
+#define SVC_CORO_SUPPORTED
+#endif
+
+#if defined(SVC_CORO_SUPPORTED)
+
+#define SVC_CORO_STACK_SIZE (128 * 1024)
+#define SVC_CORO_CACHE (1024)
+
+#define SVC_CORO_SUSPENDED	0x0001	/* switched out, and published */
+#define SVC_CORO_RESUMED	0x0002	/* svc_resume() called */
+#define SVC_CORO_DONE		0x0004	/* returned XPRT_SUSPEND */
+
+#if defined(SVC_CORO_SWAP_ASM)
+/* stack pointer, the callee-saved registers stored just above it */
+typedef void *svc_coro_ctx_t;
+
+/*
+ * Save the callee-saved registers on the current stack and its pointer
+ * in *save, then restore those below sp, and return on that stack.
+ */
+extern void svc_coro_swap(void **save, void *sp)
+	__attribute__ ((visibility("hidden")));
+
+#if defined(__x86_64__)
+/* rbp rbx r12 r13 r14 r15, then the return address */
+#define SVC_CORO_FRAME_WORDS (8)
+#define SVC_CORO_FRAME_PC (6)
+
+__asm__(
+	".text\n"
+	".p2align 4\n"
+	".globl svc_coro_swap\n"
+	".hidden svc_coro_swap\n"
+	".type svc_coro_swap, %function\n"
+	"svc_coro_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size svc_coro_swap, .-svc_coro_swap\n"
+);
+#else
+/* x19-x28, x29 x30, d8-d15 */
+#define SVC_CORO_FRAME_WORDS (20)
+#define SVC_CORO_FRAME_PC (11)
+
+__asm__(
+	".text\n"
+	".p2align 4\n"
+	".globl svc_coro_swap\n"
+	".hidden svc_coro_swap\n"
+	".type svc_coro_swap, %function\n"
+	"svc_coro_swap:\n"
+	"	sub sp, sp, #160\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mov x9, sp\n"
+	"	str x9, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #160\n"
+	"	ret\n"
+	".size svc_coro_swap, .-svc_coro_swap\n"
+);
+#endif
+#else
+typedef ucontext_t svc_coro_ctx_t;
+#endif
+
+struct svc_coro {
+	svc_coro_ctx_t co_ctx;
+	struct work_pool_entry co_wpe;	/* resumed from another thread */
+	struct svc_coro *co_next;	/* cache, or ready list */
+	struct svc_req *co_req;
+	void *co_map;		/* stack, above its guard page */
+	enum xprt_stat co_stat;
+	uint32_t co_state;
+	bool co_done;
+};
+
+static struct svc_coro_pool {
+	mutex_t lock;
+	struct svc_coro *cache;
+	size_t stack_size;	/* without the guard page */
+	size_t page_size;
+	uint32_t n_cache;
+	uint32_t max_cache;
+	uint32_t n_live;
+} svc_coro_pool = {
+	MUTEX_INITIALIZER,
+};
+
+/* the work pool thread's own context, and what it runs */
+static __thread svc_coro_ctx_t svc_coro_sched;
+static __thread struct svc_coro *svc_coro_self;
+static __thread struct svc_coro *svc_coro_ready;
+static __thread struct svc_coro **svc_coro_ready_tail;
+static __thread bool svc_coro_running;
+
+/*
+ * A coroutine may continue on another thread after switching out, so
+ * its thread locals are found anew each time, not from an address the
+ * compiler computed before the switch.
+ */
+static __attribute__ ((noinline)) svc_coro_ctx_t *
+svc_coro_sched_get(void)
+{
+	return (&svc_coro_sched);
+}
+
+static __attribute__ ((noinline)) struct svc_coro *
+svc_coro_self_get(void)
+{
+	return (svc_coro_self);
+}
+
+static inline void
+svc_coro_switch(svc_coro_ctx_t *save, svc_coro_ctx_t *to)
+{
+#if defined(SVC_CORO_SWAP_ASM)
+	svc_coro_swap(save, *to);
+#else
+	swapcontext(save, to);
+#endif
+}
+
+/*
+ * Each request, then back to the scheduler to wait for the next.  The
+ * coroutine is found anew each time, as it may be on another thread.
+ */
+static void
+svc_coro_loop(void)
+{
+	struct svc_coro *co;
+	struct svc_req *req;
+	enum xprt_stat stat;
+
+	for (;;) {
+		co = svc_coro_self_get();
+		req = co->co_req;
+
+		stat = SVC_DECODE(req);
+		if (stat != XPRT_SUSPEND)
+			svc_request_release(req, stat);
+
+		co->co_stat = stat;
+		co->co_done = true;
+		svc_coro_switch(&co->co_ctx, svc_coro_sched_get());
+	}
+}
+
+/*
+ * The first switch to a new stack enters svc_coro_loop().
+ */
+static void
+svc_coro_make(struct svc_coro *co)
+{
+	char *stack = (char *)co->co_map + svc_coro_pool.page_size;
+#if defined(SVC_CORO_SWAP_ASM)
+	void **sp = (void **)(stack + svc_coro_pool.stack_size)
+		  - SVC_CORO_FRAME_WORDS;
+
+	memset(sp, 0, SVC_CORO_FRAME_WORDS * sizeof(void *));
+	sp[SVC_CORO_FRAME_PC] = (void *)svc_coro_loop;
+	co->co_ctx = sp;
+#else
+	getcontext(&co->co_ctx);
+	co->co_ctx.uc_stack.ss_sp = stack;
+	co->co_ctx.uc_stack.ss_size = svc_coro_pool.stack_size;
+	co->co_ctx.uc_link = NULL;
+	makecontext(&co->co_ctx, svc_coro_loop, 0);
+#endif
+}
+
+static struct svc_coro *
+svc_coro_get(void)
+{
+	struct svc_coro *co;
+	void *map;
+
+	mutex_lock(&svc_coro_pool.lock);
+	co = svc_coro_pool.cache;
+	if (co) {
+		svc_coro_pool.cache = co->co_next;
+		svc_coro_pool.n_cache--;
+	}
+	mutex_unlock(&svc_coro_pool.lock);
+
+	if (co)
+		return (co);
+
+	map = mmap(NULL, svc_coro_pool.page_size + svc_coro_pool.stack_size,
+		   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+#if defined(MAP_STACK)
+		   | MAP_STACK
+#endif
+		   , -1, 0);
+	if (map == MAP_FAILED) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() stack mmap failed (%d)",
+			__func__, errno);
+		return (NULL);
+	}
+	if (mprotect(map, svc_coro_pool.page_size, PROT_NONE)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() guard mprotect failed (%d)",
+			__func__, errno);
+		munmap(map, svc_coro_pool.page_size
+			    + svc_coro_pool.stack_size);
+		return (NULL);
+	}
+
+	co = mem_zalloc(sizeof(*co));
+	co->co_map = map;
+	svc_coro_make(co);
+	atomic_inc_uint32_t(&svc_coro_pool.n_live);
+	return (co);
+}
+
+static void
+svc_coro_free(struct svc_coro *co)
+{
+	munmap(co->co_map, svc_coro_pool.page_size + svc_coro_pool.stack_size);
+	mem_free(co, sizeof(*co));
+	atomic_dec_uint32_t(&svc_coro_pool.n_live);
+}
+
+static void
+svc_coro_put(struct svc_coro *co)
+{
+	mutex_lock(&svc_coro_pool.lock);
+	if (svc_coro_pool.n_cache < svc_coro_pool.max_cache) {
+		co->co_next = svc_coro_pool.cache;
+		svc_coro_pool.cache = co;
+		svc_coro_pool.n_cache++;
+		co = NULL;
+	}
+	mutex_unlock(&svc_coro_pool.lock);
+
+	if (co)
+		svc_coro_free(co);
+}
+
+/*
+ * Run until it suspends or finishes.  Only on the thread's own stack.
+ *
+ * @return true when finished, with its status.
+ */
+static bool
+svc_coro_slice(struct svc_coro *co, enum xprt_stat *stat)
+{
+	struct svc_req *req;
+	uint32_t state;
+
+	for (;;) {
+		svc_coro_self = co;
+		svc_coro_switch(&svc_coro_sched, &co->co_ctx);
+		svc_coro_self = NULL;
+
+		if (co->co_done)
+			break;
+
+		/* suspended, unless already resumed */
+		state = atomic_postset_uint32_t_bits(&co->co_state,
+						     SVC_CORO_SUSPENDED);
+		if (!(state & SVC_CORO_RESUMED))
+			return false;
+		atomic_store_uint32_t(&co->co_state, 0);
+	}
+
+	*stat = co->co_stat;
+	if (co->co_stat != XPRT_SUSPEND) {
+		svc_coro_put(co);
+		return true;
+	}
+
+	/* the handler will be resumed by rq_resume_cb, perhaps already */
+	req = co->co_req;
+	state = atomic_postset_uint32_t_bits(&co->co_state,
+					     SVC_CORO_SUSPENDED
+					     | SVC_CORO_DONE);
+	if (state & SVC_CORO_RESUMED) {
+		req->rq_coro = NULL;
+		svc_coro_put(co);
+		svc_resume(req);
+	}
+	return true;
+}
+
+/*
+ * Run the coroutines resumed meanwhile on this thread.
+ */
+static void
+svc_coro_drain(void)
+{
+	struct svc_coro *co;
+	enum xprt_stat stat;
+
+	svc_coro_running = true;
+	while ((co = svc_coro_ready)) {
+		svc_coro_ready = co->co_next;
+		if (!svc_coro_ready)
+			svc_coro_ready_tail = &svc_coro_ready;
+		(void)svc_coro_slice(co, &stat);
+	}
+	svc_coro_running = false;
+}
+
+static void
+svc_coro_task(struct work_pool_entry *wpe)
+{
+	struct svc_coro *co = opr_containerof(wpe, struct svc_coro, co_wpe);
+	enum xprt_stat stat;
+
+	svc_coro_running = true;
+	(void)svc_coro_slice(co, &stat);
+	svc_coro_drain();
+}
+
+/**
+ * @brief Initialize coroutine stacks
+ *
+ * @param[in] stack_size	bytes, 0 for default
+ * @param[in] cache	stacks kept for reuse, 0 for default
+ */
+bool
+svc_coro_init(uint32_t stack_size, uint32_t cache)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (page <= 0)
+		page = 4096;
+
+	mutex_lock(&svc_coro_pool.lock);
+	svc_coro_pool.page_size = page;
+	svc_coro_pool.stack_size = stack_size ? stack_size
+					      : SVC_CORO_STACK_SIZE;
+	svc_coro_pool.stack_size = (svc_coro_pool.stack_size + page - 1)
+				 & ~((size_t)page - 1);
+	svc_coro_pool.max_cache = cache ? cache : SVC_CORO_CACHE;
+	mutex_unlock(&svc_coro_pool.lock);
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: %zu byte stacks, %" PRIu32 " cached",
+		__func__, svc_coro_pool.stack_size, svc_coro_pool.max_cache);
+	return true;
+}
+
+/**
+ * @brief Dispatch a request on a coroutine
+ *
+ * @param[in] req	request, with rq_coro clear
+ * @param[out] stat	XPRT_SUSPEND when the handler suspended
+ *
+ * @return false to dispatch it directly.
+ */
+bool
+svc_coro_request(struct svc_req *req, enum xprt_stat *stat)
+{
+	struct svc_coro *co;
+	bool outer;
+
+	if (svc_coro_self)
+		return false;	/* not from within a coroutine */
+
+	co = svc_coro_get();
+	if (!co)
+		return false;
+
+	co->co_req = req;
+	co->co_state = 0;
+	co->co_done = false;
+	req->rq_coro = co;
+
+	outer = !svc_coro_running;
+	svc_coro_running = true;
+	if (!svc_coro_slice(co, stat))
+		*stat = XPRT_SUSPEND;
+	if (outer)
+		svc_coro_drain();
+	return true;
+}
+
+/**
+ * @brief Continue a request's coroutine
+ *
+ * @return false to resume by rq_resume_cb.
+ */
+bool
+svc_coro_resume(struct svc_req *req)
+{
+	struct svc_coro *co = req->rq_coro;
+	uint32_t state;
+
+	state = atomic_postset_uint32_t_bits(&co->co_state, SVC_CORO_RESUMED);
+	if (state & SVC_CORO_DONE) {
+		req->rq_coro = NULL;
+		svc_coro_put(co);
+		return false;
+	}
+	if (!(state & SVC_CORO_SUSPENDED)) {
+		/* still switching out, its thread will continue it */
+		return true;
+	}
+	atomic_store_uint32_t(&co->co_state, 0);
+
+	if (svc_coro_running) {
+		co->co_next = NULL;
+		if (!svc_coro_ready_tail)
+			svc_coro_ready_tail = &svc_coro_ready;
+		*svc_coro_ready_tail = co;
+		svc_coro_ready_tail = &co->co_next;
+		return true;
+	}
+
+	co->co_wpe.fun = svc_coro_task;
+	work_pool_submit(&svc_work_pool, &co->co_wpe, WORK_POOL_PRIO_HIGH);
+	return true;
+}
+
+void
+svc_coro_shutdown(void)
+{
+	struct svc_coro *co;
+
+	mutex_lock(&svc_coro_pool.lock);
+	while ((co = svc_coro_pool.cache)) {
+		svc_coro_pool.cache = co->co_next;
+		svc_coro_pool.n_cache--;
+		svc_coro_free(co);
+	}
+	mutex_unlock(&svc_coro_pool.lock);
+}
+
+#else				/* !SVC_CORO_SUPPORTED */
+
+bool
+svc_coro_init(uint32_t stack_size, uint32_t cache)
+{
+	__warnx(TIRPC_DEBUG_FLAG_ERROR,
+		"%s() coroutines not supported",
+		__func__);
+	return false;
+}
+
+bool
+svc_coro_request(struct svc_req *req, enum xprt_stat *stat)
+{
+	return false;
+}
+
+bool
+svc_coro_resume(struct svc_req *req)
+{
+	return false;
+}
+
+void
+svc_coro_shutdown(void)
+{
+}
+
+#endif				/* SVC_CORO_SUPPORTED */
+
+/**
+ * @brief Suspend the calling request until svc_resume()
+ *
+ * For a handler of SVC_INIT_CORO.  The caller's stack is kept, and the
+ * work pool thread goes on to other work.
+ *
+ * @param[in] req	request being dispatched
+ *
+ * @return false, without suspending, when the request is not running on
+ * a coroutine.
+ */
+bool
+svc_suspend(struct svc_req *req)
+{
+#if defined(SVC_CORO_SUPPORTED)
+	struct svc_coro *co = svc_coro_self_get();
+
+	if (!co || co->co_req != req)
+		return false;
+
+	svc_coro_switch(&co->co_ctx, svc_coro_sched_get());
+	return true;
+#else
+	return false;
+#endif
+}
@@ -61,13 +61,16 @@
 #include <string.h>
 #include <netconfig.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <err.h>
 
 #include "rpc_com.h"
 #include "svc_internal.h"
 #include "svc_xprt.h"
+#include "svc_fair.h"
 #include <rpc/svc_rqst.h>
 #include <misc/city.h>
+#include <misc/timespec.h>
 #include <rpc/rpc_cksum.h>
 
 #ifndef MAX
@@ -78,8 +81,39 @@ static void svc_dg_rendezvous_ops(SVCXPRT *);
 static void svc_dg_override_ops(SVCXPRT *, SVCXPRT *);
 
 static void svc_dg_enable_pktinfo(int, const struct __rpc_sockinfo *);
+static bool svc_dg_enable_gro(int, const struct __rpc_sockinfo *);
 static int svc_dg_store_pktinfo(struct msghdr *, SVCXPRT *);
 
+#ifndef HAVE_RECVMMSG
+/* as recvmmsg(2) takes them */
+#define mmsghdr svc_dg_mmsghdr
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif
+
+/*
+ * Per-datagram xprts of a rendezvous, with their buffers, kept for
+ * reuse by the next datagrams instead of freed.  Those set up for a
+ * recvmmsg() and not filled stay with the rendezvous for the next.
+ */
+/* aligned for the IP*_PKTINFO of a reply */
+union svc_dg_cmsg {
+	struct cmsghdr hdr;
+	char buf[SVC_CMSG_SIZE + CMSG_SPACE(sizeof(uint16_t))]; /* GSO */
+};
+
+#define SVC_DG_GRO_SIZE (65536)
+
+struct svc_dg_pool {
+	struct poolq_head sp_head;	/* idle, by su_dr.ioq.ioq_s */
+	size_t sp_size;			/* maxrec */
+	int sp_max;			/* idle kept */
+	u_int sp_nbatch;		/* by the rendezvous receive task */
+	struct svc_dg_xprt *sp_batch[SVC_DG_BATCH_MAX];
+};
+
 /*
  * Usage:
  * xprt = svc_dg_ncreate(sock, sendsize, recvsize);
@@ -88,24 +122,162 @@ static int svc_dg_store_pktinfo(struct msghdr *, SVCXPRT *);
  * system defaults are chosen.
  * If a problem occurred, this routine returns NULL.
  */
+static struct svc_dg_pool *
+svc_dg_pool_create(size_t iosz)
+{
+	struct svc_dg_pool *pool = mem_zalloc(sizeof(*pool));
+
+	poolq_head_setup(&pool->sp_head);
+	pool->sp_size = iosz;
+	pool->sp_max = __svc_params->dg_batch * 4;
+	return (pool);
+}
+
+static void
+svc_dg_pool_destroy(struct svc_dg_pool *pool)
+{
+	struct poolq_entry *have;
+
+	while (pool->sp_nbatch)
+		mem_free(pool->sp_batch[--pool->sp_nbatch],
+			 sizeof(struct svc_dg_xprt) + pool->sp_size);
+
+	while ((have = TAILQ_FIRST(&pool->sp_head.qh))) {
+		TAILQ_REMOVE(&pool->sp_head.qh, have, q);
+		mem_free(DG_DR(opr_containerof(have, struct rpc_dplx_rec,
+					       ioq.ioq_s)),
+			 sizeof(struct svc_dg_xprt) + pool->sp_size);
+	}
+	poolq_head_destroy(&pool->sp_head);
+	mem_free(pool, sizeof(*pool));
+}
+
+/*
+ * Zeroed, except for the buffer.  Only the receive targets are set up,
+ * svc_dg_xprt_init() follows once a datagram has arrived.
+ */
+static struct svc_dg_xprt *
+svc_dg_pool_get(struct svc_dg_pool *pool)
+{
+	struct poolq_entry *have;
+	struct svc_dg_xprt *su;
+
+	pthread_mutex_lock(&pool->sp_head.qmutex);
+	have = TAILQ_FIRST(&pool->sp_head.qh);
+	if (have) {
+		TAILQ_REMOVE(&pool->sp_head.qh, have, q);
+		(pool->sp_head.qcount)--;
+	}
+	pthread_mutex_unlock(&pool->sp_head.qmutex);
+
+	if (have)
+		su = DG_DR(opr_containerof(have, struct rpc_dplx_rec,
+					   ioq.ioq_s));
+	else
+		su = mem_alloc(sizeof(struct svc_dg_xprt) + pool->sp_size);
+
+	memset(su, 0, sizeof(struct svc_dg_xprt));
+	su->su_pool = pool;
+	return (su);
+}
+
+static void
+svc_dg_pool_put(struct svc_dg_pool *pool, struct svc_dg_xprt *su)
+{
+	pthread_mutex_lock(&pool->sp_head.qmutex);
+	if (pool->sp_head.qcount < pool->sp_max) {
+		TAILQ_INSERT_HEAD(&pool->sp_head.qh, &su->su_dr.ioq.ioq_s, q);
+		(pool->sp_head.qcount)++;
+		su = NULL;
+	}
+	pthread_mutex_unlock(&pool->sp_head.qmutex);
+
+	if (su)
+		mem_free(su, sizeof(struct svc_dg_xprt) + pool->sp_size);
+}
+
+#ifdef HAVE_SENDMMSG
+/*
+ * Replies waiting for a sendmmsg() on their rendezvous socket.  A reply
+ * finding no leader makes its thread the leader, which sends it at once
+ * with any already queued.  Replies arriving meanwhile are queued, and
+ * the leader sends them together once its send returns, for up to
+ * dg_send_us; then the next reply leads.  So a reply alone is never
+ * delayed, and replies are batched only when they wait anyway.  Each
+ * queued xprt holds a reference, keeping its buffer until sent.
+ */
+struct svc_dg_sendq {
+	mutex_t sq_lock;
+	SVCXPRT *sq_xprt[SVC_DG_BATCH_MAX];
+	size_t sq_len[SVC_DG_BATCH_MAX];
+	u_int sq_count;
+	bool sq_leader;
+	bool sq_gso;		/* SVC_FLAG_UDP_GSO, and the kernel has it */
+};
+
+static struct svc_dg_sendq *
+svc_dg_sendq_create(int fd)
+{
+	struct svc_dg_sendq *sq = mem_zalloc(sizeof(*sq));
+
+	mutex_init(&sq->sq_lock, NULL);
+#ifdef UDP_SEGMENT
+	if (__svc_params->flags & SVC_FLAG_UDP_GSO) {
+		int gso;
+		socklen_t len = sizeof(gso);
+
+		sq->sq_gso = !getsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso, &len);
+	}
+#endif
+	return (sq);
+}
+
+static void
+svc_dg_sendq_destroy(struct svc_dg_sendq *sq)
+{
+	mutex_destroy(&sq->sq_lock);
+	mem_free(sq, sizeof(*sq));
+}
+#endif /* HAVE_SENDMMSG */
+
 static void
 svc_dg_xprt_free(struct svc_dg_xprt *su)
 {
+	struct svc_dg_pool *pool = su->su_pool;
+
 	XDR_DESTROY(su->su_dr.ioq.xdrs);
 	rpc_dplx_rec_destroy(&su->su_dr);
+
+	if (pool && su->su_dr.xprt.xp_parent) {
+		/* per-datagram */
+		svc_dg_pool_put(pool, su);
+		return;
+	}
+	if (pool)
+		svc_dg_pool_destroy(pool);
+#ifdef HAVE_SENDMMSG
+	if (su->su_sendq)
+		svc_dg_sendq_destroy(su->su_sendq);
+#endif
 	mem_free(su, sizeof(struct svc_dg_xprt) + su->su_dr.maxrec);
 }
 
-static struct svc_dg_xprt *
-svc_dg_xprt_zalloc(size_t iosz)
+static void
+svc_dg_xprt_init(struct svc_dg_xprt *su)
 {
-	struct svc_dg_xprt *su = mem_zalloc(sizeof(struct svc_dg_xprt) + iosz);
-
 	/* Init SVCXPRT locks, etc */
 	rpc_dplx_rec_init(&su->su_dr);
 	/* Extra ref to match TCP */
 	SVC_REF(&su->su_dr.xprt, SVC_REF_FLAG_NONE);
 	xdr_ioq_setup(&su->su_dr.ioq);
+}
+
+static struct svc_dg_xprt *
+svc_dg_xprt_zalloc(size_t iosz)
+{
+	struct svc_dg_xprt *su = mem_zalloc(sizeof(struct svc_dg_xprt) + iosz);
+
+	svc_dg_xprt_init(su);
 	return (su);
 }
 
@@ -196,6 +368,14 @@ svc_dg_ncreatef(const int fd, const u_int sendsz, const u_int recvsz,
 	su->su_dr.sendsz = ((sendsize + 3) / 4) * 4;
 	su->su_dr.recvsz = ((recvsize + 3) / 4) * 4;
 	su->su_dr.maxrec = ((MAX(sendsize, recvsize) + 3) / 4) * 4;
+	su->su_pool = svc_dg_pool_create(
+			svc_dg_enable_gro(fd, &si)
+			? MAX(su->su_dr.maxrec, SVC_DG_GRO_SIZE)
+			: su->su_dr.maxrec);
+#ifdef HAVE_SENDMMSG
+	if (__svc_params->flags & SVC_FLAG_DG_SENDMMSG)
+		su->su_sendq = svc_dg_sendq_create(fd);
+#endif
 
 	/* duplex streams are not used by the rendezvous transport */
 	xdrmem_create(su->su_dr.ioq.xdrs, NULL, 0, XDR_ENCODE);
@@ -231,67 +411,79 @@ svc_dg_stat(SVCXPRT *xprt)
 	return SVC_STAT(xprt->xp_parent);
 }
 
-static enum xprt_stat
-svc_dg_rendezvous(SVCXPRT *xprt)
+static inline void
+svc_dg_rendezvous_msg(struct svc_dg_xprt *su, struct msghdr *mesgp,
+		      struct iovec *iov)
 {
-	struct svc_dg_xprt *req_su = su_data(xprt);
-	struct svc_dg_xprt *su = svc_dg_xprt_zalloc(req_su->su_dr.maxrec);
-	SVCXPRT *newxprt = &su->su_dr.xprt;
-	struct sockaddr *sp = (struct sockaddr *)&newxprt->xp_remote.ss;
-	struct msghdr *mesgp;
-	struct timespec now;
-	struct iovec iov;
-	ssize_t rlen;
-
-	newxprt->xp_fd = xprt->xp_fd;
-	newxprt->xp_flags = SVC_XPRT_FLAG_INITIAL | SVC_XPRT_FLAG_INITIALIZED;
-
-	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
-	su->su_dr.call_xid = __RPC_GETXID(&now);
-	su->su_dr.sendsz = req_su->su_dr.sendsz;
-	su->su_dr.recvsz = req_su->su_dr.recvsz;
-	su->su_dr.maxrec = req_su->su_dr.maxrec;
-	svc_dg_override_ops(newxprt, xprt);
+	struct sockaddr *sp = (struct sockaddr *)&su->su_dr.xprt.xp_remote.ss;
 
- again:
-	iov.iov_base = &su[1];
-	iov.iov_len = su->su_dr.maxrec;
-	mesgp = &su->su_msghdr;
+	iov->iov_base = &su[1];
+	iov->iov_len = su->su_pool->sp_size;
 	memset(mesgp, 0, sizeof(*mesgp));
-	mesgp->msg_iov = &iov;
+	mesgp->msg_iov = iov;
 	mesgp->msg_iovlen = 1;
 	mesgp->msg_name = sp;
 	sp->sa_family = (sa_family_t) 0xffff;
 	mesgp->msg_namelen = sizeof(struct sockaddr_storage);
 	mesgp->msg_control = su->su_cmsg;
 	mesgp->msg_controllen = sizeof(su->su_cmsg);
+}
 
-	rlen = recvmsg(newxprt->xp_fd, mesgp, 0);
+static int
+svc_dg_rendezvous_recv(int fd, struct mmsghdr *mm, u_int count)
+{
+#ifdef HAVE_RECVMMSG
+	/* block for the first as recvmsg() did, then take what is queued */
+	return recvmmsg(fd, mm, count, MSG_WAITFORONE, NULL);
+#else
+	ssize_t rlen = recvmsg(fd, &mm[0].msg_hdr, 0);
 
-	if (rlen == -1 && errno == EINTR)
-		goto again;
+	if (rlen < 0)
+		return (-1);
+	mm[0].msg_len = rlen;
+	return (1);
+#endif
+}
 
-	if (unlikely(svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV))) {
+/*
+ * Returns false when the datagram is dropped.
+ */
+static bool
+svc_dg_rendezvous_setup(SVCXPRT *xprt, struct svc_dg_xprt *su,
+			struct mmsghdr *mm)
+{
+	struct svc_dg_xprt *req_su = su_data(xprt);
+	SVCXPRT *newxprt = &su->su_dr.xprt;
+	struct sockaddr *sp = (struct sockaddr *)&newxprt->xp_remote.ss;
+	struct msghdr *mesgp = &su->su_msghdr;
+	struct timespec now;
+
+	if (sp->sa_family == (sa_family_t) 0xffff) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
-			__func__, xprt, xprt->xp_fd);
-		svc_dg_xprt_free(su);
-		return (XPRT_DIED);
+			"%s: Bad message sa_family is 0xffff",
+			__func__);
+		return (false);
 	}
 
-        if (sp->sa_family == (sa_family_t) 0xffff) {
-                __warnx(TIRPC_DEBUG_FLAG_ERROR,
-                        "%s: Bad message sa_family is 0xffff",
-                        __func__);
-                return SVC_STAT(xprt);
-        }
+	if (mm->msg_len < (4 * sizeof(u_int32_t))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: Bad message rlen: %u",
+			__func__, mm->msg_len);
+		return (false);
+	}
+
+	*mesgp = mm->msg_hdr;
+	svc_dg_xprt_init(su);
 
-        if (rlen == -1 || (rlen < (ssize_t) (4 * sizeof(u_int32_t)))) {
-                __warnx(TIRPC_DEBUG_FLAG_ERROR,
-                        "%s: Bad message rlen: %d",
-                        __func__, rlen);
-                return SVC_STAT(xprt);
-        }
+	newxprt->xp_fd = xprt->xp_fd;
+	newxprt->xp_flags = SVC_XPRT_FLAG_INITIAL | SVC_XPRT_FLAG_INITIALIZED;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+	su->su_dr.call_xid = __RPC_GETXID(&now);
+	su->su_dr.sendsz = req_su->su_dr.sendsz;
+	su->su_dr.recvsz = req_su->su_dr.recvsz;
+	su->su_dr.maxrec = req_su->su_dr.maxrec;
+	svc_dg_override_ops(newxprt, xprt);
 
 	__rpc_address_setup(&newxprt->xp_local);
 	__rpc_address_setup(&newxprt->xp_remote);
@@ -310,12 +502,168 @@ svc_dg_rendezvous(SVCXPRT *xprt)
 	__rpc_set_blkin_endpoint(newxprt, "svc_dg");
 #endif
 
-	xdrmem_create(su->su_dr.ioq.xdrs, iov.iov_base, iov.iov_len,
+	xdrmem_create(su->su_dr.ioq.xdrs, (char *)&su[1], su->su_dr.maxrec,
 		      XDR_DECODE);
 
 	SVC_REF(xprt, SVC_REF_FLAG_NONE);
 	newxprt->xp_parent = xprt;
-	return (xprt->xp_dispatch.rendezvous_cb(newxprt));
+	return (true);
+}
+
+static void
+svc_dg_rendezvous_task(struct work_pool_entry *wpe)
+{
+	struct rpc_dplx_rec *rec =
+			opr_containerof(wpe, struct rpc_dplx_rec, ioq.ioq_wpe);
+	SVCXPRT *newxprt = &rec->xprt;
+
+	atomic_clear_uint16_t_bits(&rec->ioq.ioq_s.qflags, IOQ_FLAG_WORKING);
+
+	(void)newxprt->xp_parent->xp_dispatch.rendezvous_cb(newxprt);
+}
+
+static void
+svc_dg_rendezvous_submit(struct svc_dg_xprt *su)
+{
+	/* as svc_dg_destroy_it() expects of the ioq_wpe */
+	atomic_set_uint16_t_bits(&su->su_dr.ioq.ioq_s.qflags,
+				 IOQ_FLAG_WORKING);
+	su->su_dr.ioq.ioq_wpe.fun = svc_dg_rendezvous_task;
+	if (__svc_params->flags & SVC_FLAG_FAIR)
+		svc_fair_submit(&su->su_dr.ioq.ioq_wpe, &su->su_dr.xprt);
+	else
+		work_pool_submit(&svc_work_pool, &su->su_dr.ioq.ioq_wpe,
+				 WORK_POOL_PRIO_NORMAL);
+}
+
+#ifdef UDP_GRO
+/*
+ * With UDP_GRO, datagrams of one flow may arrive coalesced, their
+ * segment size in a cmsg.  Each segment after the first is copied to an
+ * xprt of its own and dispatched; the first is left for the caller.
+ */
+static void
+svc_dg_rendezvous_gro(SVCXPRT *xprt, struct svc_dg_xprt *su,
+		      struct mmsghdr *mm)
+{
+	struct svc_dg_pool *pool = su_data(xprt)->su_pool;
+	struct msghdr *mesgp = &mm->msg_hdr;
+	struct svc_dg_xprt *next;
+	struct cmsghdr *cmsg;
+	struct mmsghdr seg;
+	struct iovec iov;
+	u_int gso_size = 0;
+	u_int off;
+
+	if (mesgp->msg_flags & MSG_CTRUNC)
+		return;
+
+	for (cmsg = CMSG_FIRSTHDR(mesgp); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(mesgp, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP
+		 && cmsg->cmsg_type == UDP_GRO) {
+			gso_size = *(int *)CMSG_DATA(cmsg);
+			break;
+		}
+	}
+	if (!gso_size || mm->msg_len <= gso_size)
+		return;
+
+	for (off = gso_size; off < mm->msg_len; off += gso_size) {
+		next = svc_dg_pool_get(pool);
+		svc_dg_rendezvous_msg(next, &seg.msg_hdr, &iov);
+		memcpy(&next->su_dr.xprt.xp_remote.ss,
+		       &su->su_dr.xprt.xp_remote.ss,
+		       sizeof(struct sockaddr_storage));
+		memcpy(next->su_cmsg, su->su_cmsg, mesgp->msg_controllen);
+		seg.msg_hdr.msg_namelen = mesgp->msg_namelen;
+		seg.msg_hdr.msg_controllen = mesgp->msg_controllen;
+		seg.msg_hdr.msg_flags = mesgp->msg_flags;
+		seg.msg_len = MIN(gso_size, mm->msg_len - off);
+		memcpy(&next[1], (char *)&su[1] + off, seg.msg_len);
+
+		if (svc_dg_rendezvous_setup(xprt, next, &seg))
+			svc_dg_rendezvous_submit(next);
+		else
+			svc_dg_pool_put(pool, next);
+	}
+	mm->msg_len = gso_size;
+}
+#endif /* UDP_GRO */
+
+/*
+ * Takes up to dg_batch datagrams per event.  The first is dispatched
+ * in this task as before, the others each in a task of its own.  With
+ * SVC_FLAG_FAIR, all of them wait on their client's flow instead.
+ *
+ * Only the xprts filled are taken from the batch, and replaced from the
+ * pool at the next event.
+ */
+static enum xprt_stat
+svc_dg_rendezvous(SVCXPRT *xprt)
+{
+	struct svc_dg_xprt *req_su = su_data(xprt);
+	struct svc_dg_pool *pool = req_su->su_pool;
+	struct svc_dg_xprt *su[SVC_DG_BATCH_MAX];
+	struct mmsghdr mm[SVC_DG_BATCH_MAX];
+	struct iovec iov[SVC_DG_BATCH_MAX];
+	struct svc_dg_xprt *first = NULL;
+	u_int batch = 1;
+	int count;
+	int ix;
+
+#ifdef HAVE_RECVMMSG
+	batch = __svc_params->dg_batch;
+#endif
+	while (pool->sp_nbatch < batch)
+		pool->sp_batch[pool->sp_nbatch++] = svc_dg_pool_get(pool);
+	for (ix = 0; ix < batch; ix++) {
+		svc_dg_rendezvous_msg(pool->sp_batch[ix], &mm[ix].msg_hdr,
+				      &iov[ix]);
+		mm[ix].msg_len = 0;
+	}
+
+	do {
+		count = svc_dg_rendezvous_recv(xprt->xp_fd, mm, batch);
+	} while (count == -1 && errno == EINTR);
+
+	if (count < 0)
+		count = 0;
+
+	/* the filled ones, before the rearm lets the next event in */
+	memcpy(su, pool->sp_batch, count * sizeof(*su));
+	pool->sp_nbatch -= count;
+	memmove(pool->sp_batch, &pool->sp_batch[count],
+		pool->sp_nbatch * sizeof(*su));
+
+	if (unlikely(svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		for (ix = 0; ix < count; ix++)
+			svc_dg_pool_put(pool, su[ix]);
+		return (XPRT_DIED);
+	}
+
+	for (ix = 0; ix < count; ix++) {
+#ifdef UDP_GRO
+		svc_dg_rendezvous_gro(xprt, su[ix], &mm[ix]);
+#endif
+		if (!svc_dg_rendezvous_setup(xprt, su[ix], &mm[ix])) {
+			svc_dg_pool_put(pool, su[ix]);
+			continue;
+		}
+		if (!first && !(__svc_params->flags & SVC_FLAG_FAIR)) {
+			first = su[ix];
+			continue;
+		}
+		svc_dg_rendezvous_submit(su[ix]);
+	}
+
+	if (!first)
+		return SVC_STAT(xprt);
+
+	return (xprt->xp_dispatch.rendezvous_cb(&first->su_dr.xprt));
 }
 
 static enum xprt_stat
@@ -388,6 +736,208 @@ svc_dg_checksum(struct svc_req *req, void *data, size_t length)
 #endif
 }
 
+/*
+ * Reply to the client's address, from the local address it was sent to.
+ */
+static void
+svc_dg_reply_msg(SVCXPRT *xprt, struct msghdr *msg, struct iovec *iov,
+		 union svc_dg_cmsg *control, size_t slen)
+{
+	struct cmsghdr *cmsg;
+
+	iov->iov_base = &su_data(xprt)[1];
+	iov->iov_len = slen;
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
+	msg->msg_name = (struct sockaddr *)&xprt->xp_remote.ss;
+	msg->msg_namelen = sizeof(struct sockaddr_storage);
+	msg->msg_control = control;
+	msg->msg_controllen = sizeof(*control);
+	msg->msg_flags = 0;
+
+	cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = (xprt->xp_local.ss.ss_family == AF_INET)
+		? IPPROTO_IP : IPPROTO_IPV6; /* a.k.a. SOL_IP and SOL_IPV6 */
+	cmsg->cmsg_type = (xprt->xp_local.ss.ss_family == AF_INET)
+		? IP_PKTINFO : IPV6_PKTINFO;
+	if (xprt->xp_local.ss.ss_family == AF_INET)
+		*(struct in_pktinfo*)CMSG_DATA(cmsg) =
+			*(struct in_pktinfo*) &xprt->xp_pktinfo;
+	else
+		*(struct in6_pktinfo*)CMSG_DATA(cmsg) =
+			*(struct in6_pktinfo*) &xprt->xp_pktinfo;
+	cmsg->cmsg_len = (xprt->xp_local.ss.ss_family == AF_INET)
+		? CMSG_LEN(sizeof(struct in_pktinfo))
+		: CMSG_LEN(sizeof(struct in6_pktinfo));
+	msg->msg_controllen = (xprt->xp_local.ss.ss_family == AF_INET)
+		? CMSG_SPACE(sizeof(struct in_pktinfo))
+		: CMSG_SPACE(sizeof(struct in6_pktinfo));
+}
+
+#ifdef HAVE_SENDMMSG
+#ifdef UDP_SEGMENT
+/*
+ * Replies to the same peer from the same address, all of one size but
+ * a shorter last, go as one GSO send the kernel segments.  The size is
+ * kept below an ethernet MTU, as a larger one fails the send.
+ */
+#define SVC_DG_GSO_SIZE (1500 - 40 - 8)
+#define SVC_DG_GSO_SEGS (64)
+#define SVC_DG_GSO_BYTES (65535 - 40 - 8)
+
+static u_int
+svc_dg_sendq_gso(SVCXPRT **xprts, size_t *lens, u_int count)
+{
+	SVCXPRT *xprt = xprts[0];
+	size_t size = lens[0];
+	size_t total = size;
+	u_int ix;
+
+	if (size > SVC_DG_GSO_SIZE)
+		return (1);
+
+	for (ix = 1; ix < count && ix < SVC_DG_GSO_SEGS; ix++) {
+		if (lens[ix] > size || lens[ix - 1] != size
+		 || total + lens[ix] > SVC_DG_GSO_BYTES
+		 || xprts[ix]->xp_remote.nb.len != xprt->xp_remote.nb.len
+		 || memcmp(&xprts[ix]->xp_remote.ss, &xprt->xp_remote.ss,
+			   xprt->xp_remote.nb.len)
+		 || memcmp(&xprts[ix]->xp_pktinfo, &xprt->xp_pktinfo,
+			   sizeof(xprt->xp_pktinfo)))
+			break;
+		total += lens[ix];
+	}
+	return (ix);
+}
+#endif /* UDP_SEGMENT */
+
+static void
+svc_dg_sendq_flush(int fd, SVCXPRT **xprts, size_t *lens, u_int count,
+		   bool gso)
+{
+	struct mmsghdr mm[SVC_DG_BATCH_MAX];
+	struct iovec iov[SVC_DG_BATCH_MAX];
+	union svc_dg_cmsg control[SVC_DG_BATCH_MAX];
+	u_int msgs = 0;
+	u_int segs;
+	u_int ix;
+	int sent;
+
+	for (ix = 0; ix < count; ix += segs) {
+		struct msghdr *msg = &mm[msgs].msg_hdr;
+
+		svc_dg_reply_msg(xprts[ix], msg, &iov[ix], &control[msgs],
+				 lens[ix]);
+		mm[msgs++].msg_len = 0;
+		segs = 1;
+#ifdef UDP_SEGMENT
+		if (gso)
+			segs = svc_dg_sendq_gso(&xprts[ix], &lens[ix],
+						count - ix);
+		if (segs > 1) {
+			struct cmsghdr *cmsg;
+			u_int jx;
+
+			for (jx = 1; jx < segs; jx++) {
+				iov[ix + jx].iov_base = &su_data(xprts[ix + jx])[1];
+				iov[ix + jx].iov_len = lens[ix + jx];
+			}
+			msg->msg_iovlen = segs;
+
+			/* after the pktinfo */
+			cmsg = (struct cmsghdr *)
+				((char *)msg->msg_control + msg->msg_controllen);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*(uint16_t *)CMSG_DATA(cmsg) = lens[ix];
+			msg->msg_controllen += CMSG_SPACE(sizeof(uint16_t));
+		}
+#endif
+	}
+
+	for (ix = 0; ix < msgs; ix += sent) {
+		sent = sendmmsg(fd, &mm[ix], msgs - ix, 0);
+		if (sent > 0)
+			continue;
+		if (sent < 0 && errno == EINTR) {
+			sent = 0;
+			continue;
+		}
+		/* datagram lost, as a failed sendmsg() would be */
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: fd %d err %d sendmmsg failed",
+			__func__, fd, errno);
+		sent = 1;
+	}
+
+	for (ix = 0; ix < count; ix++)
+		SVC_RELEASE(xprts[ix], SVC_RELEASE_FLAG_NONE);
+}
+
+static void
+svc_dg_sendq_add(struct svc_dg_sendq *sq, SVCXPRT *xprt, size_t slen)
+{
+	SVCXPRT *xprts[SVC_DG_BATCH_MAX];
+	size_t lens[SVC_DG_BATCH_MAX];
+	struct timespec budget = {
+		.tv_sec = 0,
+		.tv_nsec = __svc_params->dg_send_ns,
+	};
+	struct timespec until;
+	struct timespec now;
+	u_int batch = __svc_params->dg_batch;
+	u_int count;
+	bool more;
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+
+	mutex_lock(&sq->sq_lock);
+	if (sq->sq_count >= batch) {
+		/* the leader has yet to take them */
+		mutex_unlock(&sq->sq_lock);
+		svc_dg_sendq_flush(xprt->xp_fd, &xprt, &slen, 1, false);
+		return;
+	}
+	sq->sq_xprt[sq->sq_count] = xprt;
+	sq->sq_len[sq->sq_count] = slen;
+	sq->sq_count++;
+
+	if (sq->sq_leader) {
+		/* sent when the leader's current send returns */
+		mutex_unlock(&sq->sq_lock);
+		return;
+	}
+	sq->sq_leader = true;
+	(void)clock_gettime(CLOCK_MONOTONIC, &until);
+	timespecadd(&until, &budget, &until);
+
+	do {
+		count = sq->sq_count;
+		memcpy(xprts, sq->sq_xprt, count * sizeof(SVCXPRT *));
+		memcpy(lens, sq->sq_len, count * sizeof(size_t));
+		sq->sq_count = 0;
+
+		/* after dg_send_us, replies queued from here on lead */
+		(void)clock_gettime(CLOCK_MONOTONIC, &now);
+		more = timespeccmp(&now, &until, <);
+		if (!more)
+			sq->sq_leader = false;
+		mutex_unlock(&sq->sq_lock);
+
+		svc_dg_sendq_flush(xprt->xp_fd, xprts, lens, count,
+				   sq->sq_gso);
+		if (!more)
+			return;
+
+		mutex_lock(&sq->sq_lock);
+	} while (sq->sq_count);
+
+	sq->sq_leader = false;
+	mutex_unlock(&sq->sq_lock);
+}
+#endif /* HAVE_SENDMMSG */
+
 static enum xprt_stat
 svc_dg_reply(struct svc_req *req)
 {
@@ -396,10 +946,9 @@ svc_dg_reply(struct svc_req *req)
 	XDR *xdrs = rec->ioq.xdrs;
 	struct svc_dg_xprt *su = DG_DR(rec);
 	struct msghdr *msg = &su->su_msghdr;
-	struct cmsghdr* cmsg;
+	union svc_dg_cmsg control;
 	struct iovec iov;
 	size_t slen;
-        char msg_control[sizeof(struct cmsghdr) + sizeof(struct in6_pktinfo)];
 
 	if (!xprt->xp_remote.nb.len) {
 		__warnx(TIRPC_DEBUG_FLAG_WARN,
@@ -426,33 +975,16 @@ svc_dg_reply(struct svc_req *req)
 			__func__, xprt, xprt->xp_fd);
 		return (XPRT_DIED);
 	}
-	iov.iov_base = &su[1];
-	iov.iov_len = slen = XDR_GETPOS(xdrs);
-	msg->msg_iov = &iov;
-	msg->msg_iovlen = 1;
-	msg->msg_name = (struct sockaddr *)&xprt->xp_remote.ss;
-	msg->msg_namelen = sizeof(struct sockaddr_storage);
-	msg->msg_control = msg_control;
-	msg->msg_controllen = sizeof(msg_control);
-	msg->msg_flags = 0;
+	slen = XDR_GETPOS(xdrs);
 
-	cmsg = CMSG_FIRSTHDR(msg);
-	cmsg->cmsg_level = (xprt->xp_local.ss.ss_family == AF_INET)
-		? IPPROTO_IP : IPPROTO_IPV6; /* a.k.a. SOL_IP and SOL_IPV6 */
-	cmsg->cmsg_type = (xprt->xp_local.ss.ss_family == AF_INET)
-		? IP_PKTINFO : IPV6_PKTINFO;
-	if (xprt->xp_local.ss.ss_family == AF_INET)
-		*(struct in_pktinfo*)CMSG_DATA(cmsg) =
-			*(struct in_pktinfo*) &xprt->xp_pktinfo;
-	else
-		*(struct in6_pktinfo*)CMSG_DATA(cmsg) =
-			*(struct in6_pktinfo*) &xprt->xp_pktinfo;
-	cmsg->cmsg_len = (xprt->xp_local.ss.ss_family == AF_INET)
-		? CMSG_LEN(sizeof(struct in_pktinfo))
-		: CMSG_LEN(sizeof(struct in6_pktinfo));
-	msg->msg_controllen = (xprt->xp_local.ss.ss_family == AF_INET)
-		? CMSG_SPACE(sizeof(struct in_pktinfo))
-		: CMSG_SPACE(sizeof(struct in6_pktinfo));
+#ifdef HAVE_SENDMMSG
+	if (xprt->xp_parent && su_data(xprt->xp_parent)->su_sendq) {
+		svc_dg_sendq_add(su_data(xprt->xp_parent)->su_sendq,
+				 xprt, slen);
+		return (XPRT_IDLE);
+	}
+#endif
+	svc_dg_reply_msg(xprt, msg, &iov, &control, slen);
 
 	if (sendmsg(xprt->xp_fd, msg, 0) != (ssize_t) slen) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
@@ -470,6 +1002,7 @@ svc_dg_destroy_task(struct work_pool_entry *wpe)
 	struct rpc_dplx_rec *rec =
 			opr_containerof(wpe, struct rpc_dplx_rec, ioq.ioq_wpe);
 	SVCXPRT *xprt = &rec->xprt;
+	SVCXPRT *parent;
 	uint16_t xp_flags;
 
 	const int32_t xp_refcnt = atomic_fetch_int32_t(&rec->xprt.xp_refcnt);
@@ -478,8 +1011,11 @@ svc_dg_destroy_task(struct work_pool_entry *wpe)
 		__func__, xprt, xprt->xp_fd, xp_refcnt);
 
 	if (xp_refcnt > 0) {
-		/* instead of nanosleep */
-		work_pool_submit(&svc_work_pool, &(rec->ioq.ioq_wpe));
+		/* instead of nanosleep; not ahead of the completions that
+		 * hold the references, or it could run in their place
+		 */
+		work_pool_submit(&svc_work_pool, &(rec->ioq.ioq_wpe),
+				 WORK_POOL_PRIO_NORMAL);
 		return;
 	} else if (unlikely(xp_refcnt < 0)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
@@ -507,10 +1043,12 @@ svc_dg_destroy_task(struct work_pool_entry *wpe)
 	if (rec->xprt.xp_netid)
 		mem_free(rec->xprt.xp_netid, 0);
 
-	if (rec->xprt.xp_parent)
-		SVC_RELEASE(rec->xprt.xp_parent, SVC_RELEASE_FLAG_NONE);
-
+	/* to the parent's pool, before the parent can go */
+	parent = rec->xprt.xp_parent;
 	svc_dg_xprt_free(DG_DR(rec));
+
+	if (parent)
+		SVC_RELEASE(parent, SVC_RELEASE_FLAG_NONE);
 }
 
 static void
@@ -544,7 +1082,8 @@ svc_dg_destroy_it(SVCXPRT *xprt, u_int flags, const char *tag, const int line)
 	}
 
 	REC_XPRT(xprt)->ioq.ioq_wpe.fun = svc_dg_destroy_task;
-	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe));
+	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe),
+			 WORK_POOL_PRIO_HIGH);
 }
 
 extern mutex_t ops_lock;
@@ -662,6 +1201,24 @@ svc_dg_enable_pktinfo(int fd, const struct __rpc_sockinfo *si)
 	}
 }
 
+/*
+ * Coalesced receives fill buffers of up to SVC_DG_GRO_SIZE.
+ */
+static bool
+svc_dg_enable_gro(int fd, const struct __rpc_sockinfo *si)
+{
+#ifdef UDP_GRO
+	int on = 1;
+
+	if (!(__svc_params->flags & SVC_FLAG_UDP_GRO)
+	 || si->si_proto != IPPROTO_UDP)
+		return (false);
+	return (!setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)));
+#else
+	return (false);
+#endif
+}
+
 static int
 svc_dg_store_in_pktinfo(struct cmsghdr *cmsg, SVCXPRT *xprt)
 {
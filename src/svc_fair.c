@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file svc_fair.c
+ * @brief Per-client fair scheduling of receive tasks
+ *
+ * @section DESCRIPTION
+ *
+ * With SVC_INIT_FAIR, receive tasks are not submitted directly to
+ * svc_work_pool.  They wait on a flow per client key, by default the
+ * remote address, else from svc_init_params fair_cb.
+ *
+ * A fixed number of tokens (fair_workers) admit them, each token being
+ * a work pool task that takes one receive task, queues itself again
+ * behind other work, and then runs the receive task.  So a token is
+ * never held by a handler that blocks, and the tokens pace admission
+ * at the rate the pool drains its queue.  Tokens take from the
+ * backlogged flows by deficit round robin, each flow receiving its
+ * weight in requests per round.  So under overload no client is
+ * admitted more than its weighted share, however many connections or
+ * pipelined calls it has.  With no backlog, a receive task waits only
+ * for a token.
+ *
+ * UDP datagrams each have a flow by their own remote address.
+ *
+ * A flow is freed when its queue empties.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <misc/opr_queue.h>
+#include <misc/rbtree.h>
+#include <rpc/rpc.h>
+#include "svc_internal.h"
+#include "svc_fair.h"
+
+struct svc_fair_flow {
+	struct opr_rbtree_node ff_node;	/* svc_fair.flows, by key */
+	struct opr_queue ff_round;	/* svc_fair.round, while backlogged */
+	TAILQ_HEAD(svc_fair_q, poolq_entry) ff_q;
+	uint64_t ff_key;
+	uint32_t ff_depth;
+	uint32_t ff_weight;	/* requests per round */
+	uint32_t ff_deficit;	/* remaining this round */
+};
+
+static struct svc_fair {
+	mutex_t lock;
+	struct opr_rbtree flows;
+	struct opr_queue round;	/* head is being served */
+	struct work_pool_entry *tokens;
+	struct work_pool_entry **idle;	/* tokens not submitted */
+	uint32_t n_tokens;
+	uint32_t n_idle;
+	uint32_t depth;
+} svc_fair = {
+	MUTEX_INITIALIZER,
+};
+
+static int
+svc_fair_cmpf(const struct opr_rbtree_node *lhs,
+	      const struct opr_rbtree_node *rhs)
+{
+	struct svc_fair_flow *lk, *rk;
+
+	lk = opr_containerof(lhs, struct svc_fair_flow, ff_node);
+	rk = opr_containerof(rhs, struct svc_fair_flow, ff_node);
+
+	if (lk->ff_key < rk->ff_key)
+		return (-1);
+
+	if (lk->ff_key == rk->ff_key)
+		return (0);
+
+	return (1);
+}
+
+/*
+ * Default key, the remote address without its port, so that all the
+ * connections of a client share one flow.
+ */
+static uint64_t
+svc_fair_key(SVCXPRT *xprt, uint32_t *weight)
+{
+	struct sockaddr_storage *ss = &xprt->xp_remote.ss;
+	uint64_t key[2];
+
+	if (__svc_params->fair_cb)
+		return (__svc_params->fair_cb(xprt, weight));
+
+	switch (ss->ss_family) {
+	case AF_INET:
+		return (((struct sockaddr_in *)ss)->sin_addr.s_addr);
+	case AF_INET6:
+		memcpy(key, &((struct sockaddr_in6 *)ss)->sin6_addr,
+		       sizeof(key));
+		return (key[0] ^ key[1]);
+	default:
+		/* local, each transport its own */
+		return ((uintptr_t)xprt);
+	}
+}
+
+/*
+ * Next receive task by deficit round robin.  Each task costs one, so a
+ * flow is served its weight in tasks before the round moves on.
+ *
+ * @note Locking
+ * - svc_fair.lock held
+ */
+static struct work_pool_entry *
+svc_fair_next(void)
+{
+	struct svc_fair_flow *flow;
+	struct poolq_entry *pqe;
+
+	if (opr_queue_IsEmpty(&svc_fair.round))
+		return (NULL);
+
+	flow = opr_queue_First(&svc_fair.round, struct svc_fair_flow,
+			       ff_round);
+	if (!flow->ff_deficit)
+		flow->ff_deficit = flow->ff_weight;
+
+	pqe = TAILQ_FIRST(&flow->ff_q);
+	TAILQ_REMOVE(&flow->ff_q, pqe, q);
+	flow->ff_deficit--;
+	flow->ff_depth--;
+	svc_fair.depth--;
+
+	if (!flow->ff_depth) {
+		opr_queue_Remove(&flow->ff_round);
+		opr_rbtree_remove(&svc_fair.flows, &flow->ff_node);
+		mem_free(flow, sizeof(*flow));
+	} else if (!flow->ff_deficit) {
+		/* turn over, to the back of the round */
+		opr_queue_Remove(&flow->ff_round);
+		opr_queue_Append(&svc_fair.round, &flow->ff_round);
+	}
+	return ((struct work_pool_entry *)pqe);
+}
+
+static void
+svc_fair_run(struct work_pool_entry *token)
+{
+	struct work_pool_entry *wpe;
+
+	mutex_lock(&svc_fair.lock);
+	wpe = svc_fair_next();
+	if (!wpe) {
+		svc_fair.idle[svc_fair.n_idle++] = token;
+		mutex_unlock(&svc_fair.lock);
+		return;
+	}
+	mutex_unlock(&svc_fair.lock);
+
+	/* behind the work (and event channels) queued meanwhile, and free
+	 * for another worker while this task runs
+	 */
+	work_pool_submit(&svc_work_pool, token, WORK_POOL_PRIO_NORMAL);
+
+	wpe->fun(wpe);
+}
+
+void
+svc_fair_init(uint32_t tokens)
+{
+	uint32_t ix;
+
+	mutex_lock(&svc_fair.lock);
+	if (svc_fair.tokens) {
+		mutex_unlock(&svc_fair.lock);
+		return;
+	}
+
+	opr_rbtree_init(&svc_fair.flows, svc_fair_cmpf);
+	opr_queue_Init(&svc_fair.round);
+
+	svc_fair.n_tokens = tokens ? tokens : 1;
+	svc_fair.tokens = mem_zalloc(svc_fair.n_tokens
+				     * sizeof(struct work_pool_entry));
+	svc_fair.idle = mem_alloc(svc_fair.n_tokens
+				  * sizeof(struct work_pool_entry *));
+	for (ix = 0; ix < svc_fair.n_tokens; ix++) {
+		svc_fair.tokens[ix].fun = svc_fair_run;
+		svc_fair.idle[ix] = &svc_fair.tokens[ix];
+	}
+	svc_fair.n_idle = svc_fair.n_tokens;
+	mutex_unlock(&svc_fair.lock);
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: %" PRIu32 " fair workers",
+		__func__, svc_fair.n_tokens);
+}
+
+/**
+ * @brief Queue a receive task on its client's flow
+ *
+ * @param[in] wpe	receive or datagram task, holding its xprt reference
+ * @param[in] xprt	transport, for the key
+ */
+void
+svc_fair_submit(struct work_pool_entry *wpe, SVCXPRT *xprt)
+{
+	struct svc_fair_flow sk;
+	struct svc_fair_flow *flow;
+	struct opr_rbtree_node *nv;
+	struct work_pool_entry *token = NULL;
+	uint32_t weight = 1;
+
+	sk.ff_key = svc_fair_key(xprt, &weight);
+	if (!weight)
+		weight = 1;
+
+	mutex_lock(&svc_fair.lock);
+	nv = opr_rbtree_lookup(&svc_fair.flows, &sk.ff_node);
+	if (nv) {
+		flow = opr_containerof(nv, struct svc_fair_flow, ff_node);
+	} else {
+		flow = mem_zalloc(sizeof(*flow));
+		flow->ff_key = sk.ff_key;
+		TAILQ_INIT(&flow->ff_q);
+		(void)opr_rbtree_insert(&svc_fair.flows, &flow->ff_node);
+		opr_queue_Append(&svc_fair.round, &flow->ff_round);
+	}
+	flow->ff_weight = weight;
+
+	TAILQ_INSERT_TAIL(&flow->ff_q, &wpe->pqe, q);
+	flow->ff_depth++;
+	svc_fair.depth++;
+
+	if (svc_fair.n_idle)
+		token = svc_fair.idle[--svc_fair.n_idle];
+	mutex_unlock(&svc_fair.lock);
+
+	if (token)
+		work_pool_submit(&svc_work_pool, token,
+				 WORK_POOL_PRIO_NORMAL);
+}
+
+/**
+ * @brief Report the depth of each backlogged flow
+ *
+ * @note Locking
+ * - Callback is called with the flows locked, and must not submit
+ *
+ * @return total queued receive tasks.
+ */
+uint32_t
+svc_fair_foreach(svc_fair_each_fun_t each_f, void *arg)
+{
+	struct svc_fair_flow *flow;
+	struct opr_rbtree_node *n;
+	uint32_t depth;
+
+	mutex_lock(&svc_fair.lock);
+	depth = svc_fair.depth;
+	if (svc_fair.tokens) {
+		for (n = opr_rbtree_first(&svc_fair.flows); n;
+		     n = opr_rbtree_next(n)) {
+			flow = opr_containerof(n, struct svc_fair_flow,
+					       ff_node);
+			each_f(flow->ff_key, flow->ff_depth, flow->ff_weight,
+			       arg);
+		}
+	}
+	mutex_unlock(&svc_fair.lock);
+	return (depth);
+}
+
+/*
+ * After the work pool, tasks still queued are abandoned with their
+ * transports.
+ */
+void
+svc_fair_shutdown(void)
+{
+	struct svc_fair_flow *flow;
+
+	mutex_lock(&svc_fair.lock);
+	if (!svc_fair.tokens) {
+		mutex_unlock(&svc_fair.lock);
+		return;
+	}
+
+	while (!opr_queue_IsEmpty(&svc_fair.round)) {
+		flow = opr_queue_First(&svc_fair.round, struct svc_fair_flow,
+				       ff_round);
+		opr_queue_Remove(&flow->ff_round);
+		opr_rbtree_remove(&svc_fair.flows, &flow->ff_node);
+		mem_free(flow, sizeof(*flow));
+	}
+	svc_fair.depth = 0;
+
+	mem_free(svc_fair.tokens,
+		 svc_fair.n_tokens * sizeof(struct work_pool_entry));
+	mem_free(svc_fair.idle,
+		 svc_fair.n_tokens * sizeof(struct work_pool_entry *));
+	svc_fair.tokens = NULL;
+	svc_fair.idle = NULL;
+	svc_fair.n_tokens = 0;
+	svc_fair.n_idle = 0;
+	mutex_unlock(&svc_fair.lock);
+}
@@ -65,6 +65,8 @@ struct svc_params {
 	svc_xprt_fun_t disconnect_cb;
 	svc_xprt_alloc_fun_t alloc_cb;
 	svc_xprt_free_fun_t free_cb;
+	svc_xprt_evchan_fun_t evchan_cb;
+	svc_xprt_fair_fun_t fair_cb;
 
 	struct {
 		int ctx_hash_partitions;
@@ -82,6 +84,12 @@ struct svc_params {
 	u_long flags;
 	u_int max_connections;
 	int32_t idle_timeout;
+	uint32_t busy_poll_ns;
+	uint32_t so_busy_poll_us;
+	uint32_t dg_batch;
+	uint32_t dg_send_ns;
+	uint32_t accept_batch;
+	uint32_t zerocopy_min;
 #if defined(_USE_NFS_RDMA) || defined(USE_RPC_RDMA)
 	uint16_t nfs_rdma_port;
 	u_int max_rdma_connections;
@@ -89,6 +97,7 @@ struct svc_params {
 };
 
 enum xprt_stat svc_request(SVCXPRT *xprt, XDR *xdrs);
+void svc_request_release(struct svc_req *, enum xprt_stat);
 
 extern struct svc_params __svc_params[1];
 
@@ -110,10 +119,27 @@ union pktinfo_u {
  * which wraps struct svc_xprt indexed by fd.
  */
 #define DG_NUM_PKTINFO 4 /* s/b enough space for all pktinfos in normal case*/
+#define SVC_DG_BATCH 16		/* datagrams per wakeup, default */
+#define SVC_DG_BATCH_MAX 64
+#define SVC_DG_SEND_US 50	/* reply batching leader, default */
+#define SVC_VC_ACCEPT_BATCH 32	/* connections per wakeup, default */
+#define SVC_VC_ZEROCOPY_MIN 32768	/* MSG_ZEROCOPY reply bytes, default */
+
+struct svc_dg_pool;		/* svc_dg.c */
+struct svc_dg_sendq;
+
+/* a task submitted later, from a channel's timer wheel (svc_rqst.c) */
+struct svc_rqst_delay {
+	struct timer_wheel_entry sd_te;	/* ms ticks */
+	struct work_pool_entry *sd_wpe;
+};
+
 struct svc_dg_xprt {
 	struct rpc_dplx_rec su_dr;	/* SVCXPRT indexed by fd */
 	struct msghdr su_msghdr;	/* msghdr received from clnt */
 	union pktinfo_u su_cmsg[DG_NUM_PKTINFO]; /* cmsghdr recv'd from clnt */
+	struct svc_dg_pool *su_pool;	/* per-datagram xprts, by rendezvous */
+	struct svc_dg_sendq *su_sendq;	/* SVC_FLAG_DG_SENDMMSG, rendezvous */
 };
 #define DG_DR(p) (opr_containerof((p), struct svc_dg_xprt, su_dr))
 #define su_data(xprt) (DG_DR(REC_XPRT(xprt)))
@@ -128,6 +154,20 @@ struct svc_dg_xprt {
 struct svc_vc_xprt {
 	struct rpc_dplx_rec sx_dr;	/* SVCXPRT indexed by fd */
 	int32_t sx_fbtbc;		/* fragment bytes to be consumed */
+	uint32_t sx_ra_head;		/* next unparsed read-ahead byte */
+	uint32_t sx_ra_tail;		/* end of read-ahead bytes */
+	uint8_t *sx_ra;			/* read-ahead buffer, or NULL */
+	bool sx_drained;		/* last recv() short, socket empty */
+	bool sx_nonblock;		/* O_NONBLOCK set for sendfile() */
+
+	/* SVC_FLAG_ZEROCOPY: replies sent, awaiting kernel completion */
+	struct poolq_head sx_zc;	/* xdr_ioq, by zc_seq */
+	uint32_t sx_zc_next;		/* zerocopy sends issued */
+	uint32_t sx_zc_done;		/* zerocopy sends completed */
+	int sx_zc_state;		/* 0 untried, 1 SO_ZEROCOPY, -1 none */
+	struct timespec sx_zc_linger;	/* destroy waits for them until */
+	struct svc_rqst_delay sx_zc_delay;	/* destroy retried by */
+	bool sx_zc_close;		/* close held back until then */
 };
 #define VC_DR(p) (opr_containerof((p), struct svc_vc_xprt, sx_dr))
 
@@ -183,6 +223,8 @@ static inline int svc_rqst_rearm_events(SVCXPRT *xprt, uint16_t ev_flags)
 	return code;
 }
 
+int svc_rqst_xprt_resubmit(SVCXPRT *);
+
 int svc_rqst_xprt_register(SVCXPRT *, SVCXPRT *);
 void svc_rqst_xprt_unregister(SVCXPRT *, uint32_t);
 
@@ -193,5 +235,7 @@ void svc_rqst_xprt_unregister_rdma(SVCXPRT *, uint32_t);
 int svc_rqst_evchan_write(SVCXPRT *, struct xdr_ioq *, bool);
 void svc_rqst_xprt_send_complete(SVCXPRT *);
 void svc_rqst_unhook(SVCXPRT *);
+bool svc_rqst_delay_task(struct svc_rqst_delay *, struct work_pool_entry *,
+			 uint32_t);
 
 #endif				/* TIRPC_SVC_INTERNAL_H */
@@ -36,6 +36,10 @@
 #include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#ifdef HAVE_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
 
 #include <err.h>
 #include <errno.h>
@@ -69,6 +73,43 @@
 #define LAST_FRAG_XDR_UNITS ((LAST_FRAG - 1) & ~(BYTES_PER_XDR_UNIT - 1))
 #define MAXALLOCA (256)
 
+/* sendfile() has no MSG_DONTWAIT; every other write already passes it */
+static inline void
+svc_ioq_nonblock(SVCXPRT *xprt)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+	int flags;
+
+	if (likely(xd->sx_nonblock))
+		return;
+
+	flags = fcntl(xprt->xp_fd, F_GETFL, 0);
+	if (flags >= 0)
+		(void)fcntl(xprt->xp_fd, F_SETFL, flags | O_NONBLOCK);
+	xd->sx_nonblock = true;
+}
+
+#ifdef HAVE_MSG_ZEROCOPY
+/* SO_ZEROCOPY is tried once per socket, on its first large reply */
+static inline bool
+svc_ioq_zerocopy_enable(SVCXPRT *xprt)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+	int one = 1;
+
+	if (unlikely(!xd->sx_zc_state)) {
+		xd->sx_zc_state = setsockopt(xprt->xp_fd, SOL_SOCKET,
+					     SO_ZEROCOPY, &one, sizeof(one))
+				  ? -1 : 1;
+		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+			"%s: %p fd %d SO_ZEROCOPY %s",
+			__func__, xprt, xprt->xp_fd,
+			xd->sx_zc_state > 0 ? "on" : "unavailable");
+	}
+	return (xd->sx_zc_state > 0);
+}
+#endif /* HAVE_MSG_ZEROCOPY */
+
 /* Returns 0 on success, EWOULDBLOCK if would block, <0 on error */
 static inline int
 svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
@@ -76,10 +117,12 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 	struct msghdr msg;
 	struct iovec *iov;
 	struct xdr_vio *vio;
+	struct xdr_vio *file;
 	ssize_t result;
-	u_int32_t frag_header;
+	u_int32_t *frag_header;
 	u_int32_t fbytes;
 	int error = 0;
+	int sflags = MSG_DONTWAIT;
 	int frag_needed = 0;
 	u_int32_t last_frag = 0;
 	u_int32_t end, remaining, iov_count, vsize, isize;
@@ -90,7 +133,8 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 	/* Some basic computations */
 	end = XDR_GETPOS(xioq->xdrs);
 	remaining = end - xioq->write_start;
-	iov_count = XDR_IOVCOUNT(xioq->xdrs, xioq->write_start, remaining);
+	iov_count = xdr_ioq_vcount(xioq->xdrs, xioq->write_start, remaining,
+				   true);
 	vsize = (iov_count + 1) * sizeof(struct iovec);
 	isize = iov_count * sizeof(struct xdr_vio);
 
@@ -101,6 +145,16 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 
 	memset(&msg, 0, sizeof(msg));
 
+#ifdef HAVE_MSG_ZEROCOPY
+	/* the pages are pinned instead of copied; the xioq is then kept
+	 * until the kernel reports the send complete (svc_ioq_write).
+	 */
+	if ((__svc_params->flags & SVC_FLAG_ZEROCOPY)
+	 && end >= __svc_params->zerocopy_min
+	 && svc_ioq_zerocopy_enable(xprt))
+		sflags |= MSG_ZEROCOPY;
+#endif /* HAVE_MSG_ZEROCOPY */
+
 	if (end > (2 * LAST_FRAG_XDR_UNITS)) {
 		/* This data will need to be 3 fragments */
 		if (xioq->write_start < LAST_FRAG_XDR_UNITS) {
@@ -157,7 +211,8 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 		 * number of buffers to the ioq instead of copying into the
 		 * 8k byte buffers.
 		 */
-		iov_count = XDR_IOVCOUNT(xioq->xdrs, xioq->write_start, fbytes);
+		iov_count = xdr_ioq_vcount(xioq->xdrs, xioq->write_start,
+					   fbytes, true);
 
 		if (xioq->write_start == 0 ||
 		    xioq->write_start == LAST_FRAG_XDR_UNITS ||
@@ -167,10 +222,13 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 			 * of it we have sent so far.
 			 */
 			frag_needed = 1;
-			frag_header = htonl((u_int32_t) (fbytes | last_frag));
-			iov[0].iov_base = ((char *) &frag_header) +
+			/* kept in the xioq, MSG_ZEROCOPY references it */
+			frag_header = &xioq->frag_hdr[xioq->write_start
+						      / LAST_FRAG_XDR_UNITS];
+			*frag_header = htonl((u_int32_t) (fbytes | last_frag));
+			iov[0].iov_base = ((char *) frag_header) +
 						xioq->frag_hdr_bytes_sent;
-			iov[0].iov_len = sizeof(frag_header) -
+			iov[0].iov_len = sizeof(*frag_header) -
 						xioq->frag_hdr_bytes_sent;
 			frag_hdr_size = iov[0].iov_len;
 			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
@@ -189,9 +247,10 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 			xioq->write_start, end, frag_needed, frag_hdr_size);
 
 		/* Get an xdr_vio corresponding to the bytes of this fragment */
-		if (!XDR_FILLBUFS(xioq->xdrs, xioq->write_start, vio, fbytes)) {
+		if (!xdr_ioq_vfill(xioq->xdrs, xioq->write_start, vio, fbytes,
+				   true)) {
 			__warnx(TIRPC_DEBUG_FLAG_ERROR,
-				"%s() XDR_FILLBUFS failed", __func__);
+				"%s() xdr_ioq_vfill failed", __func__);
 			error = -1;
 			break;
 		}
@@ -201,8 +260,13 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 			iov_count = PRESUMED_UIO_MAXIOV - frag_needed;
 		}
 
-		/* Convert the xdr_vio to an iovec */
+		/* Convert the xdr_vio to an iovec, up to any file range */
+		file = NULL;
 		for (i = 0; i < iov_count; i++) {
+			if (vio[i].vio_type == VIO_FILE) {
+				file = &vio[i];
+				break;
+			}
 			iov[i + frag_needed].iov_base = vio[i].vio_head;
 			iov[i + frag_needed].iov_len = vio[i].vio_length;
 			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
@@ -213,7 +277,17 @@ svc_ioq_flushv(SVCXPRT *xprt, struct xdr_ioq *xioq)
 		}
 
 		msg.msg_iov = iov;
-		msg.msg_iovlen = iov_count + frag_needed;
+		msg.msg_iovlen = i + frag_needed;
+
+		if (file && (i || frag_hdr_size)) {
+			/* memory ahead of the file range goes first */
+			sflags |= MSG_MORE;
+			file = NULL;
+		} else {
+			sflags &= ~MSG_MORE;
+		}
+		if (file)
+			svc_ioq_nonblock(xprt);
 
 again:
 
@@ -227,8 +301,39 @@ again:
 
 		/* non-blocking write */
 		errno = 0;
-		result = sendmsg(xprt->xp_fd, &msg, MSG_DONTWAIT);
-		error = errno;
+		if (file) {
+			/* from the page cache, at the (advanced) offset */
+			off_t offset = (off_t)(uintptr_t)file->vio_head;
+
+			result = sendfile(xprt->xp_fd,
+					  ((xdr_uio *)file->vio_base)->uio_fd,
+					  &offset, file->vio_length);
+			error = errno;
+			if (unlikely(!result)) {
+				/* the file is shorter than the range */
+				result = -1;
+				error = EIO;
+			}
+		} else {
+			result = sendmsg(xprt->xp_fd, &msg, sflags);
+			error = errno;
+		}
+
+#ifdef HAVE_MSG_ZEROCOPY
+		if (!file && (sflags & MSG_ZEROCOPY)) {
+			if (unlikely(result < 0 && error == ENOBUFS)) {
+				/* no optmem left for the notification */
+				sflags &= ~MSG_ZEROCOPY;
+				goto again;
+			}
+			if (result >= 0) {
+				/* each send is numbered for its completion */
+				xioq->zc_seq = ++(VC_DR(REC_XPRT(xprt))
+							->sx_zc_next);
+				xioq->ioq_s.qflags |= IOQ_FLAG_ZEROCOPY;
+			}
+		}
+#endif /* HAVE_MSG_ZEROCOPY */
 
 		__warnx((error == EWOULDBLOCK || error == EAGAIN || error == 0)
 				? TIRPC_DEBUG_FLAG_SVC_VC
@@ -279,7 +384,7 @@ again:
 		 * go ahead and indicate that... Also deduct any fragment
 		 * header bytes from result.
 		 */
-		xioq->frag_hdr_bytes_sent = sizeof(frag_header);
+		xioq->frag_hdr_bytes_sent = sizeof(*frag_header);
 		result -= frag_hdr_size;
 		frag_hdr_size = 0;
 
@@ -317,6 +422,96 @@ again:
 	return error;
 }
 
+#ifdef HAVE_MSG_ZEROCOPY
+/*
+ * Release the replies whose MSG_ZEROCOPY sends the kernel has completed.
+ *
+ * Completions arrive on the socket error queue as ranges of send numbers,
+ * and TCP reports them in order, so a single high-water mark suffices.
+ */
+void
+svc_ioq_zerocopy_reap(SVCXPRT *xprt)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+	struct poolq_head done;
+	struct poolq_entry *have;
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	union {
+		char buf[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+		struct cmsghdr align;
+	} control;
+
+	if (!xd->sx_zc.qcount)
+		return;
+
+	TAILQ_INIT(&done.qh);
+
+	mutex_lock(&xd->sx_zc.qmutex);
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		if (recvmsg(xprt->xp_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP
+			       && cmsg->cmsg_type == IP_RECVERR)
+			   || (cmsg->cmsg_level == SOL_IPV6
+			       && cmsg->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY
+			 || serr->ee_errno)
+				continue;
+
+			/* [ee_info, ee_data] inclusive */
+			if ((int32_t)(serr->ee_data + 1 - xd->sx_zc_done) > 0)
+				xd->sx_zc_done = serr->ee_data + 1;
+
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				/* kernel copied anyway (e.g. loopback); stop
+				 * paying for the notifications.
+				 */
+				xd->sx_zc_state = -1;
+			}
+		}
+	}
+
+	while ((have = TAILQ_FIRST(&xd->sx_zc.qh))
+	    && (int32_t)(xd->sx_zc_done - _IOQ(have)->zc_seq) >= 0) {
+		TAILQ_REMOVE(&xd->sx_zc.qh, have, q);
+		(xd->sx_zc.qcount)--;
+		TAILQ_INSERT_TAIL(&done.qh, have, q);
+	}
+	mutex_unlock(&xd->sx_zc.qmutex);
+
+	while ((have = TAILQ_FIRST(&done.qh))) {
+		TAILQ_REMOVE(&done.qh, have, q);
+		XDR_DESTROY(_IOQ(have)->xdrs);
+	}
+}
+
+/* Keep a sent reply until its pages are no longer referenced */
+static void
+svc_ioq_zerocopy_defer(SVCXPRT *xprt, struct xdr_ioq *xioq)
+{
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+
+	mutex_lock(&xd->sx_zc.qmutex);
+	(xd->sx_zc.qcount)++;
+	TAILQ_INSERT_TAIL(&xd->sx_zc.qh, &xioq->ioq_s, q);
+	mutex_unlock(&xd->sx_zc.qmutex);
+
+	svc_ioq_zerocopy_reap(xprt);
+}
+#endif /* HAVE_MSG_ZEROCOPY */
+
 void svc_ioq_write(SVCXPRT *xprt)
 {
 	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
@@ -400,6 +595,16 @@ void svc_ioq_write(SVCXPRT *xprt)
 		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 			"%s: %p fd %d About to release",
 			__func__, xprt, xprt->xp_fd);
+#ifdef HAVE_MSG_ZEROCOPY
+		if (xioq->ioq_s.qflags & IOQ_FLAG_ZEROCOPY) {
+			/* still referenced by the socket, even when a later
+			 * send failed
+			 */
+			svc_ioq_zerocopy_defer(xprt, xioq);
+			SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+			continue;
+		}
+#endif /* HAVE_MSG_ZEROCOPY */
 		SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
 		XDR_DESTROY(xioq->xdrs);
 	}
@@ -472,6 +677,7 @@ svc_ioq_write_submit(SVCXPRT *xprt, struct xdr_ioq *xioq)
 	if (was_empty) {
 		/* Schedule work to process output for this duplex record. */
 		xioq->ioq_wpe.fun = svc_ioq_write_callback;
-		work_pool_submit(&svc_work_pool, &xioq->ioq_wpe);
+		work_pool_submit(&svc_work_pool, &xioq->ioq_wpe,
+				 WORK_POOL_PRIO_HIGH);
 	}
 }
@@ -32,5 +32,6 @@
 void svc_ioq_write(SVCXPRT *);
 void svc_ioq_write_now(SVCXPRT *, struct xdr_ioq *);
 void svc_ioq_write_submit(SVCXPRT *, struct xdr_ioq *);
+void svc_ioq_zerocopy_reap(SVCXPRT *);
 
 #endif				/* SVC_IOQ_H */
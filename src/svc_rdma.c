@@ -282,7 +282,8 @@ svc_rdma_unlink(SVCXPRT *xprt, u_int flags, const char *tag, const int line)
 	/* schedule task to cleanup pending cbcs and release xprt refs */
 	REC_XPRT(xprt)->ioq.ioq_wpe.fun = rdma_cleanup_cbcs_task;
 	SVC_REF(xprt, SVC_REF_FLAG_NONE);
-	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe));
+	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe),
+			 WORK_POOL_PRIO_HIGH);
 }
 
 void
@@ -33,6 +33,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#endif
 
 #include <rpc/types.h>
 #include <misc/portable.h>
@@ -50,11 +57,18 @@
 #include "svc_xprt.h"
 #include <rpc/svc_auth.h>
 #include "svc_ioq.h"
+#include "svc_fair.h"
+#include "svc_coro.h"
 
 #ifdef USE_RPC_RDMA
 #include "rpc_rdma.h"
 #endif
 
+#if defined(TIRPC_IOURING)
+#include <poll.h>
+#include <liburing.h>
+#endif
+
 /**
  * @file svc_rqst.c
  * @contributeur William Allen Simpson <bill@cohortfs.com>
@@ -72,6 +86,12 @@
 #define SVC_RQST_TIMEOUT_MS (29 /* seconds (prime) was 120 */ * 1000)
 #define SVC_RQST_WAKEUPS (1023)
 
+/* expired calls handed to the work pool together */
+#define SVC_RQST_EXPIRE_BATCH (32)
+
+/* adaptive busy poll budget, grown from the start by doubling */
+#define SVC_RQST_POLL_START_NS (10000)
+
 /* > RPC_DPLX_LOCKED > SVC_XPRT_FLAG_LOCKED */
 #define SVC_RQST_LOCKED		0x01000000
 #define SVC_RQST_UNLOCK		0x02000000
@@ -79,12 +99,32 @@
 static uint32_t round_robin;
 /*static*/ uint32_t wakeups;
 
+#if defined(TIRPC_IOURING)
+/* io_uring user_data carries the fd above the event kind */
+#define SVC_RQST_URING_CTRL	0	/* control socket wakeup */
+#define SVC_RQST_URING_RECV	1
+#define SVC_RQST_URING_SEND	2
+#define SVC_RQST_URING_IGNORE	3	/* poll removal completions */
+#define SVC_RQST_URING_KIND	3
+
+#define svc_rqst_uring_data(fd, kind) \
+	((((uint64_t)(uint32_t)(fd)) << 2) | (kind))
+
+#define SVC_RQST_URING_SQ_IDLE_MS (50)
+
+/* shared SQPOLL kernel thread, attached by later channels */
+static int svc_rqst_uring_wq_fd = -1;
+#endif
+
 struct svc_rqst_rec {
 	struct work_pool_entry ev_wpe;
-	struct opr_rbtree call_expires;
+	struct timer_wheel call_expires;	/* ms ticks */
+	struct timer_wheel ev_delays;	/* ms ticks, struct svc_rqst_delay */
+	uint64_t ev_wait_ms;	/* loop waits until */
 	mutex_t ev_lock;
 
-	int sv[2];
+	int sv[2];		/* wakeup write:read, the same eventfd */
+	uint32_t ev_sig_pending;	/* wakeup sent, or loop awake */
 	uint32_t id_k;		/* chan id */
 
 	/*
@@ -98,14 +138,33 @@ struct svc_rqst_rec {
 			struct epoll_event ctrl_ev;
 			struct epoll_event *events;
 			u_int max_events;	/* max epoll events */
+			uint32_t poll_ns;	/* busy poll budget */
 			bool sv1_added;
 		} epoll;
+#endif
+#if defined(TIRPC_IOURING)
+		struct {
+			struct io_uring ring;
+			mutex_t sq_lock;	/* SQ has a single producer */
+			struct epoll_event *events;
+			u_int max_events;	/* max reaped completions */
+			bool sqpoll;
+			bool ctrl_multi;	/* control poll is multishot */
+		} iouring;
 #endif
 		struct {
 			fd_set set;	/* select/fd_set (currently unhooked) */
 		} fd;
 	} ev_u;
 
+	struct work_pool_entry **ev_wpev;	/* batched dispatch */
+	u_int ev_wpev_max;
+
+#if defined(__linux__)
+	cpu_set_t ev_cpus;	/* SVC_FLAG_AFFINITY */
+	int ev_node;
+#endif
+
 	int32_t ev_refcnt;
 	uint16_t ev_flags;
 	struct xdr_ioq *xioq; /* IOQ for floating sr_rec */
@@ -123,10 +182,20 @@ void svc_rqst_rec_init(struct svc_rqst_rec *sr_rec)
 #endif
 }
 
+#if defined(TIRPC_IOURING)
+static void svc_rqst_uring_destroy(struct svc_rqst_rec *sr_rec);
+#endif
+
 void svc_rqst_rec_destroy(struct svc_rqst_rec *sr_rec)
 {
+#if defined(TIRPC_IOURING)
+	/* after the last hooked xprt, as unhook submits to the ring */
+	if (sr_rec->ev_type == SVC_EVENT_IOURING)
+		svc_rqst_uring_destroy(sr_rec);
+#endif
 #if defined(TIRPC_EPOLL)
-	if (sr_rec->ev_u.epoll.sv1_added) {
+	if (sr_rec->ev_type == SVC_EVENT_EPOLL
+	    && sr_rec->ev_u.epoll.sv1_added) {
 		int code;
 
 		code = epoll_ctl(sr_rec->ev_u.epoll.epoll_fd, EPOLL_CTL_DEL,
@@ -154,7 +223,8 @@ void svc_rqst_rec_destroy(struct svc_rqst_rec *sr_rec)
 #endif
 
 	if (sr_rec->sv[0] >= 0) {
-		close(sr_rec->sv[0]);
+		if (sr_rec->sv[0] != sr_rec->sv[1])
+			close(sr_rec->sv[0]);
 		sr_rec->sv[0] = -1;
 	}
 
@@ -164,11 +234,18 @@ void svc_rqst_rec_destroy(struct svc_rqst_rec *sr_rec)
 	}
 
 #if defined(TIRPC_EPOLL)
-	if (sr_rec->ev_u.epoll.epoll_fd > 0) {
+	if (sr_rec->ev_type == SVC_EVENT_EPOLL
+	    && sr_rec->ev_u.epoll.epoll_fd > 0) {
 		close(sr_rec->ev_u.epoll.epoll_fd);
 		sr_rec->ev_u.epoll.epoll_fd = -1;
 	}
 #endif
+
+	if (sr_rec->ev_wpev) {
+		mem_free(sr_rec->ev_wpev,
+			 sr_rec->ev_wpev_max * sizeof(struct work_pool_entry *));
+		sr_rec->ev_wpev = NULL;
+	}
 }
 
 struct svc_rqst_set {
@@ -185,45 +262,314 @@ static struct svc_rqst_set svc_rqst_set = {
 	0,
 };
 
+static inline void
+SetNonBlock(int fd)
+{
+	int s_flags = fcntl(fd, F_GETFL, 0);
+	(void)fcntl(fd, F_SETFL, (s_flags | O_NONBLOCK));
+}
+
+/*
+ * Create the event channel wakeup, an eventfd where available (both
+ * sv[] are the one fd), otherwise a pair of anonymous sockets.
+ */
+static int
+ev_sig_init(struct svc_rqst_rec *sr_rec)
+{
+	sr_rec->ev_sig_pending = 0;
+
+#if defined(__linux__)
+	sr_rec->sv[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (sr_rec->sv[0] >= 0) {
+		sr_rec->sv[1] = sr_rec->sv[0];
+		return (0);
+	}
+	__warnx(TIRPC_DEBUG_FLAG_WARN,
+		"%s: eventfd failed (%d), using socketpair",
+		__func__, errno);
+#endif
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sr_rec->sv))
+		return (errno);
+
+	/* set non-blocking */
+	SetNonBlock(sr_rec->sv[0]);
+	SetNonBlock(sr_rec->sv[1]);
+	return (0);
+}
+
 /*
- * Write 4-byte value to shared event-notification channel.  The
- * value as presently implemented can be interpreted only by one consumer,
- * so is not relied on.
+ * Wake the event loop.  Signals are coalesced:  only the first since
+ * the loop last went to wait is written, and none while it is awake,
+ * as it checks for work before it waits again.  The value as presently
+ * implemented can be interpreted only by one consumer, so is not relied
+ * on.
  */
 static inline void
-ev_sig(int fd, uint32_t sig)
+ev_sig(struct svc_rqst_rec *sr_rec, uint32_t sig)
 {
-	int code = write(fd, &sig, sizeof(uint32_t));
+	uint64_t count = 1;
+	int code;
+
+	if (atomic_postset_uint32_t_bits(&sr_rec->ev_sig_pending, 1))
+		return;
 
-	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST, "%s: fd %d sig %d", __func__, fd,
-		sig);
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST, "%s: fd %d sig %d", __func__,
+		sr_rec->sv[0], sig);
+	if (sr_rec->sv[0] == sr_rec->sv[1])
+		code = write(sr_rec->sv[0], &count, sizeof(count));
+	else
+		code = write(sr_rec->sv[0], &sig, sizeof(sig));
 	if (code < 1)
 		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
-			"%s: error writing to event socket [%d:%d]", __func__,
+			"%s: error writing to event fd [%d:%d]", __func__,
 			code, errno);
 }
 
 /*
- * Read a single 4-byte value from the shared event-notification channel,
- * the socket is in non-blocking mode.  The value read is returned.
+ * Drain the wakeup, non-blocking.
  */
-static inline uint32_t
-consume_ev_sig_nb(int fd)
+static inline void
+ev_sig_consume(struct svc_rqst_rec *sr_rec)
 {
-	uint32_t sig = 0;
-	int code __attribute__ ((unused));
+	uint32_t sig[16];
+	uint64_t count;
 
-	code = read(fd, &sig, sizeof(uint32_t));
-	return (sig);
+	if (sr_rec->sv[0] == sr_rec->sv[1]) {
+		(void)read(sr_rec->sv[1], &count, sizeof(count));
+		return;
+	}
+	while (read(sr_rec->sv[1], sig, sizeof(sig)) == sizeof(sig))
+		;
 }
 
+/*
+ * The loop is awake and will check for work before it next waits, so
+ * further signals are skipped.
+ */
 static inline void
-SetNonBlock(int fd)
+ev_sig_awake(struct svc_rqst_rec *sr_rec)
 {
-	int s_flags = fcntl(fd, F_GETFL, 0);
-	(void)fcntl(fd, F_SETFL, (s_flags | O_NONBLOCK));
+	atomic_set_uint32_t_bits(&sr_rec->ev_sig_pending, 1);
+}
+
+/*
+ * Called before the loop checks for work, and then waits.  Returns
+ * true when the channel is shutting down, and should not wait.
+ */
+static inline bool
+ev_sig_idle(struct svc_rqst_rec *sr_rec)
+{
+	atomic_clear_uint32_t_bits(&sr_rec->ev_sig_pending, 1);
+	return (atomic_fetch_uint16_t(&sr_rec->ev_flags)
+		& SVC_RQST_FLAG_SHUTDOWN);
+}
+
+#if defined(__linux__)
+/* the channel this worker thread is pinned to, and its own mask */
+static __thread struct svc_rqst_rec *svc_rqst_pinned;
+static __thread cpu_set_t svc_rqst_unpinned;
+static __thread bool svc_rqst_unpinned_valid;
+
+/*
+ * NUMA node of a cpu, from sysfs; 0 when not NUMA
+ */
+static int
+svc_rqst_cpu_node(int cpu)
+{
+	char path[64];
+	struct dirent *de;
+	DIR *dir;
+	int node;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return (0);
+
+	while ((de = readdir(dir))) {
+		if (sscanf(de->d_name, "node%d", &node) == 1) {
+			closedir(dir);
+			return (node);
+		}
+	}
+	closedir(dir);
+	return (0);
+}
+
+/*
+ * Spread the channels over the NUMA nodes of the allowed cpus, then
+ * split each node's cpus among its channels.
+ */
+static void
+svc_rqst_affinity_init(uint32_t channels)
+{
+	cpu_set_t allowed;
+	int *cpus = mem_alloc(CPU_SETSIZE * sizeof(int));
+	int *nodes = mem_alloc(CPU_SETSIZE * sizeof(int));
+	int *node_ids = mem_alloc(CPU_SETSIZE * sizeof(int));
+	int n_cpus = 0;
+	int n_nodes = 0;
+	int cpu;
+	int ix;
+	uint32_t i;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: sched_getaffinity failed (%d), no affinity",
+			__func__, errno);
+		__svc_params->flags &= ~SVC_FLAG_AFFINITY;
+		goto out;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		cpus[n_cpus] = cpu;
+		nodes[n_cpus] = svc_rqst_cpu_node(cpu);
+		for (ix = 0; ix < n_nodes; ix++) {
+			if (node_ids[ix] == nodes[n_cpus])
+				break;
+		}
+		if (ix == n_nodes)
+			node_ids[n_nodes++] = nodes[n_cpus];
+		n_cpus++;
+	}
+
+	for (i = 0; i < channels; i++) {
+		struct svc_rqst_rec *sr_rec = &svc_rqst_set.srr[i];
+		int node = node_ids[i % n_nodes];
+		/* channels on this node, and this one's rank among them */
+		int n_chan = (channels - (i % n_nodes) + n_nodes - 1) / n_nodes;
+		int rank = i / n_nodes;
+		int n_node_cpus = 0;
+		int j = 0;
+
+		for (ix = 0; ix < n_cpus; ix++) {
+			if (nodes[ix] == node)
+				n_node_cpus++;
+		}
+
+		sr_rec->ev_node = node;
+		CPU_ZERO(&sr_rec->ev_cpus);
+		for (ix = 0; ix < n_cpus; ix++) {
+			if (nodes[ix] != node)
+				continue;
+			if (n_node_cpus < n_chan
+			    ? j == rank % n_node_cpus
+			    : j * n_chan / n_node_cpus == rank)
+				CPU_SET(cpus[ix], &sr_rec->ev_cpus);
+			j++;
+		}
+
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+			"%s: evchan %" PRIu32 " node %d cpus %d",
+			__func__, i, node, CPU_COUNT(&sr_rec->ev_cpus));
+	}
+
+ out:
+	mem_free(node_ids, CPU_SETSIZE * sizeof(int));
+	mem_free(nodes, CPU_SETSIZE * sizeof(int));
+	mem_free(cpus, CPU_SETSIZE * sizeof(int));
 }
 
+/*
+ * Pin the worker running a channel's event loop to the channel's cpus.
+ * The loop keeps that worker until the channel finishes, so it is
+ * pinned once; the events it pushes are stolen by workers on the
+ * channel's node first.  The worker's own mask is fetched only once.
+ */
+static inline void
+svc_rqst_affinity_pin(struct svc_rqst_rec *sr_rec)
+{
+	int code;
+
+	if (!(__svc_params->flags & SVC_FLAG_AFFINITY)
+	    || svc_rqst_pinned == sr_rec)
+		return;
+
+	if (!svc_rqst_unpinned_valid) {
+		code = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t),
+					      &svc_rqst_unpinned);
+		if (code) {
+			__warnx(TIRPC_DEBUG_FLAG_WARN,
+				"%s: evchan %" PRIu32
+				" pthread_getaffinity_np failed (%d)",
+				__func__, sr_rec->id_k, code);
+			return;
+		}
+		svc_rqst_unpinned_valid = true;
+	}
+
+	code = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				      &sr_rec->ev_cpus);
+	if (code) {
+		__warnx(TIRPC_DEBUG_FLAG_WARN,
+			"%s: evchan %" PRIu32 " pthread_setaffinity_np failed (%d)",
+			__func__, sr_rec->id_k, code);
+	}
+	svc_rqst_pinned = sr_rec;
+	work_pool_set_node(sr_rec->ev_node);
+}
+
+/*
+ * Give the worker back to the pool with its own mask and no node, once
+ * its channel has finished.
+ */
+static inline void
+svc_rqst_affinity_unpin(void)
+{
+	int code;
+
+	if (!svc_rqst_pinned)
+		return;
+
+	code = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				      &svc_rqst_unpinned);
+	if (code) {
+		__warnx(TIRPC_DEBUG_FLAG_WARN,
+			"%s: evchan %" PRIu32 " pthread_setaffinity_np failed (%d)",
+			__func__, svc_rqst_pinned->id_k, code);
+	}
+	svc_rqst_pinned = NULL;
+	work_pool_set_node(-1);
+}
+
+/*
+ * Channel for a new connection, by the cpu that received its packets
+ */
+static int
+svc_rqst_affinity_chan(SVCXPRT *newxprt)
+{
+	int cpu = -1;
+	uint32_t ix;
+#if defined(SO_INCOMING_CPU)
+	socklen_t len = sizeof(cpu);
+
+	if (getsockopt(newxprt->xp_fd, SOL_SOCKET, SO_INCOMING_CPU,
+		       &cpu, &len))
+		cpu = -1;
+#endif
+
+	if (__svc_params->evchan_cb)
+		return __svc_params->evchan_cb(newxprt, cpu);
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return (-1);
+
+	for (ix = 0; ix < svc_rqst_set.max_id; ix++) {
+		if (CPU_ISSET(cpu, &svc_rqst_set.srr[ix].ev_cpus))
+			return (ix);
+	}
+	return (-1);
+}
+#else
+#define svc_rqst_affinity_init(channels) \
+	(__svc_params->flags &= ~SVC_FLAG_AFFINITY)
+#define svc_rqst_affinity_pin(sr_rec)
+#define svc_rqst_affinity_unpin()
+#define svc_rqst_affinity_chan(newxprt) (-1)
+#endif
+
 void
 svc_rqst_init(uint32_t channels)
 {
@@ -242,6 +588,9 @@ svc_rqst_init(uint32_t channels)
 		svc_rqst_rec_init(&svc_rqst_set.srr[i]);
 	}
 
+	if (__svc_params->flags & SVC_FLAG_AFFINITY)
+		svc_rqst_affinity_init(channels);
+
  unlock:
 	mutex_unlock(&svc_rqst_set.mtx);
 }
@@ -268,35 +617,39 @@ svc_rqst_lookup_chan(uint32_t chan_id)
 
 /* forward declaration in lieu of moving code {WAS} */
 static void svc_rqst_epoll_loop(struct work_pool_entry *wpe);
+#if defined(TIRPC_IOURING)
+static void svc_rqst_iouring_loop(struct work_pool_entry *wpe);
+#endif
 static void svc_complete_task(struct svc_rqst_rec *sr_rec, bool finished);
+static inline void svc_rqst_release(struct svc_rqst_rec *sr_rec);
+void svc_rqst_xprt_task_recv(struct work_pool_entry *wpe);
 
-static int
-svc_rqst_expire_cmpf(const struct opr_rbtree_node *lhs,
-		     const struct opr_rbtree_node *rhs)
+/*
+ * With SVC_FLAG_FAIR, receive tasks go to their client's flow rather
+ * than to this thread or the work pool.  Not those of UDP listeners,
+ * whose datagrams are queued on flows of their own.
+ */
+static inline bool
+svc_rqst_fair(struct xdr_ioq *ioq)
 {
-	struct clnt_req *lk, *rk;
-
-	lk = opr_containerof(lhs, struct clnt_req, cc_rqst);
-	rk = opr_containerof(rhs, struct clnt_req, cc_rqst);
-
-	if (lk->cc_expire_ms < rk->cc_expire_ms)
-		return (-1);
-
-	if (lk->cc_expire_ms == rk->cc_expire_ms) {
-		return (0);
-	}
+	if (!(__svc_params->flags & SVC_FLAG_FAIR)
+	    || ioq->ioq_wpe.fun != svc_rqst_xprt_task_recv
+	    || ioq->rec->xprt.xp_type == XPRT_UDP_RENDEZVOUS)
+		return (false);
 
-	return (1);
+	svc_fair_submit(&ioq->ioq_wpe, &ioq->rec->xprt);
+	return (true);
 }
 
-static inline int
+static inline uint64_t
 svc_rqst_expire_ms(struct timespec *to)
 {
 	struct timespec ts;
 
 	/* coarse nsec, not system time */
 	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
-	timespecadd(&ts, to, &ts);
+	if (to)
+		timespecadd(&ts, to, &ts);
 	return timespec_ms(&ts);
 }
 
@@ -305,28 +658,31 @@ svc_rqst_expire_insert(struct clnt_req *cc)
 {
 	struct cx_data *cx = CX_DATA(cc->cc_clnt);
 	struct svc_rqst_rec *sr_rec = cx->cx_rec->ev_p;
-	struct opr_rbtree_node *nv;
+	uint64_t expire_ms = svc_rqst_expire_ms(&cc->cc_timeout);
+	bool wakeup;
 
-	cc->cc_expire_ms = svc_rqst_expire_ms(&cc->cc_timeout);
+	cc->cc_expire_ms = expire_ms;
 
 	mutex_lock(&sr_rec->ev_lock);
 	cc->cc_flags = CLNT_REQ_FLAG_EXPIRING;
- repeat:
-	nv = opr_rbtree_insert(&sr_rec->call_expires, &cc->cc_rqst);
-	if (nv) {
-		/* add this slightly later */
-		cc->cc_expire_ms++;
-		goto repeat;
-	}
+	timer_wheel_insert(&sr_rec->call_expires, &cc->cc_rqst, expire_ms);
+	/* only when the loop would otherwise sleep past this one */
+	wakeup = expire_ms < sr_rec->ev_wait_ms;
 	mutex_unlock(&sr_rec->ev_lock);
 
+	if (!wakeup)
+		return;
+
 	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
 		"%s: sv[0] fd %d before ev_sig (sr_rec %p)",
 		__func__, sr_rec->sv[0],
 		sr_rec);
-	ev_sig(sr_rec->sv[0], 0);	/* send wakeup */
+	ev_sig(sr_rec, 0);	/* send wakeup */
 }
 
+/*
+ * No wakeup, the loop recalculates its wait when it next scans.
+ */
 void
 svc_rqst_expire_remove(struct clnt_req *cc)
 {
@@ -334,14 +690,8 @@ svc_rqst_expire_remove(struct clnt_req *cc)
 	struct svc_rqst_rec *sr_rec = cx->cx_rec->ev_p;
 
 	mutex_lock(&sr_rec->ev_lock);
-	opr_rbtree_remove(&sr_rec->call_expires, &cc->cc_rqst);
+	timer_wheel_remove(&sr_rec->call_expires, &cc->cc_rqst);
 	mutex_unlock(&sr_rec->ev_lock);
-
-	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
-		"%s: sv[0] fd %d before ev_sig (sr_rec %p)",
-		__func__, sr_rec->sv[0],
-		sr_rec);
-	ev_sig(sr_rec->sv[0], 0);	/* send wakeup */
 }
 
 static void
@@ -363,6 +713,156 @@ svc_rqst_expire_task(struct work_pool_entry *wpe)
 	clnt_req_release(cc);
 }
 
+/**
+ * @brief Submit a task after a delay
+ *
+ * Rather than resubmitting a task that waits on the kernel at once, it
+ * is held on the timer wheel of a channel, taken in turn.  The channel
+ * is referenced until then.
+ *
+ * @param[in] sd	delay entry, not already waiting
+ * @param[in] wpe	task
+ * @param[in] ms	delay
+ *
+ * @return false when no channel is left to wait on, as at shutdown.
+ */
+bool
+svc_rqst_delay_task(struct svc_rqst_delay *sd, struct work_pool_entry *wpe,
+		    uint32_t ms)
+{
+	struct svc_rqst_rec *sr_rec = NULL;
+	uint32_t chan = atomic_fetch_uint32_t(&round_robin);
+	uint64_t expire_ms = svc_rqst_expire_ms(NULL) + ms;
+	uint32_t ix;
+	bool wakeup;
+
+	for (ix = 0; ix < svc_rqst_set.max_id && !sr_rec; ix++)
+		sr_rec = svc_rqst_lookup_chan((chan + ix) % svc_rqst_set.max_id);
+	if (!sr_rec)
+		return (false);
+
+	timer_wheel_entry_init(&sd->sd_te);
+	sd->sd_wpe = wpe;
+
+	mutex_lock(&sr_rec->ev_lock);
+	if (atomic_fetch_uint16_t(&sr_rec->ev_flags)
+	    & SVC_RQST_FLAG_SHUTDOWN) {
+		/* its loop may have flushed them already */
+		mutex_unlock(&sr_rec->ev_lock);
+		svc_rqst_release(sr_rec);
+		return (false);
+	}
+	timer_wheel_insert(&sr_rec->ev_delays, &sd->sd_te, expire_ms);
+	wakeup = expire_ms < sr_rec->ev_wait_ms;
+	mutex_unlock(&sr_rec->ev_lock);
+
+	if (wakeup)
+		ev_sig(sr_rec, 0);	/* send wakeup */
+	return (true);
+}
+
+/*
+ * Submit the delayed tasks due by now_ms, dropping their references.
+ * The caller holds another.
+ *
+ * @note Locking
+ *	Called with ev_lock held.
+ */
+static void
+svc_rqst_delay_expire(struct svc_rqst_rec *sr_rec, uint64_t now_ms)
+{
+	struct opr_queue expired;
+	struct svc_rqst_delay *sd;
+
+	opr_queue_Init(&expired);
+	timer_wheel_advance(&sr_rec->ev_delays, now_ms, &expired);
+
+	while (!opr_queue_IsEmpty(&expired)) {
+		sd = opr_queue_First(&expired, struct svc_rqst_delay,
+				     sd_te.te_q);
+		opr_queue_Remove(&sd->sd_te.te_q);
+
+		work_pool_submit(&svc_work_pool, sd->sd_wpe,
+				 WORK_POOL_PRIO_NORMAL);
+		atomic_dec_int32_t(&sr_rec->ev_refcnt);
+	}
+}
+
+/*
+ * A finished loop submits the remaining delayed tasks now, and refuses
+ * more.
+ */
+static void
+svc_rqst_delay_flush(struct svc_rqst_rec *sr_rec)
+{
+	mutex_lock(&sr_rec->ev_lock);
+	atomic_set_uint16_t_bits(&sr_rec->ev_flags, SVC_RQST_FLAG_SHUTDOWN);
+	svc_rqst_delay_expire(sr_rec,
+			      sr_rec->ev_delays.tw_now + TIMER_WHEEL_SPAN);
+	mutex_unlock(&sr_rec->ev_lock);
+}
+
+/*
+ * Hand expired calls and delayed tasks to workers, returning the wait
+ * until the next one.  Call before waiting, as events will accumulate
+ * during the scan.
+ */
+static int
+svc_rqst_expire_scan(struct svc_rqst_rec *sr_rec)
+{
+	struct work_pool_entry *wpev[SVC_RQST_EXPIRE_BATCH];
+	struct opr_queue expired;
+	struct clnt_req *cc;
+	uint64_t now_ms = svc_rqst_expire_ms(NULL);
+	uint64_t next_ms;
+	int timeout_ms = SVC_RQST_TIMEOUT_MS;
+	int n_wpe = 0;
+
+	opr_queue_Init(&expired);
+
+	mutex_lock(&sr_rec->ev_lock);
+	timer_wheel_advance(&sr_rec->call_expires, now_ms, &expired);
+	svc_rqst_delay_expire(sr_rec, now_ms);
+
+	next_ms = timer_wheel_next(&sr_rec->call_expires);
+	if (next_ms - now_ms < timeout_ms)
+		timeout_ms = next_ms - now_ms;
+	next_ms = timer_wheel_next(&sr_rec->ev_delays);
+	if (next_ms - now_ms < timeout_ms)
+		timeout_ms = next_ms - now_ms;
+	sr_rec->ev_wait_ms = now_ms + timeout_ms;
+
+	/* referenced under the lock, as a racing svc_rqst_expire_remove()
+	 * no longer finds them armed
+	 */
+	while (!opr_queue_IsEmpty(&expired)) {
+		cc = opr_queue_First(&expired, struct clnt_req, cc_rqst.te_q);
+		opr_queue_Remove(&cc->cc_rqst.te_q);
+
+		/* order dependent */
+		atomic_clear_uint16_t_bits(&cc->cc_flags,
+					   CLNT_REQ_FLAG_EXPIRING);
+		cc->cc_expire_ms = 0;	/* atomic barrier(s) */
+
+		atomic_inc_int32_t(&cc->cc_refcnt);
+		cc->cc_wpe.fun = svc_rqst_expire_task;
+		cc->cc_wpe.arg = NULL;
+		wpev[n_wpe++] = &cc->cc_wpe;
+		if (n_wpe == SVC_RQST_EXPIRE_BATCH) {
+			work_pool_submit_batch(&svc_work_pool, wpev, n_wpe,
+					       WORK_POOL_PRIO_HIGH);
+			n_wpe = 0;
+		}
+	}
+	mutex_unlock(&sr_rec->ev_lock);
+
+	if (n_wpe)
+		work_pool_submit_batch(&svc_work_pool, wpev, n_wpe,
+				       WORK_POOL_PRIO_HIGH);
+
+	return (timeout_ms);
+}
+
 static inline void
 svc_rqst_release(struct svc_rqst_rec *sr_rec)
 {
@@ -377,6 +877,188 @@ svc_rqst_release(struct svc_rqst_rec *sr_rec)
 	svc_rqst_rec_destroy(sr_rec);
 }
 
+#if defined(TIRPC_IOURING)
+/*
+ * Queue a oneshot poll (the analog of EPOLLONESHOT) or a poll removal.
+ * The control socket poll is multishot where the kernel allows, as only
+ * the channel task consumes it.  With SQPOLL, submission is normally a
+ * store to the shared ring that the kernel thread picks up, without a
+ * syscall.
+ */
+static int
+svc_rqst_uring_submit(struct svc_rqst_rec *sr_rec, uint8_t op, int fd,
+		      unsigned poll_mask, uint64_t data)
+{
+	struct io_uring *ring = &sr_rec->ev_u.iouring.ring;
+	struct io_uring_sqe *sqe;
+	int code;
+
+	mutex_lock(&sr_rec->ev_u.iouring.sq_lock);
+	sqe = io_uring_get_sqe(ring);
+	if (unlikely(!sqe)) {
+		/* full, push queued entries to the kernel and retry */
+		(void)io_uring_submit(ring);
+		if (sr_rec->ev_u.iouring.sqpoll)
+			(void)io_uring_sqring_wait(ring);
+		sqe = io_uring_get_sqe(ring);
+		if (!sqe) {
+			mutex_unlock(&sr_rec->ev_u.iouring.sq_lock);
+			return (EBUSY);
+		}
+	}
+
+	if (op == IORING_OP_POLL_ADD) {
+		io_uring_prep_poll_add(sqe, fd, poll_mask);
+#if defined(IORING_POLL_ADD_MULTI)
+		if ((data & SVC_RQST_URING_KIND) == SVC_RQST_URING_CTRL
+		 && sr_rec->ev_u.iouring.ctrl_multi)
+			sqe->len |= IORING_POLL_ADD_MULTI;
+#endif
+		sqe->user_data = data;
+	} else {
+		/* spelled out, the liburing helper changed its signature */
+		io_uring_prep_rw(IORING_OP_POLL_REMOVE, sqe, -1, NULL, 0, 0);
+		sqe->addr = data;
+		sqe->user_data =
+			svc_rqst_uring_data(fd, SVC_RQST_URING_IGNORE);
+	}
+
+	code = io_uring_submit(ring);
+	mutex_unlock(&sr_rec->ev_u.iouring.sq_lock);
+
+	return (code < 0 ? -code : 0);
+}
+
+static void
+svc_rqst_uring_destroy(struct svc_rqst_rec *sr_rec)
+{
+	if (svc_rqst_uring_wq_fd == sr_rec->ev_u.iouring.ring.ring_fd)
+		svc_rqst_uring_wq_fd = -1;
+
+	io_uring_queue_exit(&sr_rec->ev_u.iouring.ring);
+	mutex_destroy(&sr_rec->ev_u.iouring.sq_lock);
+	mem_free(sr_rec->ev_u.iouring.events,
+		 sr_rec->ev_u.iouring.max_events *
+		 sizeof(struct epoll_event));
+}
+
+/*
+ * svc_rqst_set.mtx must be held
+ */
+static int
+svc_rqst_uring_init(struct svc_rqst_rec *sr_rec)
+{
+	struct io_uring *ring = &sr_rec->ev_u.iouring.ring;
+	struct io_uring_params params;
+	u_int max_events = __svc_params->ev_u.evchan.max_events;
+	int code;
+
+	/* one SQPOLL kernel thread is shared by all channels */
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_SQPOLL;
+	params.sq_thread_idle = SVC_RQST_URING_SQ_IDLE_MS;
+	if (svc_rqst_uring_wq_fd >= 0) {
+		params.flags |= IORING_SETUP_ATTACH_WQ;
+		params.wq_fd = svc_rqst_uring_wq_fd;
+	}
+
+	code = io_uring_queue_init_params(max_events, ring, &params);
+	if (code < 0) {
+		/* SQPOLL needs privileges on older kernels */
+		memset(&params, 0, sizeof(params));
+		code = io_uring_queue_init_params(max_events, ring, &params);
+	}
+	if (code < 0)
+		return (-code);
+
+	/* a timed wait must not take SQEs behind the other producers */
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		io_uring_queue_exit(ring);
+		return (ENOTSUP);
+	}
+
+	sr_rec->ev_u.iouring.sqpoll = !!(params.flags & IORING_SETUP_SQPOLL);
+	if (sr_rec->ev_u.iouring.sqpoll && svc_rqst_uring_wq_fd < 0)
+		svc_rqst_uring_wq_fd = ring->ring_fd;
+
+	mutex_init(&sr_rec->ev_u.iouring.sq_lock, NULL);
+	sr_rec->ev_u.iouring.max_events = max_events;
+#if defined(IORING_POLL_ADD_MULTI)
+	sr_rec->ev_u.iouring.ctrl_multi = true;
+#else
+	sr_rec->ev_u.iouring.ctrl_multi = false;
+#endif
+	sr_rec->ev_u.iouring.events = (struct epoll_event *)
+	    mem_alloc(max_events * sizeof(struct epoll_event));
+
+	/* permit wakeup of the thread waiting on the ring */
+	code = svc_rqst_uring_submit(sr_rec, IORING_OP_POLL_ADD, sr_rec->sv[1],
+				     POLLIN, svc_rqst_uring_data(sr_rec->sv[1],
+							SVC_RQST_URING_CTRL));
+	if (code) {
+		svc_rqst_uring_destroy(sr_rec);
+		return (code);
+	}
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: sr_rec %p ring_fd %d max_events %u%s",
+		__func__, sr_rec, ring->ring_fd, max_events,
+		sr_rec->ev_u.iouring.sqpoll ? " SQPOLL" : "");
+	return (0);
+}
+
+/*
+ * Hook and rearm are the same for io_uring, as a fired poll is consumed.
+ */
+static int
+svc_rqst_uring_arm(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
+		   uint16_t ev_flags)
+{
+	int code = EINVAL;
+
+	if (ev_flags & SVC_XPRT_FLAG_ADDED_RECV) {
+		code = svc_rqst_uring_submit(sr_rec, IORING_OP_POLL_ADD,
+					     rec->xprt.xp_fd, POLLIN,
+					     svc_rqst_uring_data(
+							rec->xprt.xp_fd,
+							SVC_RQST_URING_RECV));
+		if (code) {
+			atomic_clear_uint16_t_bits(&rec->xprt.xp_flags,
+						   SVC_XPRT_FLAG_ADDED_RECV);
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d xp_refcnt %" PRId32
+				" sr_rec %p evchan %d ev_refcnt %" PRId32
+				" direction in poll failed (%d)",
+				__func__, rec, rec->xprt.xp_fd,
+				rec->xprt.xp_refcnt,
+				sr_rec, sr_rec->id_k, sr_rec->ev_refcnt, code);
+		}
+	}
+
+	if (ev_flags & SVC_XPRT_FLAG_ADDED_SEND) {
+		/* no dup needed, the poll kind is kept in the user_data */
+		code = svc_rqst_uring_submit(sr_rec, IORING_OP_POLL_ADD,
+					     rec->xprt.xp_fd, POLLOUT,
+					     svc_rqst_uring_data(
+							rec->xprt.xp_fd,
+							SVC_RQST_URING_SEND));
+		if (code) {
+			atomic_clear_uint16_t_bits(&rec->xprt.xp_flags,
+						   SVC_XPRT_FLAG_ADDED_SEND);
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d xp_refcnt %" PRId32
+				" sr_rec %p evchan %d ev_refcnt %" PRId32
+				" direction out poll failed (%d)",
+				__func__, rec, rec->xprt.xp_fd,
+				rec->xprt.xp_refcnt,
+				sr_rec, sr_rec->id_k, sr_rec->ev_refcnt, code);
+		}
+	}
+
+	return (code);
+}
+#endif /* TIRPC_IOURING */
+
 int
 svc_rqst_new_evchan(uint32_t *chan_id /* OUT */, void *u_data, uint32_t flags)
 {
@@ -412,20 +1094,37 @@ svc_rqst_new_evchan(uint32_t *chan_id /* OUT */, void *u_data, uint32_t flags)
 
 	flags |= SVC_RQST_FLAG_EPOLL;	/* XXX */
 
-	/* create a pair of anonymous sockets for async event channel wakeups */
-	code = socketpair(AF_UNIX, SOCK_STREAM, 0, sr_rec->sv);
+	/* async event channel wakeups */
+	code = ev_sig_init(sr_rec);
 	if (code) {
-		code = errno;
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: failed creating event signal socketpair (%d) for sr_rec",
+			"%s: failed creating event signal (%d) for sr_rec",
 			__func__, code);
 		goto fail;
 	}
 
-	/* set non-blocking */
-	SetNonBlock(sr_rec->sv[0]);
-	SetNonBlock(sr_rec->sv[1]);
+	/* each ready event, plus the next event task */
+	sr_rec->ev_wpev_max = __svc_params->ev_u.evchan.max_events + 1;
+	sr_rec->ev_wpev = (struct work_pool_entry **)
+	    mem_alloc(sr_rec->ev_wpev_max * sizeof(struct work_pool_entry *));
 
+#if defined(TIRPC_IOURING)
+	if (__svc_params->ev_type == SVC_EVENT_IOURING) {
+		code = svc_rqst_uring_init(sr_rec);
+		if (!code) {
+			sr_rec->ev_type = SVC_EVENT_IOURING;
+			fun = svc_rqst_iouring_loop;
+			flags &= ~SVC_RQST_FLAG_EPOLL;
+		} else {
+			__warnx(TIRPC_DEBUG_FLAG_WARN,
+				"%s: io_uring unavailable (%d), using epoll",
+				__func__, code);
+			/* do not retry for the remaining channels */
+			__svc_params->ev_type = SVC_EVENT_EPOLL;
+			code = 0;
+		}
+	}
+#endif
 #if defined(TIRPC_EPOLL)
 	if (flags & SVC_RQST_FLAG_EPOLL) {
 		sr_rec->ev_type = SVC_EVENT_EPOLL;
@@ -477,7 +1176,7 @@ svc_rqst_new_evchan(uint32_t *chan_id /* OUT */, void *u_data, uint32_t flags)
 			sr_rec, sr_rec->id_k, ref_rec,
 			sr_rec->ev_u.epoll.epoll_fd, code,
 			&sr_rec->ev_u.epoll.ctrl_ev);
-	} else {
+	} else if (!fun) {
 		/* legacy fdset (currently unhooked) */
 		sr_rec->ev_type = SVC_EVENT_FDSET;
 	}
@@ -489,12 +1188,14 @@ svc_rqst_new_evchan(uint32_t *chan_id /* OUT */, void *u_data, uint32_t flags)
 
 	sr_rec->id_k = n_id;
 	sr_rec->ev_flags = flags & SVC_RQST_FLAG_MASK;
-	opr_rbtree_init(&sr_rec->call_expires, svc_rqst_expire_cmpf);
+	timer_wheel_init(&sr_rec->call_expires, svc_rqst_expire_ms(NULL));
+	timer_wheel_init(&sr_rec->ev_delays, svc_rqst_expire_ms(NULL));
+	sr_rec->ev_wait_ms = 0;
 	atomic_inc_int32_t(&sr_rec->ev_refcnt);
 	ref_rec++;
 	sr_rec->ev_wpe.fun = fun;
 	sr_rec->ev_wpe.arg = u_data;
-	work_pool_submit(&svc_work_pool, &sr_rec->ev_wpe);
+	work_pool_submit(&svc_work_pool, &sr_rec->ev_wpe, WORK_POOL_PRIO_HIGH);
 
 	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
 		"%s: create evchan %d control fd pair (%d:%d)",
@@ -623,6 +1324,50 @@ svc_rqst_unhook_events(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
 		}
 		break;
 	}
+#endif
+#if defined(TIRPC_IOURING)
+	case SVC_EVENT_IOURING:
+	{
+		/* a poll that already fired completes the removal with
+		 * ENOENT, and the xprt lookup tolerates late completions.
+		 */
+		if (ev_flags & SVC_XPRT_FLAG_ADDED_RECV) {
+			code = svc_rqst_uring_submit(sr_rec,
+						IORING_OP_POLL_REMOVE,
+						rec->xprt.xp_fd, 0,
+						svc_rqst_uring_data(
+							rec->xprt.xp_fd,
+							SVC_RQST_URING_RECV));
+			if (!code)
+				atomic_clear_uint16_t_bits(
+						&rec->xprt.xp_flags,
+						SVC_XPRT_FLAG_ADDED_RECV);
+		}
+
+		if (ev_flags & SVC_XPRT_FLAG_ADDED_SEND) {
+			code = svc_rqst_uring_submit(sr_rec,
+						IORING_OP_POLL_REMOVE,
+						rec->xprt.xp_fd, 0,
+						svc_rqst_uring_data(
+							rec->xprt.xp_fd,
+							SVC_RQST_URING_SEND));
+			if (!code)
+				atomic_clear_uint16_t_bits(
+						&rec->xprt.xp_flags,
+						SVC_XPRT_FLAG_ADDED_SEND);
+		}
+
+		if (code) {
+			__warnx(TIRPC_DEBUG_FLAG_WARN,
+				"%s: %p fd %d xp_refcnt %" PRId32
+				" sr_rec %p evchan %d ev_refcnt %" PRId32
+				" unhook failed (%d)",
+				__func__, rec, rec->xprt.xp_fd,
+				rec->xprt.xp_refcnt,
+				sr_rec, sr_rec->id_k, sr_rec->ev_refcnt, code);
+		}
+		break;
+	}
 #endif
 	default:
 		/* XXX formerly select/fd_set case, now placeholder for new
@@ -633,6 +1378,91 @@ svc_rqst_unhook_events(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
 	return (code);
 }
 
+/*
+ * Edge-triggered receive stays hooked, so rearm hands back ownership.
+ * An edge that arrived while owned (or a reader that stopped short of
+ * EAGAIN) queues another receive task instead, without epoll_ctl().
+ */
+static int
+svc_rqst_edge_rearm(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec)
+{
+	uint32_t ev_state = atomic_postclear_uint32_t_bits(&rec->ev_state,
+							   RPC_DPLX_EV_ACTIVE);
+
+	if (!(ev_state & RPC_DPLX_EV_PENDING))
+		return (0);
+
+	/* take it back, unless a new event already did */
+	if (atomic_postset_uint32_t_bits(&rec->ev_state, RPC_DPLX_EV_ACTIVE)
+	    & RPC_DPLX_EV_ACTIVE)
+		return (0);
+
+	if ((rec->xprt.xp_flags & SVC_XPRT_FLAG_DESTROYED)
+	    || (sr_rec->ev_flags & SVC_RQST_FLAG_SHUTDOWN)) {
+		atomic_clear_uint32_t_bits(&rec->ev_state,
+					   RPC_DPLX_EV_ACTIVE |
+					   RPC_DPLX_EV_PENDING);
+		return (0);
+	}
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: %p fd %d xp_refcnt %" PRId32 " pending, continue",
+		__func__, rec, rec->xprt.xp_fd, rec->xprt.xp_refcnt);
+
+	/* the ref otherwise taken by the event lookup */
+	SVC_REF(&rec->xprt, SVC_REF_FLAG_NONE);
+	atomic_set_uint16_t_bits(&rec->ioq.ioq_s.qflags, IOQ_FLAG_WORKING);
+	rec->ioq.ioq_wpe.fun = svc_rqst_xprt_task_recv;
+	rec->ioq.rec = rec;
+	if (!svc_rqst_fair(&rec->ioq))
+		work_pool_submit(&svc_work_pool, &rec->ioq.ioq_wpe,
+				 WORK_POOL_PRIO_NORMAL);
+	return (0);
+}
+
+/*
+ * Queue another receive task for data the transport has already read
+ * ahead, which no event would report.  Called by the task owning the
+ * receive side, instead of rearming.
+ */
+int
+svc_rqst_xprt_resubmit(SVCXPRT *xprt)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	struct svc_rqst_rec *sr_rec = rec->ev_p;
+
+	if (rec->ev_state & RPC_DPLX_EV_EDGE) {
+		/* still hooked, the rearm continues as if for an edge */
+		atomic_set_uint32_t_bits(&rec->ev_state, RPC_DPLX_EV_PENDING);
+		return svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV);
+	}
+
+	if ((xprt->xp_flags & SVC_XPRT_FLAG_DESTROYED)
+	    || !sr_rec || (sr_rec->ev_flags & SVC_RQST_FLAG_SHUTDOWN))
+		return (0);
+
+	/* lost to svc_vc_destroy_it() */
+	if (atomic_postset_uint16_t_bits(&rec->ioq.ioq_s.qflags,
+					 IOQ_FLAG_WORKING)
+	    & IOQ_FLAG_WORKING)
+		return (0);
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: %p fd %d xp_refcnt %" PRId32 " read ahead, continue",
+		__func__, rec, rec->xprt.xp_fd, rec->xprt.xp_refcnt);
+
+	/* the ref otherwise taken by the event lookup, and the epoll
+	 * registration stays disarmed until the next task rearms
+	 */
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	rec->ioq.ioq_wpe.fun = svc_rqst_xprt_task_recv;
+	rec->ioq.rec = rec;
+	if (!svc_rqst_fair(&rec->ioq))
+		work_pool_submit(&svc_work_pool, &rec->ioq.ioq_wpe,
+				 WORK_POOL_PRIO_NORMAL);
+	return (0);
+}
+
 /*
  * rpc_dplx_rec lock must be held
  */
@@ -647,6 +1477,10 @@ svc_rqst_rearm_events_locked(SVCXPRT *xprt, uint16_t ev_flags)
 	tracepoint(xprt, rearm, __func__, __LINE__, xprt, ev_flags);
 #endif /* USE_LTTNG_NTIRPC */
 
+	if ((ev_flags & SVC_XPRT_FLAG_ADDED_RECV)
+	    && (rec->ev_state & RPC_DPLX_EV_EDGE))
+		return svc_rqst_edge_rearm(rec, sr_rec);
+
 	const bool is_xprt_destroyed = xprt->xp_flags & (ev_flags | SVC_XPRT_FLAG_DESTROYED);
 	/* MUST follow the destroyed check above */
 	const bool is_rec_shutdown = !is_xprt_destroyed && (
@@ -759,6 +1593,13 @@ svc_rqst_rearm_events_locked(SVCXPRT *xprt, uint16_t ev_flags)
 		}
 		break;
 	}
+#endif
+#if defined(TIRPC_IOURING)
+	case SVC_EVENT_IOURING:
+		code = svc_rqst_uring_arm(rec, sr_rec, ev_flags);
+		if (code)
+			SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+		break;
 #endif
 	default:
 		/* XXX formerly select/fd_set case, now placeholder for new
@@ -799,6 +1640,10 @@ svc_rqst_hook_events(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
 	/* assuming success */
 	atomic_set_uint16_t_bits(&rec->xprt.xp_flags, ev_flags);
 
+	/* only epoll has an edge-triggered mode */
+	if (sr_rec->ev_type != SVC_EVENT_EPOLL)
+		atomic_clear_uint32_t_bits(&rec->ev_state, RPC_DPLX_EV_EDGE);
+
 	switch (sr_rec->ev_type) {
 #if defined(TIRPC_EPOLL)
 	case SVC_EVENT_EPOLL:
@@ -816,8 +1661,12 @@ svc_rqst_hook_events(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
 			/* set up epoll user data */
 			ev->data.fd = rec->xprt.xp_fd;
 
-			/* wait for read events, level triggered, oneshot */
-			ev->events = EPOLLONESHOT | EPOLLIN;
+			/* wait for read events, level triggered, oneshot;
+			 * or edge triggered, with ownership in ev_state
+			 */
+			ev->events = (rec->ev_state & RPC_DPLX_EV_EDGE)
+				   ? EPOLLIN | EPOLLET
+				   : EPOLLONESHOT | EPOLLIN;
 
 			/* add to epoll vector */
 			code = epoll_ctl(sr_rec->ev_u.epoll.epoll_fd,
@@ -892,6 +1741,11 @@ svc_rqst_hook_events(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
 		}
 		break;
 	}
+#endif
+#if defined(TIRPC_IOURING)
+	case SVC_EVENT_IOURING:
+		code = svc_rqst_uring_arm(rec, sr_rec, ev_flags);
+		break;
 #endif
 	default:
 		/* XXX formerly select/fd_set case, now placeholder for new
@@ -903,7 +1757,7 @@ svc_rqst_hook_events(struct rpc_dplx_rec *rec, struct svc_rqst_rec *sr_rec,
 		"%s: sv[0] fd %d before ev_sig (sr_rec %p)",
 		__func__, sr_rec->sv[0],
 		sr_rec);
-	ev_sig(sr_rec->sv[0], 0);	/* send wakeup */
+	ev_sig(sr_rec, 0);	/* send wakeup */
 
 	return (code);
 }
@@ -1024,71 +1878,275 @@ svc_rqst_evchan_write(SVCXPRT *xprt, struct xdr_ioq *xioq, bool has_blocked)
 
 	rpc_dplx_rui(rec);
 
-	return (code);
+	return (code);
+}
+
+/*
+ * Let the kernel poll the device queue in the receive path, rather than
+ * wait for the interrupt.  Best effort: raising SO_BUSY_POLL above
+ * net.core.busy_read needs CAP_NET_ADMIN.
+ */
+static void
+svc_rqst_busy_poll_sock(SVCXPRT *xprt)
+{
+#if defined(SO_BUSY_POLL)
+	int val = __svc_params->so_busy_poll_us;
+
+	if (setsockopt(xprt->xp_fd, SOL_SOCKET, SO_BUSY_POLL,
+		       &val, sizeof(val))) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+			"%s: %p fd %d SO_BUSY_POLL failed (%d)",
+			__func__, xprt, xprt->xp_fd, errno);
+		return;
+	}
+#if defined(SO_PREFER_BUSY_POLL)
+	val = 1;
+	if (setsockopt(xprt->xp_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+		       &val, sizeof(val))) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+			"%s: %p fd %d SO_PREFER_BUSY_POLL failed (%d)",
+			__func__, xprt, xprt->xp_fd, errno);
+	}
+#endif
+#endif
+}
+
+/*
+ * sr_rec referenced by svc_rqst_lookup_chan(),
+ * flags indicate locking state
+ */
+static int
+svc_rqst_rec_reg(struct svc_rqst_rec *sr_rec, SVCXPRT *xprt, uint32_t flags)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	uint32_t chan_id = sr_rec->id_k;
+	int code;
+	uint16_t bits = SVC_XPRT_FLAG_ADDED_RECV | (flags & SVC_XPRT_FLAG_UREG);
+
+	if (!(flags & RPC_DPLX_LOCKED))
+		rpc_dplx_rli(rec);
+
+	if (rec->ev_p) {
+		if (rec->ev_p == sr_rec) {
+			if (!(flags & RPC_DPLX_LOCKED))
+				rpc_dplx_rui(rec);
+			__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+				"%s: %p already registered evchan %d",
+				__func__, xprt, chan_id);
+			return (0);
+		}
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+			"%s: %p unregistering evchan %d",
+			__func__, xprt, rec->ev_p->id_k);
+		svc_rqst_unreg(rec, rec->ev_p);
+	}
+
+	/* link from xprt */
+	rec->ev_p = sr_rec;
+
+	if (__svc_params->flags & SVC_FLAG_SO_BUSY_POLL)
+		svc_rqst_busy_poll_sock(xprt);
+
+	/* register sr_rec on event channel */
+	code = svc_rqst_hook_events(rec, sr_rec, bits);
+
+	if (!(flags & RPC_DPLX_LOCKED))
+		rpc_dplx_rui(rec);
+
+	return (code);
+}
+
+/*
+ * flags indicate locking state
+ */
+int
+svc_rqst_evchan_reg(uint32_t chan_id, SVCXPRT *xprt, uint32_t flags)
+{
+	struct svc_rqst_rec *sr_rec;
+	int code;
+
+	if (chan_id == 0) {
+		/* Create a global/legacy event channel */
+		code = svc_rqst_new_evchan(&(__svc_params->ev_u.evchan.id),
+					   NULL /* u_data */ ,
+					   SVC_RQST_FLAG_CHAN_AFFINITY);
+		if (code) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p failed to create global/legacy channel (%d)",
+				__func__, xprt, code);
+			return (code);
+		}
+		chan_id = __svc_params->ev_u.evchan.id;
+	}
+
+	sr_rec = svc_rqst_lookup_chan(chan_id);
+
+	if (!sr_rec) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p unknown evchan %d",
+			__func__, xprt, chan_id);
+		return (ENOENT);
+	}
+
+	return svc_rqst_rec_reg(sr_rec, xprt, flags);
+}
+
+/*
+ * Register on a given channel, creating channels as needed
+ */
+static int
+svc_rqst_chan_reg(uint32_t chan, SVCXPRT *newxprt)
+{
+	struct svc_rqst_rec *sr_rec;
+	uint32_t ix;
+	uint32_t id;
+
+	if (chan >= svc_rqst_set.max_id)
+		return (ENOENT);
+
+	/* channel ids are handed out in sequence */
+	for (ix = 0; ix < svc_rqst_set.max_id; ix++) {
+		sr_rec = svc_rqst_lookup_chan(chan);
+		if (sr_rec)
+			return svc_rqst_rec_reg(sr_rec, newxprt,
+						SVC_RQST_FLAG_NONE);
+		if (svc_rqst_new_evchan(&id, NULL, SVC_RQST_FLAG_NONE))
+			break;
+	}
+	return (ENOENT);
+}
+
+/*
+ * SVC_FLAG_AFFINITY placement
+ */
+static int
+svc_rqst_affinity_reg(SVCXPRT *newxprt)
+{
+	int chan = svc_rqst_affinity_chan(newxprt);
+
+	if (chan < 0)
+		return (ENOENT);
+
+	return svc_rqst_chan_reg(chan, newxprt);
 }
 
+#if defined(SO_ATTACH_REUSEPORT_CBPF)
 /*
- * flags indicate locking state
+ * Steer each connection or datagram to socket (cpu % count) of the
+ * group, which is their order of binding.
  */
-int
-svc_rqst_evchan_reg(uint32_t chan_id, SVCXPRT *xprt, uint32_t flags)
+static void
+svc_rqst_reuseport_steer(int fd, u_int count)
 {
-	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
-	struct svc_rqst_rec *sr_rec;
-	int code;
-	uint16_t bits = SVC_XPRT_FLAG_ADDED_RECV | (flags & SVC_XPRT_FLAG_UREG);
-
-	if (chan_id == 0) {
-		/* Create a global/legacy event channel */
-		code = svc_rqst_new_evchan(&(__svc_params->ev_u.evchan.id),
-					   NULL /* u_data */ ,
-					   SVC_RQST_FLAG_CHAN_AFFINITY);
-		if (code) {
-			__warnx(TIRPC_DEBUG_FLAG_ERROR,
-				"%s: %p failed to create global/legacy channel (%d)",
-				__func__, xprt, code);
-			return (code);
-		}
-		chan_id = __svc_params->ev_u.evchan.id;
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, count },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       &prog, sizeof(prog))) {
+		__warnx(TIRPC_DEBUG_FLAG_WARN,
+			"%s: fd %d SO_ATTACH_REUSEPORT_CBPF failed (%d), by hash",
+			__func__, fd, errno);
 	}
+}
+#else
+#define svc_rqst_reuseport_steer(fd, count)
+#endif
 
-	sr_rec = svc_rqst_lookup_chan(chan_id);
+static int
+svc_rqst_reuseport_socket(const struct sockaddr *addr, socklen_t addrlen,
+			  int type)
+{
+	int on = 1;
+	int fd = socket(addr->sa_family, type | SOCK_CLOEXEC, 0);
 
-	if (!sr_rec) {
+	if (fd < 0)
+		return (-1);
+
+	if ((type == SOCK_STREAM
+	     && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)))
+	    || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))
+	    || bind(fd, addr, addrlen)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p unknown evchan %d",
-			__func__, xprt, chan_id);
-		return (ENOENT);
+			"%s: fd %d reuseport bind failed (%d)",
+			__func__, fd, errno);
+		close(fd);
+		return (-1);
 	}
+	return (fd);
+}
 
-	if (!(flags & RPC_DPLX_LOCKED))
-		rpc_dplx_rli(rec);
+/**
+ * @brief Shard a listener over the event channels
+ *
+ * Creates up to count SO_REUSEPORT sockets bound to addr, as SOCK_STREAM
+ * listeners or SOCK_DGRAM services, and registers socket n on channel
+ * (n % channels), so that accepts and datagrams are taken in parallel.
+ * With SVC_RQST_FLAG_REUSEPORT_CPU, the kernel picks the socket by the
+ * receiving cpu rather than by hash.
+ *
+ * @param[in] addr	address to bind
+ * @param[in] addrlen	its length
+ * @param[in] type	SOCK_STREAM or SOCK_DGRAM
+ * @param[in] sendsz	as svc_vc_ncreatef() or svc_dg_ncreatef()
+ * @param[in] recvsz	as svc_vc_ncreatef() or svc_dg_ncreatef()
+ * @param[in] flags	SVC_RQST_FLAG_REUSEPORT_CPU
+ * @param[out] xprts	the transports
+ * @param[in] count	number wanted
+ *
+ * @return number created, which may be fewer; -1 for none.
+ */
+int
+svc_rqst_reuseport_ncreate(const struct sockaddr *addr, socklen_t addrlen,
+			   int type, u_int sendsz, u_int recvsz,
+			   uint32_t flags, SVCXPRT **xprts, u_int count)
+{
+	const uint32_t create = SVC_CREATE_FLAG_CLOSE
+				| SVC_CREATE_FLAG_XPRT_NOREG;
+	SVCXPRT *xprt;
+	u_int n;
+	int fd;
 
-	if (rec->ev_p) {
-		if (rec->ev_p == sr_rec) {
-			if (!(flags & RPC_DPLX_LOCKED))
-				rpc_dplx_rui(rec);
-			__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
-				"%s: %p already registered evchan %d",
-				__func__, xprt, chan_id);
-			return (0);
-		}
-		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
-			"%s: %p unregistering evchan %d",
-			__func__, xprt, rec->ev_p->id_k);
-		svc_rqst_unreg(rec, rec->ev_p);
-	}
+	if (type != SOCK_STREAM && type != SOCK_DGRAM)
+		return (-1);
 
-	/* link from xprt */
-	rec->ev_p = sr_rec;
+	for (n = 0; n < count; n++) {
+		fd = svc_rqst_reuseport_socket(addr, addrlen, type);
+		if (fd < 0)
+			break;
 
-	/* register sr_rec on event channel */
-	code = svc_rqst_hook_events(rec, sr_rec, bits);
+		/* once for the group */
+		if (!n && (flags & SVC_RQST_FLAG_REUSEPORT_CPU))
+			svc_rqst_reuseport_steer(fd, count);
 
-	if (!(flags & RPC_DPLX_LOCKED))
-		rpc_dplx_rui(rec);
+		xprt = (type == SOCK_STREAM)
+			? svc_vc_ncreatef(fd, sendsz, recvsz,
+					  create | SVC_CREATE_FLAG_LISTEN)
+			: svc_dg_ncreatef(fd, sendsz, recvsz, create);
+		if (!xprt) {
+			close(fd);
+			break;
+		}
 
-	return (code);
+		if (svc_rqst_chan_reg(n % svc_rqst_set.max_id, xprt)) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s: %p fd %d no evchan",
+				__func__, xprt, fd);
+			SVC_DESTROY(xprt);
+			break;
+		}
+		xprts[n] = xprt;
+	}
+
+	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+		"%s: %u of %u sockets", __func__, n, count);
+	return (n ? n : -1);
 }
 
 /*
@@ -1115,8 +2173,15 @@ svc_rqst_xprt_register(SVCXPRT *newxprt, SVCXPRT *xprt)
 
 	/* if round robin policy, begin with global/legacy event channel */
 	if (!(sr_rec->ev_flags & SVC_RQST_FLAG_CHAN_AFFINITY)) {
-		int code = svc_rqst_evchan_reg(round_robin, newxprt,
-					       SVC_RQST_FLAG_NONE);
+		int code;
+
+		/* unless placed on the channel for its incoming cpu */
+		if ((__svc_params->flags & SVC_FLAG_AFFINITY)
+		    && !svc_rqst_affinity_reg(newxprt))
+			return (0);
+
+		code = svc_rqst_evchan_reg(round_robin, newxprt,
+					   SVC_RQST_FLAG_NONE);
 
 		if (!code) {
 			/* advance round robin channel */
@@ -1200,6 +2265,11 @@ svc_rqst_xprt_task_recv(struct work_pool_entry *wpe)
 
 	atomic_clear_uint16_t_bits(&ioq->ioq_s.qflags, IOQ_FLAG_WORKING);
 
+	/* edges from here on are seen by this task's rearm */
+	if (rec->ev_state & RPC_DPLX_EV_EDGE)
+		atomic_clear_uint32_t_bits(&rec->ev_state,
+					   RPC_DPLX_EV_PENDING);
+
 #ifdef USE_LTTNG_NTIRPC
 	tracepoint(xprt, recv, __func__, __LINE__,
 		   &rec->xprt,
@@ -1221,6 +2291,17 @@ svc_rqst_xprt_task_recv(struct work_pool_entry *wpe)
 	SVC_RELEASE(&rec->xprt, SVC_RELEASE_FLAG_NONE);
 }
 
+void
+svc_request_release(struct svc_req *req, enum xprt_stat stat)
+{
+	if (req->rq_auth)
+		SVCAUTH_RELEASE(req);
+
+	XDR_DESTROY(req->rq_xdrs);
+
+	__svc_params->free_cb(req, stat);
+}
+
 enum xprt_stat svc_request(SVCXPRT *xprt, XDR *xdrs)
 {
 	enum xprt_stat stat;
@@ -1229,6 +2310,12 @@ enum xprt_stat svc_request(SVCXPRT *xprt, XDR *xdrs)
 
 	/* Track the request we are processing */
 	rpc_dplx_rec->svc_req = req;
+	req->rq_coro = NULL;
+
+	/* On a coroutine, XPRT_SUSPEND when it suspended or returned so */
+	if ((__svc_params->flags & SVC_FLAG_CORO)
+	 && svc_coro_request(req, &stat))
+		return stat;
 
 	/* All decode functions basically do a
 	 * return xprt->xp_dispatch.process_cb(req);
@@ -1243,13 +2330,7 @@ enum xprt_stat svc_request(SVCXPRT *xprt, XDR *xdrs)
 		return XPRT_SUSPEND;
 	}
 
-	if (req->rq_auth)
-		SVCAUTH_RELEASE(req);
-
-	XDR_DESTROY(req->rq_xdrs);
-
-	__svc_params->free_cb(req, stat);
-
+	svc_request_release(req, stat);
 	return stat;
 }
 
@@ -1270,18 +2351,17 @@ static void svc_resume_task(struct work_pool_entry *wpe)
 		return;
 	}
 
-	if (req->rq_auth)
-		SVCAUTH_RELEASE(req);
-
-	XDR_DESTROY(req->rq_xdrs);
-
-	__svc_params->free_cb(req, stat);
+	svc_request_release(req, stat);
 }
 
 void svc_resume(struct svc_req *req)
 {
+	/* continues its coroutine, unless that returned XPRT_SUSPEND */
+	if (req->rq_coro && svc_coro_resume(req))
+		return;
+
 	req->rq_wpe.fun = svc_resume_task;
-	work_pool_submit(&svc_work_pool, &req->rq_wpe);
+	work_pool_submit(&svc_work_pool, &req->rq_wpe, WORK_POOL_PRIO_HIGH);
 }
 
 /*static*/ void
@@ -1366,12 +2446,13 @@ svc_rqst_clean_idle(int timeout)
 	if (timeout <= 0)
 		goto unlock;
 
-	/* trim xprts (not sorted, not aggressive [but self limiting]) */
+	/* trim xprts, only those due on the idle wheel */
 	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &acc.ts);
 	acc.timeout = timeout;
 	acc.cleaned = 0;
 
-	svc_xprt_foreach(svc_rqst_clean_func, (void *)&acc);
+	(void)svc_xprt_foreach_idle(timeout, svc_rqst_clean_func,
+				    (void *)&acc);
 
  unlock:
 	--active;
@@ -1389,6 +2470,7 @@ svc_rqst_epoll_event(struct svc_rqst_rec *sr_rec, struct epoll_event *ev)
 	uint16_t xp_flags, ev_flag = 0;
 	struct xdr_ioq *ioq = NULL;
 	work_pool_fun_t fun;
+	bool edge = false;
 
 	if (unlikely(ev->data.fd == sr_rec->sv[1])) {
 		/* signalled -- there was a wakeup on ctrl_ev (see
@@ -1397,7 +2479,7 @@ svc_rqst_epoll_event(struct svc_rqst_rec *sr_rec, struct epoll_event *ev)
 			"%s: fd %d wakeup (sr_rec %p)",
 			__func__, sr_rec->sv[1],
 			sr_rec);
-		(void)consume_ev_sig_nb(sr_rec->sv[1]);
+		ev_sig_consume(sr_rec);
 		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
 			"%s: fd %d after consume sig (sr_rec %p)",
 			__func__, sr_rec->sv[1],
@@ -1422,11 +2504,17 @@ svc_rqst_epoll_event(struct svc_rqst_rec *sr_rec, struct epoll_event *ev)
 		ev->events & EPOLLOUT ? " SEND" : "",
 		rec, sr_rec);
 
-	if (ev->events & EPOLLIN) {
-		/* This is a RECV event */
+	if ((ev->events & EPOLLIN)
+	 || ((ev->events & (EPOLLERR | EPOLLOUT)) == EPOLLERR
+	  && (__svc_params->flags & SVC_FLAG_ZEROCOPY)
+	  && (rec->xprt.xp_flags & SVC_XPRT_FLAG_ADDED_RECV))) {
+		/* This is a RECV event, or MSG_ZEROCOPY completions on the
+		 * error queue (svc_vc_recv reaps them before reading).
+		 */
 		ev_flag = SVC_XPRT_FLAG_ADDED_RECV;
 		ioq = &rec->ioq;
 		fun = svc_rqst_xprt_task_recv;
+		edge = rec->ev_state & RPC_DPLX_EV_EDGE;
 	} else if (ev->events & EPOLLOUT) {
 		/* This is a SEND event */
 		ev_flag = SVC_XPRT_FLAG_ADDED_SEND;
@@ -1441,7 +2529,20 @@ svc_rqst_epoll_event(struct svc_rqst_rec *sr_rec, struct epoll_event *ev)
 	/* MUST handle flags after reference.
 	 * Although another task may unhook, the error is non-fatal.
 	 */
-	xp_flags = atomic_postclear_uint16_t_bits(&rec->xprt.xp_flags, ev_flag);
+	if (edge) {
+		/* stays hooked, the owner will see this edge on rearm */
+		if (atomic_postset_uint32_t_bits(&rec->ev_state,
+						 RPC_DPLX_EV_ACTIVE |
+						 RPC_DPLX_EV_PENDING)
+		    & RPC_DPLX_EV_ACTIVE) {
+			SVC_RELEASE(&rec->xprt, SVC_RELEASE_FLAG_NONE);
+			return (NULL);
+		}
+		xp_flags = atomic_fetch_uint16_t(&rec->xprt.xp_flags);
+	} else {
+		xp_flags = atomic_postclear_uint16_t_bits(&rec->xprt.xp_flags,
+							  ev_flag);
+	}
 
 	__warnx(TIRPC_DEBUG_FLAG_SVC_RQST |
 		TIRPC_DEBUG_FLAG_REFCNT,
@@ -1473,6 +2574,11 @@ svc_rqst_epoll_event(struct svc_rqst_rec *sr_rec, struct epoll_event *ev)
 		return ioq;
 	}
 
+	if (edge)
+		atomic_clear_uint32_t_bits(&rec->ev_state,
+					   RPC_DPLX_EV_ACTIVE |
+					   RPC_DPLX_EV_PENDING);
+
 	/* Do not return destroyed transports.
 	 * Probably log non-fatal "WARNING! already destroying!"
 	 */
@@ -1480,21 +2586,41 @@ svc_rqst_epoll_event(struct svc_rqst_rec *sr_rec, struct epoll_event *ev)
 	return (NULL);
 }
 
+/*
+ * sends drain output, ahead of new receives; they fill the vector from
+ * the end
+ */
+static inline void
+svc_rqst_queue_ioq(struct xdr_ioq *ioq, struct work_pool_entry **wpev,
+		   int *n_wpe, struct work_pool_entry ***high)
+{
+	if (ioq->ioq_wpe.fun == svc_rqst_xprt_task_send)
+		*--(*high) = &ioq->ioq_wpe;
+	else
+		wpev[(*n_wpe)++] = &ioq->ioq_wpe;
+}
+
 /*
  * not locked
  */
 static inline struct xdr_ioq *
-svc_rqst_epoll_events(struct svc_rqst_rec *sr_rec, int n_events)
+svc_rqst_epoll_events(struct svc_rqst_rec *sr_rec, struct epoll_event *events,
+		      int n_events)
 {
+	struct work_pool_entry **wpev = sr_rec->ev_wpev;
+	struct work_pool_entry **high = wpev + sr_rec->ev_wpev_max;
 	struct xdr_ioq *ioq = NULL;
+	bool pinned = __svc_params->flags & SVC_FLAG_AFFINITY;
 	int ix = 0;
+	int n_wpe = 0;
+	int n_high = 0;
 
 	/* Find the first RECV or SEND event */
 	while (ix < n_events) {
-		ioq = svc_rqst_epoll_event(sr_rec,
-					   &sr_rec->ev_u.epoll.events[ix++]);
-		if (ioq)
+		ioq = svc_rqst_epoll_event(sr_rec, &events[ix++]);
+		if (ioq && !svc_rqst_fair(ioq))
 			break;
+		ioq = NULL;
 	}
 
 	if (!ioq) {
@@ -1502,62 +2628,162 @@ svc_rqst_epoll_events(struct svc_rqst_rec *sr_rec, int n_events)
 		return NULL;
 	}
 
+	/* a pinned loop keeps its worker, and queues the first event with
+	 * the rest
+	 */
+	if (pinned) {
+		svc_rqst_queue_ioq(ioq, wpev, &n_wpe, &high);
+		ioq = NULL;
+	}
+
 	while (ix < n_events) {
 		/* Queue up additional RECV or SEND events */
 		struct xdr_ioq *ioq = svc_rqst_epoll_event(sr_rec,
-					    &(sr_rec->ev_u.epoll.events[ix++]));
-		if (ioq)
-			work_pool_submit(&svc_work_pool, &ioq->ioq_wpe);
+							   &events[ix++]);
+		if (!ioq || svc_rqst_fair(ioq))
+			continue;
+
+		svc_rqst_queue_ioq(ioq, wpev, &n_wpe, &high);
 	}
 
-	/* submit another task to handle events in order */
-	atomic_inc_int32_t(&sr_rec->ev_refcnt);
-	work_pool_submit(&svc_work_pool, &sr_rec->ev_wpe);
+	/* otherwise another task to handle events in order, with the
+	 * sends.  Each class is submitted under a single queue lock.  The
+	 * vector is not touched once submitted, so the next task may
+	 * reuse it.
+	 */
+	if (!pinned) {
+		atomic_inc_int32_t(&sr_rec->ev_refcnt);
+		*--high = &sr_rec->ev_wpe;
+	}
+	n_high = wpev + sr_rec->ev_wpev_max - high;
+
+	work_pool_submit_batch(&svc_work_pool, wpev, n_wpe,
+			       WORK_POOL_PRIO_NORMAL);
+	work_pool_submit_batch(&svc_work_pool, high, n_high,
+			       WORK_POOL_PRIO_HIGH);
 
 	return ioq;
 }
 
+/*
+ * Returns true when this task was used for the first event, and another
+ * task continues waiting on the channel.  A pinned loop queues them all,
+ * and goes on waiting itself.
+ */
+static bool
+svc_rqst_dispatch_events(struct svc_rqst_rec *sr_rec,
+			 struct epoll_event *events, int n_events)
+{
+	struct xdr_ioq *ioq = svc_rqst_epoll_events(sr_rec, events, n_events);
+
+	if (ioq) {
+		/* use this hot thread for the first event */
+		ioq->ioq_wpe.fun(&ioq->ioq_wpe);
+	} else if (!(__svc_params->flags & SVC_FLAG_AFFINITY)) {
+		return (false);
+	}
+
+	/* failsafe idle processing after work task */
+	if (atomic_postclear_uint32_t_bits(&wakeups, ~SVC_RQST_WAKEUPS)
+	    > SVC_RQST_WAKEUPS) {
+		svc_rqst_clean_idle(__svc_params->idle_timeout);
+	}
+	return (ioq != NULL);
+}
+
+static inline uint64_t
+svc_rqst_elapsed_ns(struct timespec *start, struct timespec *now)
+{
+	return ((uint64_t)(now->tv_sec - start->tv_sec) * 1000000000ULL
+		+ now->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Adaptive busy poll, in the manner of KVM halt polling.  Spin on a zero
+ * timeout epoll_wait for up to the channel's budget before blocking.
+ * The budget grows when a blocking wait ended within the maximum, as a
+ * longer spin would have caught that event, and shrinks when the wait
+ * was longer or timed out.  An idle channel soon stops spinning.
+ */
+static int
+svc_rqst_epoll_wait(struct svc_rqst_rec *sr_rec, int timeout_ms)
+{
+	uint32_t max_ns = __svc_params->busy_poll_ns;
+	uint32_t poll_ns = sr_rec->ev_u.epoll.poll_ns;
+	struct timespec start;
+	struct timespec now;
+	uint64_t block_ns;
+	int n_events;
+	int err;
+
+	if (!max_ns || !timeout_ms) {
+		return epoll_wait(sr_rec->ev_u.epoll.epoll_fd,
+				  sr_rec->ev_u.epoll.events,
+				  sr_rec->ev_u.epoll.max_events,
+				  timeout_ms);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	now = start;
+	while (svc_rqst_elapsed_ns(&start, &now) < poll_ns) {
+		n_events = epoll_wait(sr_rec->ev_u.epoll.epoll_fd,
+				      sr_rec->ev_u.epoll.events,
+				      sr_rec->ev_u.epoll.max_events,
+				      0);
+		if (n_events
+		    || (sr_rec->ev_flags & SVC_RQST_FLAG_SHUTDOWN))
+			return (n_events);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	}
+
+	start = now;
+	n_events = epoll_wait(sr_rec->ev_u.epoll.epoll_fd,
+			      sr_rec->ev_u.epoll.events,
+			      sr_rec->ev_u.epoll.max_events,
+			      timeout_ms);
+	err = errno;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	block_ns = svc_rqst_elapsed_ns(&start, &now);
+
+	if (n_events > 0 && block_ns < max_ns) {
+		if (!poll_ns)
+			poll_ns = SVC_RQST_POLL_START_NS;
+		else
+			poll_ns *= 2;
+		if (poll_ns > max_ns)
+			poll_ns = max_ns;
+	} else if (poll_ns) {
+		poll_ns /= 2;
+		if (poll_ns < SVC_RQST_POLL_START_NS)
+			poll_ns = 0;
+	}
+
+	if (poll_ns != sr_rec->ev_u.epoll.poll_ns) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+			"%s: epoll_fd %d busy poll %" PRIu32 " ns",
+			__func__, sr_rec->ev_u.epoll.epoll_fd, poll_ns);
+		sr_rec->ev_u.epoll.poll_ns = poll_ns;
+	}
+	errno = err;
+	return (n_events);
+}
+
 static void svc_rqst_epoll_loop(struct work_pool_entry *wpe)
 {
 	struct svc_rqst_rec *sr_rec = 
 		opr_containerof(wpe, struct svc_rqst_rec, ev_wpe);
-	struct clnt_req *cc;
-	struct opr_rbtree_node *n;
-	struct timespec ts;
 	int timeout_ms;
-	int expire_ms;
 	int n_events;
 	bool finished;
 
-	for (;;) {
-		timeout_ms = SVC_RQST_TIMEOUT_MS;
-
-		/* coarse nsec, not system time */
-		(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
-		expire_ms = timespec_ms(&ts);
-
-		/* before epoll_wait will accumulate events during scan */
-		mutex_lock(&sr_rec->ev_lock);
-		while ((n = opr_rbtree_first(&sr_rec->call_expires))) {
-			cc = opr_containerof(n, struct clnt_req, cc_rqst);
-
-			if (cc->cc_expire_ms > expire_ms) {
-				timeout_ms = cc->cc_expire_ms - expire_ms;
-				break;
-			}
-
-			/* order dependent */
-			atomic_clear_uint16_t_bits(&cc->cc_flags,
-						   CLNT_REQ_FLAG_EXPIRING);
-			opr_rbtree_remove(&sr_rec->call_expires, &cc->cc_rqst);
-			cc->cc_expire_ms = 0;	/* atomic barrier(s) */
+	svc_rqst_affinity_pin(sr_rec);
 
-			atomic_inc_uint32_t(&cc->cc_refcnt);
-			cc->cc_wpe.fun = svc_rqst_expire_task;
-			cc->cc_wpe.arg = NULL;
-			work_pool_submit(&svc_work_pool, &cc->cc_wpe);
-		}
-		mutex_unlock(&sr_rec->ev_lock);
+	for (;;) {
+		/* before epoll_wait will accumulate events during scan,
+		 * no wait when shutting down
+		 */
+		timeout_ms = ev_sig_idle(sr_rec)
+			   ? 0 : svc_rqst_expire_scan(sr_rec);
 
 		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
 			"%s: epoll_fd %d before epoll_wait (%d)",
@@ -1565,10 +2791,8 @@ static void svc_rqst_epoll_loop(struct work_pool_entry *wpe)
 			sr_rec->ev_u.epoll.epoll_fd,
 			timeout_ms);
 
-		n_events = epoll_wait(sr_rec->ev_u.epoll.epoll_fd,
-				      sr_rec->ev_u.epoll.events,
-				      sr_rec->ev_u.epoll.max_events,
-				      timeout_ms);
+		n_events = svc_rqst_epoll_wait(sr_rec, timeout_ms);
+		ev_sig_awake(sr_rec);
 
 		if (unlikely(sr_rec->ev_flags & SVC_RQST_FLAG_SHUTDOWN)) {
 			__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
@@ -1589,21 +2813,10 @@ static void svc_rqst_epoll_loop(struct work_pool_entry *wpe)
 				sr_rec->ev_u.epoll.epoll_fd, n_events);
 
 			atomic_add_uint32_t(&wakeups, n_events);
-			struct xdr_ioq *ioq;
-
-			ioq = svc_rqst_epoll_events(sr_rec, n_events);
 
-			if (ioq != NULL) {
-				/* use this hot thread for the first event */
-				ioq->ioq_wpe.fun(&ioq->ioq_wpe);
-
-				/* failsafe idle processing after work task */
-				if (atomic_postclear_uint32_t_bits(
-					&wakeups, ~SVC_RQST_WAKEUPS)
-				    > SVC_RQST_WAKEUPS) {
-					svc_rqst_clean_idle(
-						__svc_params->idle_timeout);
-				}
+			if (svc_rqst_dispatch_events(sr_rec,
+						     sr_rec->ev_u.epoll.events,
+						     n_events)) {
 				finished = false;
 				break;
 			}
@@ -1641,14 +2854,177 @@ static void svc_rqst_epoll_loop(struct work_pool_entry *wpe)
 			sr_rec, sr_rec->id_k, sr_rec->ev_refcnt,
 			sr_rec->ev_u.epoll.epoll_fd);
 
+		svc_rqst_delay_flush(sr_rec);
 		close(sr_rec->ev_u.epoll.epoll_fd);
 		mem_free(sr_rec->ev_u.epoll.events,
 			 sr_rec->ev_u.epoll.max_events *
 			 sizeof(struct epoll_event));
 	}
 
+	svc_rqst_affinity_unpin();
+	svc_complete_task(sr_rec, finished);
+}
+
+#if defined(TIRPC_IOURING)
+/*
+ * Translate completions into epoll_events for the common dispatch.
+ * The control socket poll is rearmed here only when the kernel ended
+ * it, without IORING_CQE_F_MORE.
+ */
+static int
+svc_rqst_uring_reap(struct svc_rqst_rec *sr_rec)
+{
+	struct io_uring *ring = &sr_rec->ev_u.iouring.ring;
+	struct io_uring_cqe *cqe;
+	struct epoll_event *ev;
+	unsigned head;
+	unsigned seen = 0;
+	int n_events = 0;
+	bool signalled = false;
+	bool rearm = false;
+
+	io_uring_for_each_cqe(ring, head, cqe) {
+		if ((u_int)n_events >= sr_rec->ev_u.iouring.max_events)
+			break;
+		seen++;
+
+		switch (cqe->user_data & SVC_RQST_URING_KIND) {
+		case SVC_RQST_URING_CTRL:
+			if (cqe->res == -EINVAL
+			 && sr_rec->ev_u.iouring.ctrl_multi) {
+				/* multishot poll needs Linux 5.13 */
+				sr_rec->ev_u.iouring.ctrl_multi = false;
+			} else
+				signalled = true;
+#if defined(IORING_CQE_F_MORE)
+			if (cqe->flags & IORING_CQE_F_MORE)
+				break;
+#endif
+			rearm = true;
+			break;
+		case SVC_RQST_URING_RECV:
+		case SVC_RQST_URING_SEND:
+			/* cancelled by unhook */
+			if (cqe->res < 0)
+				break;
+			ev = &sr_rec->ev_u.iouring.events[n_events++];
+			ev->data.fd = (int)(cqe->user_data >> 2);
+			/* the poll kind, not the mask, picks the direction */
+			ev->events = ((cqe->user_data & SVC_RQST_URING_KIND)
+				      == SVC_RQST_URING_RECV)
+				   ? EPOLLIN : EPOLLOUT;
+			break;
+		default:
+			break;
+		}
+	}
+	io_uring_cq_advance(ring, seen);
+
+	if (signalled) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+			"%s: fd %d wakeup (sr_rec %p)",
+			__func__, sr_rec->sv[1],
+			sr_rec);
+		ev_sig_consume(sr_rec);
+	}
+	if (rearm) {
+		(void)svc_rqst_uring_submit(sr_rec, IORING_OP_POLL_ADD,
+					    sr_rec->sv[1], POLLIN,
+					    svc_rqst_uring_data(sr_rec->sv[1],
+							SVC_RQST_URING_CTRL));
+	}
+	return (n_events);
+}
+
+static void svc_rqst_iouring_loop(struct work_pool_entry *wpe)
+{
+	struct svc_rqst_rec *sr_rec =
+		opr_containerof(wpe, struct svc_rqst_rec, ev_wpe);
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec kts;
+	int timeout_ms;
+	int n_events;
+	int code;
+	bool finished;
+
+	svc_rqst_affinity_pin(sr_rec);
+
+	for (;;) {
+		/* before waiting will accumulate completions during scan,
+		 * no wait when shutting down
+		 */
+		timeout_ms = ev_sig_idle(sr_rec)
+			   ? 0 : svc_rqst_expire_scan(sr_rec);
+		kts.tv_sec = timeout_ms / 1000;
+		kts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+
+		/* only reaps, submission is done by the producers */
+		code = io_uring_wait_cqes(&sr_rec->ev_u.iouring.ring, &cqe, 1,
+					  &kts, NULL);
+		ev_sig_awake(sr_rec);
+
+		if (unlikely(sr_rec->ev_flags & SVC_RQST_FLAG_SHUTDOWN)) {
+			__warnx(TIRPC_DEBUG_FLAG_SVC_RQST,
+				"%s: ring_fd %d wait shutdown (%d)",
+				__func__,
+				sr_rec->ev_u.iouring.ring.ring_fd, code);
+			finished = true;
+			break;
+		}
+		if (!code) {
+			n_events = svc_rqst_uring_reap(sr_rec);
+			if (n_events <= 0)
+				continue;
+
+			__warnx(TIRPC_DEBUG_FLAG_SVC_RQST |
+				TIRPC_DEBUG_FLAG_REFCNT,
+				"%s: sr_rec %p evchan %d ev_refcnt %" PRId32
+				" ring_fd %d n_events %d",
+				__func__,
+				sr_rec, sr_rec->id_k, sr_rec->ev_refcnt,
+				sr_rec->ev_u.iouring.ring.ring_fd, n_events);
+
+			atomic_add_uint32_t(&wakeups, n_events);
+
+			if (svc_rqst_dispatch_events(sr_rec,
+						     sr_rec->ev_u.iouring.events,
+						     n_events)) {
+				finished = false;
+				break;
+			}
+			continue;
+		}
+		if (code == -ETIME) {
+			/* timed out (idle) */
+			atomic_inc_uint32_t(&wakeups);
+			continue;
+		}
+		if (code != -EINTR) {
+			__warnx(TIRPC_DEBUG_FLAG_WARN,
+				"%s: ring_fd %d wait failed (%d)",
+				__func__,
+				sr_rec->ev_u.iouring.ring.ring_fd, -code);
+			finished = true;
+			break;
+		}
+	}
+	if (finished) {
+		__warnx(TIRPC_DEBUG_FLAG_SVC_RQST |
+			TIRPC_DEBUG_FLAG_REFCNT,
+			"%s: sr_rec %p evchan %d ev_refcnt %" PRId32
+			" ring_fd %d finished",
+			__func__,
+			sr_rec, sr_rec->id_k, sr_rec->ev_refcnt,
+			sr_rec->ev_u.iouring.ring.ring_fd);
+
+		svc_rqst_delay_flush(sr_rec);
+	}
+
+	/* the ring lives on until svc_rqst_rec_destroy() */
+	svc_rqst_affinity_unpin();
 	svc_complete_task(sr_rec, finished);
 }
+#endif /* TIRPC_IOURING */
 #endif
 
 static void svc_complete_task(struct svc_rqst_rec *sr_rec, bool finished)
@@ -1681,7 +3057,7 @@ svc_rqst_thrd_signal(uint32_t chan_id, uint32_t flags)
 		"%s: sv[0] fd %d before ev_sig (sr_rec %p) evchan %d",
 		__func__, sr_rec->sv[0],
 		sr_rec, chan_id);
-	ev_sig(sr_rec->sv[0], flags);	/* send wakeup */
+	ev_sig(sr_rec, flags);	/* send wakeup */
 
 	svc_rqst_release(sr_rec);
 	return (0);
@@ -1702,7 +3078,7 @@ svc_rqst_delete_evchan(uint32_t chan_id)
 		"%s: sv[0] fd %d before ev_sig (sr_rec %p)",
 		__func__, sr_rec->sv[0],
 		sr_rec);
-	ev_sig(sr_rec->sv[0], SVC_RQST_FLAG_SHUTDOWN);
+	ev_sig(sr_rec, SVC_RQST_FLAG_SHUTDOWN);
 
 	svc_rqst_release(sr_rec);
 	return (code);
@@ -80,6 +80,7 @@
 #include "rpc_dplx_internal.h"
 #include "svc_ioq.h"
 #include "haproxy.h"
+#include "xdr_ioq_pool.h"
 
 static void svc_vc_rendezvous_ops(SVCXPRT *);
 static void svc_vc_override_ops(SVCXPRT *, SVCXPRT *);
@@ -99,6 +100,13 @@ static void svc_vc_override_ops(SVCXPRT *, SVCXPRT *);
 
 #define LAST_FRAG ((u_int32_t)(1 << 31))
 
+/*
+ * Each receive reads up to this many bytes ahead, so that the record
+ * marks and bodies of small requests come in one call.  Fragments that
+ * do not fit are read straight into their own buffer.
+ */
+#define SVC_VC_READAHEAD (8192)
+
 /*
  * Usage:
  * xprt = svc_vc_ncreate(sock, send_buf_size, recv_buf_size);
@@ -117,8 +125,21 @@ static void svc_vc_override_ops(SVCXPRT *, SVCXPRT *);
 static void
 svc_vc_xprt_free(struct svc_vc_xprt *xd)
 {
+	struct poolq_entry *have;
+
+	/* MSG_ZEROCOPY replies; completed, or their data discarded by
+	 * svc_vc_zerocopy_linger(), so the kernel no longer reads them
+	 */
+	while ((have = TAILQ_FIRST(&xd->sx_zc.qh))) {
+		TAILQ_REMOVE(&xd->sx_zc.qh, have, q);
+		XDR_DESTROY(_IOQ(have)->xdrs);
+	}
+	poolq_head_destroy(&xd->sx_zc);
+
 	XDR_DESTROY(xd->sx_dr.ioq.xdrs);
 	rpc_dplx_rec_destroy(&xd->sx_dr);
+	if (xd->sx_ra)
+		mem_free(xd->sx_ra, SVC_VC_READAHEAD);
 	mem_free(xd, sizeof(struct svc_vc_xprt));
 }
 
@@ -130,6 +151,7 @@ svc_vc_xprt_zalloc(void)
 	/* Init SVCXPRT locks, etc */
 	rpc_dplx_rec_init(&xd->sx_dr);
 	xdr_ioq_setup(&xd->sx_dr.ioq);
+	poolq_head_setup(&xd->sx_zc);
 	return (xd);
 }
 
@@ -217,6 +239,11 @@ svc_vc_ncreatef(const int fd, const u_int sendsz, const u_int recvsz,
 	xdrmem_create(xd->sx_dr.ioq.xdrs, NULL, 0, XDR_ENCODE);
 
 	svc_vc_rendezvous_ops(xprt);
+
+	/* svc_vc_rendezvous accepts until none are left */
+	rc = fcntl(fd, F_GETFL);
+	if (rc >= 0)
+		(void)fcntl(fd, F_SETFL, rc | O_NONBLOCK);
 #ifdef RPC_VSOCK
 	if (si.si_af == AF_VSOCK)
 		 xprt->xp_type = XPRT_VSOCK_RENDEZVOUS;
@@ -413,57 +440,29 @@ svc_fd_ncreatef(const int fd, const u_int sendsize, const u_int recvsize,
 	return (xprt);
 }
 
- /*ARGSUSED*/
+/*
+ * An accepted connection, set up on a worker of its own.
+ */
+struct svc_vc_accept {
+	struct work_pool_entry sa_wpe;
+	SVCXPRT *sa_xprt;		/* listener, referenced */
+	struct sockaddr_storage sa_addr;
+	socklen_t sa_len;
+	int sa_fd;
+};
+
 static enum xprt_stat
-svc_vc_rendezvous(SVCXPRT *xprt)
+svc_vc_rendezvous_setup(SVCXPRT *xprt, int fd, struct sockaddr_storage *addr,
+			socklen_t len)
 {
 	struct svc_vc_xprt *req_xd = VC_DR(REC_XPRT(xprt));
 	SVCXPRT *newxprt;
 	struct svc_vc_xprt *xd;
-	struct sockaddr_storage addr;
 	struct __rpc_sockinfo si;
-	int fd;
 	int rc;
-	socklen_t len;
 	static int n = 1;
 	struct timeval timeval;
 
-#ifdef USE_LTTNG_NTIRPC
-	tracepoint(xprt, funcin, __func__, __LINE__, xprt);
-#endif /* USE_LTTNG_NTIRPC */
-
- again:
-	len = sizeof(addr);
-	fd = accept(xprt->xp_fd, (struct sockaddr *)(void *)&addr, &len);
-	if (fd < 0) {
-		if (errno == EINTR)
-			goto again;
-		/*
-		 * Clean out the most idle file descriptor when we're
-		 * running out.
-		 */
-		if (errno == EMFILE || errno == ENFILE) {
-			switch (__svc_params->ev_type) {
-#if defined(TIRPC_EPOLL)
-			case SVC_EVENT_EPOLL:
-				break;
-#endif
-			default:
-				abort();	/* XXX */
-				break;
-			}	/* switch */
-			goto again;
-		}
-		return (XPRT_DIED);
-	}
-	if (unlikely(svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV))) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
-			__func__, xprt, xprt->xp_fd);
-		close(fd);
-		return (XPRT_DIED);
-	}
-
 	(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &n, sizeof(n));
 
 	/*
@@ -485,8 +484,12 @@ svc_vc_rendezvous(SVCXPRT *xprt)
 
 	svc_vc_override_ops(newxprt, xprt);
 
+	if (__svc_params->flags & SVC_FLAG_EPOLL_ET)
+		atomic_set_uint32_t_bits(&REC_XPRT(newxprt)->ev_state,
+					 RPC_DPLX_EV_EDGE);
+
 	__rpc_address_setup(&newxprt->xp_remote);
-	memcpy(newxprt->xp_remote.nb.buf, &addr, len);
+	memcpy(newxprt->xp_remote.nb.buf, addr, len);
 	newxprt->xp_remote.nb.len = len;
 	XPRT_TRACE(newxprt, __func__, __func__, __LINE__);
 
@@ -552,6 +555,157 @@ svc_vc_rendezvous(SVCXPRT *xprt)
 	return (XPRT_IDLE);
 }
 
+static void
+svc_vc_rendezvous_task(struct work_pool_entry *wpe)
+{
+	struct svc_vc_accept *sa =
+			opr_containerof(wpe, struct svc_vc_accept, sa_wpe);
+	SVCXPRT *xprt = sa->sa_xprt;
+
+	(void)svc_vc_rendezvous_setup(xprt, sa->sa_fd, &sa->sa_addr,
+				      sa->sa_len);
+	mem_free(sa, sizeof(*sa));
+	SVC_RELEASE(xprt, SVC_RELEASE_FLAG_NONE);
+}
+
+/*
+ * Accepts up to accept_batch connections per event, then rearms.  The
+ * first is set up in this task as before, the others each in a task of
+ * their own.  The accepted sockets stay blocking, as replies depend on
+ * SO_SNDTIMEO.
+ */
+ /*ARGSUSED*/
+static enum xprt_stat
+svc_vc_rendezvous(SVCXPRT *xprt)
+{
+	struct svc_vc_accept *sa;
+	struct sockaddr_storage addr;
+	socklen_t len = 0;
+	u_int batch = __svc_params->accept_batch;
+	u_int count = 0;
+	int first = -1;
+	int fd;
+
+#ifdef USE_LTTNG_NTIRPC
+	tracepoint(xprt, funcin, __func__, __LINE__, xprt);
+#endif /* USE_LTTNG_NTIRPC */
+
+	while (count < batch) {
+		socklen_t alen = sizeof(addr);
+
+		sa = NULL;
+		if (first >= 0) {
+			sa = mem_alloc(sizeof(*sa));
+			alen = sizeof(sa->sa_addr);
+		}
+		fd = accept4(xprt->xp_fd,
+			     (struct sockaddr *)(sa ? &sa->sa_addr : &addr),
+			     &alen, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (sa)
+				mem_free(sa, sizeof(*sa));
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			/* EMFILE or ENFILE, retried on the next event */
+			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+				"%s: %p fd %d accept failed (%d)",
+				__func__, xprt, xprt->xp_fd, errno);
+			if (!count && errno != EMFILE && errno != ENFILE)
+				return (XPRT_DIED);
+			break;
+		}
+		count++;
+
+		if (!sa) {
+			first = fd;
+			len = alen;
+			continue;
+		}
+		sa->sa_xprt = xprt;
+		sa->sa_len = alen;
+		sa->sa_fd = fd;
+		sa->sa_wpe.fun = svc_vc_rendezvous_task;
+		SVC_REF(xprt, SVC_REF_FLAG_NONE);
+		work_pool_submit(&svc_work_pool, &sa->sa_wpe,
+				 WORK_POOL_PRIO_NORMAL);
+	}
+
+	if (unlikely(svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV))) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+			__func__, xprt, xprt->xp_fd);
+		if (first >= 0)
+			close(first);
+		return (XPRT_DIED);
+	}
+
+	if (first < 0)
+		return (XPRT_IDLE);
+
+	return (svc_vc_rendezvous_setup(xprt, first, &addr, len));
+}
+
+#ifdef HAVE_MSG_ZEROCOPY
+#define SVC_VC_ZC_LINGER_S (1)
+#define SVC_VC_ZC_RETRY_MS (10)
+
+/*
+ * MSG_ZEROCOPY replies stay referenced by the kernel until TCP has had them
+ * acknowledged, and might be retransmitted from until then.  Completions
+ * are only reported while the fd is open, so reap them before the close,
+ * retrying every SVC_VC_ZC_RETRY_MS from the timer wheel, up to
+ * SVC_VC_ZC_LINGER_S.  Past that, or with no channel left to wait on,
+ * abort the connection, so the close discards the unacknowledged data; or
+ * when the fd is not ours to close, abandon the replies rather than free
+ * them under the kernel.
+ *
+ * @return true while still waiting, the destroy task resubmitted.
+ */
+static bool
+svc_vc_zerocopy_linger(struct rpc_dplx_rec *rec, bool closing)
+{
+	struct svc_vc_xprt *xd = VC_DR(rec);
+	struct linger abort = {
+		.l_onoff = 1,
+		.l_linger = 0,
+	};
+	struct timespec now;
+
+	if (!xd->sx_zc.qcount || rec->xprt.xp_fd == RPC_ANYFD)
+		return (false);
+
+	svc_ioq_zerocopy_reap(&rec->xprt);
+	if (!xd->sx_zc.qcount)
+		return (false);
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+	if (!xd->sx_zc_linger.tv_sec) {
+		xd->sx_zc_linger = now;
+		xd->sx_zc_linger.tv_sec += SVC_VC_ZC_LINGER_S;
+	}
+	if (timespeccmp(&now, &xd->sx_zc_linger, <)
+	    && svc_rqst_delay_task(&xd->sx_zc_delay, &rec->ioq.ioq_wpe,
+				   SVC_VC_ZC_RETRY_MS))
+		return (true);
+
+	__warnx(TIRPC_DEBUG_FLAG_WARN,
+		"%s: %p fd %d %d zerocopy replies unacknowledged, %s",
+		__func__, rec, rec->xprt.xp_fd, xd->sx_zc.qcount,
+		closing ? "aborting" : "abandoned");
+
+	if (closing) {
+		(void)setsockopt(rec->xprt.xp_fd, SOL_SOCKET, SO_LINGER,
+				 &abort, sizeof(abort));
+	} else {
+		TAILQ_INIT(&xd->sx_zc.qh);
+		xd->sx_zc.qcount = 0;
+	}
+	return (false);
+}
+#endif /* HAVE_MSG_ZEROCOPY */
+
 static void
 svc_vc_destroy_task(struct work_pool_entry *wpe)
 {
@@ -566,8 +720,11 @@ svc_vc_destroy_task(struct work_pool_entry *wpe)
 		__func__, rec, rec->xprt.xp_fd, xp_refcnt);
 
 	if (xp_refcnt > 0) {
-		/* instead of nanosleep */
-		work_pool_submit(&svc_work_pool, &(rec->ioq.ioq_wpe));
+		/* instead of nanosleep; not ahead of the completions that
+		 * hold the references, or it could run in their place
+		 */
+		work_pool_submit(&svc_work_pool, &(rec->ioq.ioq_wpe),
+				 WORK_POOL_PRIO_NORMAL);
 		return;
 	} else if (unlikely(xp_refcnt < 0)) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
@@ -576,6 +733,18 @@ svc_vc_destroy_task(struct work_pool_entry *wpe)
 		abort();
 	}
 
+#ifdef HAVE_MSG_ZEROCOPY
+	if (VC_DR(rec)->sx_zc_close) {
+		/* held back by svc_vc_unlink_it() */
+		VC_DR(rec)->sx_zc_close = false;
+		atomic_set_uint16_t_bits(&rec->xprt.xp_flags,
+					 SVC_XPRT_FLAG_CLOSE);
+	}
+	if (svc_vc_zerocopy_linger(rec, atomic_fetch_uint16_t(
+				&rec->xprt.xp_flags) & SVC_XPRT_FLAG_CLOSE))
+		return;
+#endif /* HAVE_MSG_ZEROCOPY */
+
 	xp_flags = atomic_postclear_uint16_t_bits(&rec->xprt.xp_flags,
 						  SVC_XPRT_FLAG_CLOSE);
 	if ((xp_flags & SVC_XPRT_FLAG_CLOSE) && rec->xprt.xp_fd != RPC_ANYFD) {
@@ -613,6 +782,18 @@ svc_vc_destroy_task(struct work_pool_entry *wpe)
 static void
 svc_vc_unlink_it(SVCXPRT *xprt, u_int flags, const char *tag, const int line)
 {
+#ifdef HAVE_MSG_ZEROCOPY
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
+
+	/* svc_destroy_it() closes a dead connection next; once MSG_ZEROCOPY
+	 * is on, the fd stays open for svc_vc_zerocopy_linger() instead.
+	 */
+	if (xd->sx_zc_state > 0)
+		xd->sx_zc_close = !!(atomic_postclear_uint16_t_bits(
+						&xprt->xp_flags,
+						SVC_XPRT_FLAG_CLOSE)
+				     & SVC_XPRT_FLAG_CLOSE);
+#endif /* HAVE_MSG_ZEROCOPY */
 	svc_rqst_xprt_unregister(xprt, flags);
 }
 
@@ -635,7 +816,8 @@ svc_vc_destroy_it(SVCXPRT *xprt, u_int flags, const char *tag, const int line)
 	}
 
 	REC_XPRT(xprt)->ioq.ioq_wpe.fun = svc_vc_destroy_task;
-	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe));
+	work_pool_submit(&svc_work_pool, &(REC_XPRT(xprt)->ioq.ioq_wpe),
+			 WORK_POOL_PRIO_HIGH);
 }
 
 extern mutex_t ops_lock;
@@ -751,35 +933,111 @@ static bool update_and_notify_remote_address_set(SVCXPRT *xprt)
 	return true;
 }
 
+/*
+ * Edge-triggered receive does not report data that is already queued,
+ * so a reader whose last recv() filled its buffer asks to be run again.
+ * A short read proves the socket empty, and any later data raises a new
+ * edge.  Nor does any event report data already read ahead.
+ */
+static inline int
+svc_vc_rearm_more(SVCXPRT *xprt)
+{
+	struct rpc_dplx_rec *rec = REC_XPRT(xprt);
+	struct svc_vc_xprt *xd = VC_DR(rec);
+
+	if (xd->sx_ra_head < xd->sx_ra_tail)
+		return svc_rqst_xprt_resubmit(xprt);
+
+	if ((rec->ev_state & RPC_DPLX_EV_EDGE) && !xd->sx_drained)
+		atomic_set_uint32_t_bits(&rec->ev_state, RPC_DPLX_EV_PENDING);
+
+	return svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV);
+}
+
+/*
+ * Fill the read-ahead buffer behind any bytes not yet parsed, as far as
+ * is available without waiting.
+ *
+ * @return bytes read, 0 when closed, or -1 with errno.
+ */
+static ssize_t
+svc_vc_readahead(SVCXPRT *xprt, struct svc_vc_xprt *xd)
+{
+	uint32_t have = xd->sx_ra_tail - xd->sx_ra_head;
+	ssize_t rlen;
+
+	if (unlikely(!xd->sx_ra))
+		xd->sx_ra = mem_alloc(SVC_VC_READAHEAD);
+	if (have && xd->sx_ra_head)
+		memmove(xd->sx_ra, xd->sx_ra + xd->sx_ra_head, have);
+	xd->sx_ra_head = 0;
+	xd->sx_ra_tail = have;
+
+	rlen = recv(xprt->xp_fd, xd->sx_ra + have, SVC_VC_READAHEAD - have,
+		    MSG_DONTWAIT);
+	if (rlen > 0)
+		xd->sx_ra_tail += rlen;
+	xd->sx_drained = rlen < (ssize_t)(SVC_VC_READAHEAD - have);
+	return (rlen);
+}
+
 enum haproxy_ret_code {
        HAPROXY_RET_CODE__SUCCESS = 0,
        HAPROXY_RET_CODE__FAILURE,
        HAPROXY_RET_CODE__IGNORE_LOCAL,
-       HAPROXY_RET_CODE__NOT_HAPROXY
+       HAPROXY_RET_CODE__NOT_HAPROXY,
+       HAPROXY_RET_CODE__AGAIN
 };
 
+/*
+ * Whether the read-ahead holds need bytes, reading once more if not.
+ */
+static enum haproxy_ret_code
+haproxy_need(SVCXPRT *xprt, struct svc_vc_xprt *xd, uint32_t need)
+{
+	ssize_t rlen;
+
+	if (xd->sx_ra_tail - xd->sx_ra_head >= need)
+		return HAPROXY_RET_CODE__SUCCESS;
+
+	rlen = svc_vc_readahead(xprt, xd);
+	if (rlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return HAPROXY_RET_CODE__AGAIN;
+	if (rlen <= 0) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s: %p fd %d proxy header failed rlen = %zd "
+			"(will set dead)",
+			__func__, xprt, xprt->xp_fd, rlen);
+		return HAPROXY_RET_CODE__FAILURE;
+	}
+	if (xd->sx_ra_tail - xd->sx_ra_head < need)
+		return HAPROXY_RET_CODE__AGAIN;
+	return HAPROXY_RET_CODE__SUCCESS;
+}
+
+/*
+ * The header is parsed from the read-ahead, starting at the signature
+ * already taken as a record mark, and consumed only once complete.
+ * Until then, HAPROXY_RET_CODE__AGAIN leaves it to be parsed again.
+ */
 static enum haproxy_ret_code handle_haproxy_header(SVCXPRT *xprt)
 {
 	/* HA Proxy V2? */
-	ssize_t rlen;
+	struct svc_vc_xprt *xd = VC_DR(REC_XPRT(xprt));
 	uint32_t rest[2];
 	struct proxy_header_part s;
 	union proxy_addr pa;
 	enum haproxy_ret_code ret;
+	uint32_t off = BYTES_PER_XDR_UNIT;
 
 	__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 			"%s: %p fd %d potential haproxy packet",
 			__func__, xprt, xprt->xp_fd);
 
-	/* PEEK in order not to consume a non haproxy packet */
-	rlen = recv(xprt->xp_fd, rest, sizeof(rest), MSG_WAITALL | MSG_PEEK);
-	if (rlen != sizeof(rest)) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p fd %d proxy header failed rest rlen = %z "
-			"(will set dead)",
-			__func__, xprt, xprt->xp_fd, rlen);
-		return HAPROXY_RET_CODE__FAILURE;
-	}
+	ret = haproxy_need(xprt, xd, off + sizeof(rest));
+	if (ret != HAPROXY_RET_CODE__SUCCESS)
+		return ret;
+	memcpy(rest, xd->sx_ra + xd->sx_ra_head + off, sizeof(rest));
 	rest[0] = ntohl(rest[0]);
 	rest[1] = ntohl(rest[1]);
 
@@ -793,25 +1051,13 @@ static enum haproxy_ret_code handle_haproxy_header(SVCXPRT *xprt)
 		 * Flow should treat the packet as a regular rpc packet.*/
 		return HAPROXY_RET_CODE__NOT_HAPROXY;
 	}
+	off += sizeof(rest);
 
-	rlen = recv(xprt->xp_fd, rest, sizeof(rest), MSG_WAITALL);
-	if (rlen != sizeof(rest)) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p fd %d proxy header failed rest rlen = %z "
-			"(will set dead)",
-			__func__, xprt, xprt->xp_fd, rlen);
-		return HAPROXY_RET_CODE__FAILURE;
-	}
-
-	rlen = recv(xprt->xp_fd, &s, sizeof(s), MSG_WAITALL);
-
-	if (rlen != sizeof(s)) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p fd %d proxy header failed header rlen = %z "
-			"(will set dead)",
-			__func__, xprt, xprt->xp_fd, rlen);
-		return HAPROXY_RET_CODE__FAILURE;
-	}
+	ret = haproxy_need(xprt, xd, off + sizeof(s));
+	if (ret != HAPROXY_RET_CODE__SUCCESS)
+		return ret;
+	memcpy(&s, xd->sx_ra + xd->sx_ra_head + off, sizeof(s));
+	off += sizeof(s);
 
 	s.len = ntohs(s.len);
 	if (unlikely(s.len > sizeof(pa))) {
@@ -822,15 +1068,11 @@ static enum haproxy_ret_code handle_haproxy_header(SVCXPRT *xprt)
 		return HAPROXY_RET_CODE__FAILURE;
 	}
 
-	rlen = recv(xprt->xp_fd, &pa, s.len, MSG_WAITALL);
-
-	if (rlen != s.len) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s: %p fd %d proxy header rest len failed header "
-			"rlen = %z (will set dead)",
-			__func__, xprt, xprt->xp_fd, rlen);
-		return HAPROXY_RET_CODE__FAILURE;
-	}
+	ret = haproxy_need(xprt, xd, off + s.len);
+	if (ret != HAPROXY_RET_CODE__SUCCESS)
+		return ret;
+	memcpy(&pa, xd->sx_ra + xd->sx_ra_head + off, s.len);
+	xd->sx_ra_head += off + s.len;
 
 	if (s.ver_cmd == PP2_VERSIOB2_CMD_PROXY) {
 		if (unlikely(is_remote_addr_set(xprt))) {
@@ -909,8 +1151,7 @@ static enum haproxy_ret_code handle_haproxy_header(SVCXPRT *xprt)
 		return HAPROXY_RET_CODE__FAILURE;
 	}
 
-	if (unlikely(svc_rqst_rearm_events(xprt,
-				   SVC_XPRT_FLAG_ADDED_RECV))) {
+	if (unlikely(svc_vc_rearm_more(xprt))) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
 			__func__, xprt, xprt->xp_fd);
@@ -940,19 +1181,24 @@ svc_vc_recv(SVCXPRT *xprt)
 	ssize_t rlen;
 	u_int flags;
 	int code;
-	bool hap_again = false;
 
 #ifdef USE_LTTNG_NTIRPC
 	tracepoint(xprt, funcin, __func__, __LINE__, xprt);
 #endif /* USE_LTTNG_NTIRPC */
 
+#ifdef HAVE_MSG_ZEROCOPY
+	/* completions raise EPOLLERR, delivered here as a receive event */
+	if (__svc_params->flags & SVC_FLAG_ZEROCOPY)
+		svc_ioq_zerocopy_reap(xprt);
+#endif /* HAVE_MSG_ZEROCOPY */
+
 	/* no need for locking, only one svc_rqst_xprt_task() per event.
 	 * depends upon svc_rqst_rearm_events() for ordering.
 	 */
 	have = TAILQ_LAST(&rec->ioq.ioq_uv.uvqh.qh, poolq_head_s);
 	if (!have) {
-		xioq = xdr_ioq_create(xd->sx_dr.pagesz, xd->sx_dr.maxrec,
-				      UIO_FLAG_BUFQ);
+		xioq = xdr_ioq_pool_create(xd->sx_dr.pagesz, xd->sx_dr.maxrec,
+					   UIO_FLAG_BUFQ);
 		(rec->ioq.ioq_uv.uvqh.qcount)++;
 		TAILQ_INSERT_TAIL(&rec->ioq.ioq_uv.uvqh.qh, &xioq->ioq_s, q);
 	} else {
@@ -961,16 +1207,18 @@ svc_vc_recv(SVCXPRT *xprt)
 
 	if (!xd->sx_fbtbc) {
 again:
-
-		rlen = recv(xprt->xp_fd, &xd->sx_fbtbc, BYTES_PER_XDR_UNIT,
-			    hap_again ? MSG_DONTWAIT : MSG_WAITALL);
+		if (xd->sx_ra_tail - xd->sx_ra_head >= BYTES_PER_XDR_UNIT) {
+			/* read ahead with the previous record */
+			rlen = BYTES_PER_XDR_UNIT;
+		} else {
+			rlen = svc_vc_readahead(xprt, xd);
+		}
 
 		if (unlikely(rlen < 0)) {
 			code = errno;
 
 			if (code == EAGAIN || code == EWOULDBLOCK) {
-				__warnx(hap_again ? TIRPC_DEBUG_FLAG_SVC_VC
-						  : TIRPC_DEBUG_FLAG_WARN,
+				__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 					"%s: %p fd %d recv errno %d (try again)",
 					"svc_vc_wait", xprt, xprt->xp_fd, code);
 				if (unlikely(svc_rqst_rearm_events(
@@ -1012,29 +1260,69 @@ again:
 			return SVC_STAT(xprt);
 		}
 
+		if (xd->sx_ra_tail - xd->sx_ra_head < BYTES_PER_XDR_UNIT) {
+			/* the rest of the record mark is in flight, kept
+			 * in the read-ahead until the next event
+			 */
+			__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
+				"%s: %p fd %d record mark %" PRIu32 " of 4 bytes",
+				"svc_vc_wait", xprt, xprt->xp_fd,
+				xd->sx_ra_tail - xd->sx_ra_head);
+			if (unlikely(svc_rqst_rearm_events(
+						xprt,
+						SVC_XPRT_FLAG_ADDED_RECV))) {
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+					"svc_vc_wait",
+					xprt, xprt->xp_fd);
+				SVC_DESTROY(xprt);
+			}
+			return SVC_STAT(xprt);
+		}
+
+		memcpy(&xd->sx_fbtbc, xd->sx_ra + xd->sx_ra_head,
+		       BYTES_PER_XDR_UNIT);
+		xd->sx_ra_head += BYTES_PER_XDR_UNIT;
 		xd->sx_fbtbc = (int32_t)ntohl((long)xd->sx_fbtbc);
 
 		__warnx(TIRPC_DEBUG_FLAG_SVC_VC,
 			"sx_fbtbc = %08x", (int)xd->sx_fbtbc);
 
 		if (xd->sx_fbtbc == PP2_SIG_UINT32) {
-			/* HA Proxy V2? */
-			enum haproxy_ret_code ret = handle_haproxy_header(xprt);
+			/* HA Proxy V2? parsed from the signature */
+			enum haproxy_ret_code ret;
+
+			xd->sx_ra_head -= BYTES_PER_XDR_UNIT;
+			ret = handle_haproxy_header(xprt);
 			switch (ret) {
 			case HAPROXY_RET_CODE__SUCCESS:
+				xd->sx_fbtbc = 0;
 				if (!update_and_notify_remote_address_set(xprt)) {
 					SVC_DESTROY(xprt);
 					return SVC_STAT(xprt);
 				}
 				/* Now look to see if there's more... */
-				hap_again = true;
 				goto again;
 			case HAPROXY_RET_CODE__FAILURE:
 				SVC_DESTROY(xprt);
 				return SVC_STAT(xprt);
 			case HAPROXY_RET_CODE__IGNORE_LOCAL:
+				xd->sx_fbtbc = 0;
+				return SVC_STAT(xprt);
+			case HAPROXY_RET_CODE__AGAIN:
+				/* the rest of the header is in flight */
+				xd->sx_fbtbc = 0;
+				if (unlikely(svc_rqst_rearm_events(
+						xprt,
+						SVC_XPRT_FLAG_ADDED_RECV))) {
+					__warnx(TIRPC_DEBUG_FLAG_ERROR,
+						"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
+						__func__, xprt, xprt->xp_fd);
+					SVC_DESTROY(xprt);
+				}
 				return SVC_STAT(xprt);
 			case HAPROXY_RET_CODE__NOT_HAPROXY:
+				xd->sx_ra_head += BYTES_PER_XDR_UNIT;
 				break;
 			}
 		}
@@ -1063,7 +1351,7 @@ again:
 			   xprt, xd->sx_fbtbc);
 #endif /* USE_LTTNG_NTIRPC */
 		/* one buffer per fragment */
-		uv = xdr_ioq_uv_create(xd->sx_fbtbc, flags);
+		uv = xdr_ioq_pool_uv_create(xd->sx_fbtbc, flags);
 		(xioq->ioq_uv.uvqh.qcount)++;
 		TAILQ_INSERT_TAIL(&xioq->ioq_uv.uvqh.qh, &uv->uvq, q);
 	} else {
@@ -1071,7 +1359,19 @@ again:
 		flags = uv->u.uio_flags;
 	}
 
+	if (xd->sx_ra_head < xd->sx_ra_tail) {
+		rlen = MIN(xd->sx_fbtbc, xd->sx_ra_tail - xd->sx_ra_head);
+		memcpy(uv->v.vio_tail, xd->sx_ra + xd->sx_ra_head, rlen);
+		xd->sx_ra_head += rlen;
+		uv->v.vio_tail += rlen;
+		xd->sx_fbtbc -= rlen;
+		if (!xd->sx_fbtbc)
+			goto fragment;
+	}
+
+	/* the read-ahead is empty, the rest goes straight to the buffer */
 	rlen = recv(xprt->xp_fd, uv->v.vio_tail, xd->sx_fbtbc, MSG_DONTWAIT);
+	xd->sx_drained = rlen < xd->sx_fbtbc;
 
 	if (unlikely(rlen < 0)) {
 		code = errno;
@@ -1130,9 +1430,13 @@ again:
 		"%s: %p fd %d recv %zd, need %" PRIu32 ", flags %x",
 		__func__, xprt, xprt->xp_fd, rlen, xd->sx_fbtbc, flags);
 
+fragment:
 	if (xd->sx_fbtbc || (flags & UIO_FLAG_MORE)) {
-		if (unlikely(svc_rqst_rearm_events(xprt,
-						   SVC_XPRT_FLAG_ADDED_RECV))) {
+		/* a short read has drained the socket */
+		if (unlikely(xd->sx_fbtbc
+			     ? svc_rqst_rearm_events(xprt,
+						     SVC_XPRT_FLAG_ADDED_RECV)
+			     : svc_vc_rearm_more(xprt))) {
 			__warnx(TIRPC_DEBUG_FLAG_ERROR,
 				"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
 				__func__, xprt, xprt->xp_fd);
@@ -1162,7 +1466,7 @@ again:
 		}
 	}
 
-	if (unlikely(svc_rqst_rearm_events(xprt, SVC_XPRT_FLAG_ADDED_RECV))) {
+	if (unlikely(svc_vc_rearm_more(xprt))) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s: %p fd %d svc_rqst_rearm_events failed (will set dead)",
 			__func__, xprt, xprt->xp_fd);
@@ -56,6 +56,11 @@
  * @note currently static sizes
  *	partitions should be largish prime, relative to connections.
  *	no cache slots, as rpc_dplx_rec has fd_node for direct access.
+ *
+ * Transports are also indexed on a timer wheel in seconds, due when
+ * they would become idle.  Receive only updates recv.ts, so an entry
+ * that comes due after later activity is re-placed, at most once per
+ * idle timeout.  Reaping then costs the entries due, not the tree.
  */
 
 #define SVC_XPRT_PARTITIONS 193
@@ -65,6 +70,8 @@ static bool initialized;
 struct svc_xprt_fd {
 	mutex_t lock;
 	struct rbtree_x xt;
+	mutex_t idle_lock;
+	struct timer_wheel idle;
 	uint32_t connections;
 
 #ifdef USE_RPC_RDMA
@@ -80,7 +87,8 @@ static struct svc_xprt_fd svc_xprt_fd = {
 	 RBT_X_FLAG_NONE,	/* flags */
 	 0,			/* cachesz */
 	 NULL			/* tree */
-	}			/* xt */
+	},			/* xt */
+	MUTEX_INITIALIZER /* idle_lock */ ,
 };
 
 static inline int
@@ -104,6 +112,7 @@ svc_xprt_fd_cmpf(const struct opr_rbtree_node *lhs,
 int
 svc_xprt_init(void)
 {
+	struct timespec ts;
 	int code = 0;
 
 	mutex_lock(&svc_xprt_fd.lock);
@@ -120,6 +129,9 @@ svc_xprt_init(void)
 		__warnx(TIRPC_DEBUG_FLAG_SVC_XPRT,
 			"svc_xprt_init: rbtx_init failed");
 
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+	timer_wheel_init(&svc_xprt_fd.idle, ts.tv_sec);
+
 	initialized = true;
 
  unlock:
@@ -135,6 +147,24 @@ svc_xprt_init_failure(void)
 	return (svc_xprt_init() != 0);
 }
 
+/*
+ * Index a newly registered transport, due one idle timeout after its
+ * (initial) receive time.
+ */
+static inline void
+svc_xprt_idle_insert(struct rpc_dplx_rec *rec)
+{
+	int timeout = __svc_params->idle_timeout;
+
+	if (timeout <= 0)
+		return;
+
+	mutex_lock(&svc_xprt_fd.idle_lock);
+	timer_wheel_insert(&svc_xprt_fd.idle, &rec->idle_te,
+			   rec->recv.ts.tv_sec + timeout);
+	mutex_unlock(&svc_xprt_fd.idle_lock);
+}
+
 /*
  * On success, returns with RPC_DPLX_LOCKED
  */
@@ -194,6 +224,8 @@ svc_xprt_lookup(int fd, svc_xprt_setup_t setup)
 					__func__);
 				(*setup)(&xprt);	/* free, sets NULL */
 				atomic_dec_uint32_t(&svc_xprt_fd.connections);
+			} else {
+				svc_xprt_idle_insert(rec);
 			}
 			rwlock_unlock(&t->lock);
 			return (xprt);
@@ -242,6 +274,11 @@ svc_xprt_clear(SVCXPRT *xprt)
 	if (svc_xprt_init_failure())
 		return;
 
+	/* also after svc_xprt_shutdown() removed fd_node */
+	mutex_lock(&svc_xprt_fd.idle_lock);
+	timer_wheel_remove(&svc_xprt_fd.idle, &REC_XPRT(xprt)->idle_te);
+	mutex_unlock(&svc_xprt_fd.idle_lock);
+
 	/* xprt lock ensures only one active thread here */
 	if (opr_rbtree_node_valid(&REC_XPRT(xprt)->fd_node)) {
 		t = rbtx_partition_of_scalar(&svc_xprt_fd.xt, xprt->xp_fd);
@@ -361,6 +398,85 @@ svc_xprt_foreach(svc_xprt_each_func_t each_f, void *arg)
 	return (0);
 }
 
+/**
+ * Perform custom task for each xprt without a receive for timeout
+ * seconds
+ *
+ * Visits only the transports due on the idle wheel, re-placing those
+ * that have since received.  The callback returns true when it
+ * disposed of the xprt; otherwise the xprt is checked again after
+ * another timeout.
+ *
+ * @note Locking
+ * - Callback is called unlocked, holding a reference
+ *
+ * @return the number of xprts passed to the callback.
+ */
+int
+svc_xprt_foreach_idle(int timeout, svc_xprt_each_func_t each_f, void *arg)
+{
+	struct opr_queue expired;
+	struct opr_queue idle;
+	struct rpc_dplx_rec *rec;
+	struct timespec ts;
+	int n = 0;
+
+	if (svc_xprt_init_failure())
+		return (-1);
+
+	if (timeout <= 0)
+		return (0);
+
+	opr_queue_Init(&expired);
+	opr_queue_Init(&idle);
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+
+	mutex_lock(&svc_xprt_fd.idle_lock);
+	timer_wheel_advance(&svc_xprt_fd.idle, ts.tv_sec, &expired);
+
+	while (!opr_queue_IsEmpty(&expired)) {
+		rec = opr_queue_First(&expired, struct rpc_dplx_rec,
+				      idle_te.te_q);
+		opr_queue_Remove(&rec->idle_te.te_q);
+
+		if (ts.tv_sec - rec->recv.ts.tv_sec < timeout) {
+			/* received since, not yet idle */
+			timer_wheel_insert(&svc_xprt_fd.idle, &rec->idle_te,
+					   rec->recv.ts.tv_sec + timeout);
+			continue;
+		}
+
+		/* still indexed, so svc_xprt_clear() has not dropped
+		 * the tree reference
+		 */
+		SVC_REF(&rec->xprt, SVC_REF_FLAG_NONE);
+		opr_queue_Append(&idle, &rec->idle_te.te_q);
+	}
+	mutex_unlock(&svc_xprt_fd.idle_lock);
+
+	while (!opr_queue_IsEmpty(&idle)) {
+		rec = opr_queue_First(&idle, struct rpc_dplx_rec,
+				      idle_te.te_q);
+		opr_queue_Remove(&rec->idle_te.te_q);
+		n++;
+
+		if (!each_f(&rec->xprt, arg)) {
+			/* kept, unless destroyed meanwhile, see
+			 * svc_xprt_clear()
+			 */
+			mutex_lock(&svc_xprt_fd.idle_lock);
+			if (!(atomic_fetch_uint16_t(&rec->xprt.xp_flags)
+			      & SVC_XPRT_FLAG_DESTROYED))
+				timer_wheel_insert(&svc_xprt_fd.idle,
+						   &rec->idle_te,
+						   ts.tv_sec + timeout);
+			mutex_unlock(&svc_xprt_fd.idle_lock);
+		}
+		SVC_RELEASE(&rec->xprt, SVC_RELEASE_FLAG_NONE);
+	}
+	return (n);
+}
+
 void
 svc_xprt_dump_xprts(const char *tag)
 {
@@ -49,6 +49,7 @@
  *  svc_xprt_lookup -- find or create shared fd state
  *  svc_xprt_clear -- remove a transport
  *  svc_xprt_foreach -- scan registered transports
+ *  svc_xprt_foreach_idle -- visit transports idle past a timeout
  *  svc_xprt_dump_xprts -- dump registered transports
  *  svc_xprt_shutdown -- clear the tree, destroy transports
  */
@@ -65,6 +66,7 @@ void svc_xprt_clear(SVCXPRT *);
 
 typedef bool(*svc_xprt_each_func_t) (SVCXPRT *, void *);
 int svc_xprt_foreach(svc_xprt_each_func_t, void *);
+int svc_xprt_foreach_idle(int, svc_xprt_each_func_t, void *);
 
 void svc_xprt_dump_xprts(const char *);
 void svc_xprt_shutdown(void);
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file timer_wheel.c
+ * @brief Hierarchical timing wheel
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <misc/timer_wheel.h>
+
+#define timer_wheel_shift(level) (TIMER_WHEEL_BITS * (level))
+#define timer_wheel_bit(slot) ((uint64_t)1 << (slot))
+
+/* occupied bits, rotated so that bit 0 is the given slot */
+static inline uint64_t
+timer_wheel_rotate(uint64_t occupied, int slot)
+{
+	if (!slot)
+		return (occupied);
+	return ((occupied >> slot) | (occupied << (TIMER_WHEEL_SLOTS - slot)));
+}
+
+/*
+ * Place by the ticks remaining after tw_now.  Level L holds what comes
+ * due within 64^(L+1) ticks, in the slot of its 64^L tick span.
+ */
+static void
+timer_wheel_place(struct timer_wheel *tw, struct timer_wheel_entry *te)
+{
+	uint64_t when = te->te_expire;
+	uint64_t delta;
+	int level;
+	int slot;
+
+	if (when <= tw->tw_now)
+		when = tw->tw_now + 1;	/* already due, at the next tick */
+	else if (when - tw->tw_now >= TIMER_WHEEL_SPAN)
+		when = tw->tw_now + TIMER_WHEEL_SPAN - 1;
+
+	delta = when - tw->tw_now;
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << timer_wheel_shift(level + 1)))
+			break;
+	}
+	slot = (when >> timer_wheel_shift(level)) & TIMER_WHEEL_MASK;
+
+	te->te_slot = level * TIMER_WHEEL_SLOTS + slot;
+	opr_queue_Append(&tw->tw_slots[level][slot], &te->te_q);
+	tw->tw_occupied[level] |= timer_wheel_bit(slot);
+}
+
+void
+timer_wheel_init(struct timer_wheel *tw, uint64_t now)
+{
+	int level;
+	int slot;
+
+	memset(tw, 0, sizeof(*tw));
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+			opr_queue_Init(&tw->tw_slots[level][slot]);
+	}
+	tw->tw_now = now;
+}
+
+void
+timer_wheel_insert(struct timer_wheel *tw, struct timer_wheel_entry *te,
+		   uint64_t expire)
+{
+	if (timer_wheel_entry_armed(te))
+		timer_wheel_remove(tw, te);
+
+	te->te_expire = expire;
+	timer_wheel_place(tw, te);
+	tw->tw_count++;
+}
+
+void
+timer_wheel_remove(struct timer_wheel *tw, struct timer_wheel_entry *te)
+{
+	int level;
+	int slot;
+
+	if (!timer_wheel_entry_armed(te))
+		return;
+
+	level = te->te_slot / TIMER_WHEEL_SLOTS;
+	slot = te->te_slot % TIMER_WHEEL_SLOTS;
+
+	opr_queue_Remove(&te->te_q);
+	te->te_slot = TIMER_WHEEL_NONE;
+	tw->tw_count--;
+
+	if (opr_queue_IsEmpty(&tw->tw_slots[level][slot]))
+		tw->tw_occupied[level] &= ~timer_wheel_bit(slot);
+}
+
+/*
+ * Move a slot to the expired list, or down the wheel.  tw_now is the
+ * tick being processed.
+ */
+static uint32_t
+timer_wheel_cascade(struct timer_wheel *tw, int level, int slot,
+		    struct opr_queue *expired)
+{
+	struct opr_queue pending;
+	struct timer_wheel_entry *te;
+	uint32_t n = 0;
+
+	if (!(tw->tw_occupied[level] & timer_wheel_bit(slot)))
+		return (0);
+
+	tw->tw_occupied[level] &= ~timer_wheel_bit(slot);
+	opr_queue_Init(&pending);
+	opr_queue_SpliceAppend(&pending, &tw->tw_slots[level][slot]);
+
+	while (!opr_queue_IsEmpty(&pending)) {
+		te = opr_queue_First(&pending, struct timer_wheel_entry, te_q);
+		opr_queue_Remove(&te->te_q);
+
+		if (te->te_expire <= tw->tw_now) {
+			te->te_slot = TIMER_WHEEL_NONE;
+			opr_queue_Append(expired, &te->te_q);
+			tw->tw_count--;
+			n++;
+		} else {
+			timer_wheel_place(tw, te);
+		}
+	}
+	return (n);
+}
+
+/**
+ * @brief Advance the wheel
+ *
+ * Empty ticks are skipped a rotation of the lowest level at a time.
+ *
+ * @param[in] tw	wheel
+ * @param[in] now	current tick
+ * @param[out] expired	list to append the expired entries, no longer armed
+ *
+ * @return the number of entries expired.
+ */
+uint32_t
+timer_wheel_advance(struct timer_wheel *tw, uint64_t now,
+		    struct opr_queue *expired)
+{
+	uint64_t pending;
+	uint64_t t;
+	uint32_t n = 0;
+	int level;
+	int slot;
+
+	while (tw->tw_now < now) {
+		if (!tw->tw_count) {
+			tw->tw_now = now;
+			break;
+		}
+
+		t = tw->tw_now + 1;
+		slot = t & TIMER_WHEEL_MASK;
+		if (slot) {
+			/* within this rotation, to the next occupied slot */
+			pending = tw->tw_occupied[0] >> slot;
+			if (!pending) {
+				t |= TIMER_WHEEL_MASK;
+				tw->tw_now = (t < now) ? t : now;
+				continue;
+			}
+			t += __builtin_ctzll(pending);
+			if (t > now) {
+				tw->tw_now = now;
+				break;
+			}
+			tw->tw_now = t;
+		} else {
+			tw->tw_now = t;
+			/* higher levels first, their entries may fall to
+			 * slots due at this same tick
+			 */
+			for (level = TIMER_WHEEL_LEVELS - 1; level > 0;
+			     level--) {
+				if (t & (timer_wheel_bit(timer_wheel_shift(level))
+					 - 1))
+					continue;
+				n += timer_wheel_cascade(tw, level,
+					(t >> timer_wheel_shift(level))
+					& TIMER_WHEEL_MASK, expired);
+			}
+		}
+		n += timer_wheel_cascade(tw, 0, t & TIMER_WHEEL_MASK, expired);
+	}
+	return (n);
+}
+
+/**
+ * @brief Earliest tick that may need advancing
+ *
+ * Exact for entries within 64 ticks, otherwise the next cascade of
+ * their slot.
+ *
+ * @return tick, or UINT64_MAX when empty.
+ */
+uint64_t
+timer_wheel_next(struct timer_wheel *tw)
+{
+	uint64_t next = UINT64_MAX;
+	uint64_t base;
+	uint64_t when;
+	uint64_t rotated;
+	int level;
+
+	if (!tw->tw_count)
+		return (next);
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if (!tw->tw_occupied[level])
+			continue;
+
+		/* the next span of this level begins at base + 1 */
+		base = tw->tw_now >> timer_wheel_shift(level);
+		rotated = timer_wheel_rotate(tw->tw_occupied[level],
+					     (base + 1) & TIMER_WHEEL_MASK);
+		when = (base + 1 + __builtin_ctzll(rotated))
+			<< timer_wheel_shift(level);
+		if (when < next)
+			next = when;
+	}
+	return (next);
+}
@@ -33,106 +33,1367 @@
  *
  * This provides simple work queues using pthreads and TAILQ primitives.
  *
+ * Each submission has a priority class.  By default the shared queue
+ * serves them in strict priority order; with weights, each class with
+ * work in turn runs up to its weight of entries before the lower classes
+ * have theirs, so none starves.
+ *
+ * With WORK_POOL_FLAG_STEAL, each worker also has a bounded lock-free
+ * deque.  Normal priority submissions from a worker go to its own deque,
+ * and idle workers steal from the others.  Other threads and classes
+ * still submit to the shared queue, and queued high priority work is
+ * taken before the deques.
+ *
+ * With WORK_POOL_FLAG_HANDOFF, idle workers of the shared queue spin a
+ * while, then park on a futex word of their own.  A submission with a
+ * worker parked hands the entry straight to it, so that the woken worker
+ * runs without taking the queue lock.  The spin doubles each time work
+ * arrives during it, and halves each time it is wasted.
+ *
+ * With WORK_POOL_FLAG_ADAPT, a controller sizes the pool between
+ * thrd_min and thrd_max instead.  See work_pool_adapt() for the rules.
+ *
+ * Each worker counts its tasks, their queue wait and run time, and its
+ * own idle time, apart for each task function (up to a limit, then all
+ * together).  Nothing is shared while counting; work_pool_stats() sums
+ * the workers under the queue lock, so the result is approximate.
+ *
  * @note    Loosely based upon previous thrdpool by
  *          Matt Benjamin <matt@cohortfs.com>
  */
 
-#include "config.h"
+#include "config.h"
+
+#include <sys/types.h>
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <err.h>
+#endif
+
+#include <rpc/types.h>
+#include "rpc_com.h"
+#include <sys/types.h>
+#include <misc/abstract_atomic.h>
+#include <misc/portable.h>
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <intrinsic.h>
+#include <urcu-bp.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <rpc/work_pool.h>
+
+#define WORK_POOL_STACK_SIZE MAX(1 * 1024 * 1024, PTHREAD_STACK_MIN)
+#define WORK_POOL_TIMEOUT_MS (31 /* seconds (prime) */ * 1000)
+
+#define WORK_POOL_ADAPT_MS (100)
+#define WORK_POOL_ADAPT_WAIT_US (1000)
+#define WORK_POOL_ADAPT_STEP_MAX (16)
+#define WORK_POOL_ADAPT_IDLE (10)	/* intervals before an idle retires */
+
+/* WORK_POOL_FLAG_HANDOFF park word */
+#define WORK_POOL_PARK_SPIN (0x0001)	/* on the idle queue */
+#define WORK_POOL_PARK_SLEEP (0x0002)	/* and waiting in the kernel */
+#define WORK_POOL_PARK_WAKE (0x0004)	/* taken off the idle queue */
+#define WORK_POOL_SPIN_MIN_NS (1000)
+
+#define WORK_POOL_CACHE_LINE (64)
+#define WORK_POOL_DEQUE_SIZE (256)	/* power of 2 */
+#define WORK_POOL_DEQUE_MASK (WORK_POOL_DEQUE_SIZE - 1)
+
+/*
+ * Bounded per-worker deque for WORK_POOL_FLAG_STEAL.
+ *
+ * Only the owner pushes at the bottom.  The owner and thieves alike
+ * take from the top with a compare and swap, so each worker still runs
+ * its own submissions in order.  The counters never wrap in practice.
+ */
+struct work_pool_deque {
+	uint64_t top;
+	uint8_t pad0[WORK_POOL_CACHE_LINE - sizeof(uint64_t)];
+	uint64_t bottom;
+	struct work_pool_thread *owner;	/* qmutex */
+	int32_t node;			/* of the owner's pushes, or -1 */
+	uint8_t pad1[WORK_POOL_CACHE_LINE - sizeof(uint64_t) - sizeof(void *)
+		     - sizeof(int32_t)];
+	struct work_pool_entry *ring[WORK_POOL_DEQUE_SIZE];
+};
+
+/* the worker running on this thread, when in a stealing pool */
+static __thread struct work_pool_thread *work_pool_self;
+
+/* forward declaration in lieu of moving code, was inline */
+
+static int work_pool_spawn(struct work_pool *pool);
+
+static inline uint64_t
+work_pool_now_ns(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* precise, for the stats */
+static inline uint64_t
+work_pool_clock_ns(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static inline void
+work_pool_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+#if defined(__linux__)
+static inline long
+work_pool_futex(uint32_t *uaddr, int op, uint32_t val,
+		const struct timespec *ts)
+{
+	return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
+}
+#endif
+
+/*
+ * WORK_POOL_FLAG_HANDOFF.  Called with qmutex held, after taking the
+ * worker off the idle queue and handing it any work.  The worker cannot
+ * exit while the lock is held, so the word remains valid.
+ */
+static inline void
+work_pool_unpark(struct work_pool_thread *wpt)
+{
+#if defined(__linux__)
+	if (atomic_postset_uint32_t_bits(&wpt->park, WORK_POOL_PARK_WAKE)
+	    & WORK_POOL_PARK_SLEEP)
+		(void)work_pool_futex(&wpt->park, FUTEX_WAKE_PRIVATE, 1, NULL);
+#endif
+}
+
+int
+work_pool_init(struct work_pool *pool, const char *name,
+		struct work_pool_params *params)
+{
+	uint32_t ix;
+	int prio;
+	int rc;
+
+	memset(pool, 0, sizeof(*pool));
+	poolq_head_setup(&pool->pqh);
+	TAILQ_INIT(&pool->wptqh);
+	TAILQ_INIT(&pool->wpt_all);
+	for (prio = 0; prio < WORK_POOL_PRIO_MAX; prio++) {
+		TAILQ_INIT(&pool->wpc[prio].qh);
+		pool->wpc[prio].weight =
+		pool->wpc[prio].credit = params->weights[prio];
+	}
+
+	pool->timeout_ms = WORK_POOL_TIMEOUT_MS;
+
+	pool->name = mem_strdup(name);
+	pool->params = *params;
+
+	if (pool->params.thrd_min < 1) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() thrd_min (%d) < 1",
+			__func__, pool->params.thrd_min);
+		pool->params.thrd_min = 1;
+	};
+
+	if (pool->params.thrd_max < pool->params.thrd_min) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() thrd_max (%d) < thrd_min (%d)",
+			__func__, pool->params.thrd_max, pool->params.thrd_min);
+		pool->params.thrd_max = pool->params.thrd_min;
+	};
+
+#if defined(__linux__)
+	if ((pool->params.flags & WORK_POOL_FLAG_HANDOFF)
+	 && (pool->params.flags & WORK_POOL_FLAG_STEAL)) {
+		/* stealing workers mostly find work on the deques */
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() handoff ignored with work stealing",
+			__func__);
+		pool->params.flags &= ~WORK_POOL_FLAG_HANDOFF;
+	}
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		/* spinning would only delay the submitter */
+		pool->params.spin_us = 0;
+	}
+#else
+	pool->params.flags &= ~WORK_POOL_FLAG_HANDOFF;
+#endif
+
+	rc = pthread_attr_init(&pool->attr);
+	if (rc) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() can't init pthread's attributes: %s (%d)",
+			__func__, strerror(rc), rc);
+		return rc;
+	}
+
+	rc = pthread_attr_setscope(&pool->attr, PTHREAD_SCOPE_SYSTEM);
+	if (rc) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() can't set pthread's scope: %s (%d)",
+			__func__, strerror(rc), rc);
+		return rc;
+	}
+
+	rc = pthread_attr_setdetachstate(&pool->attr, PTHREAD_CREATE_DETACHED);
+	if (rc) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() can't set pthread's join state: %s (%d)",
+			__func__, strerror(rc), rc);
+		return rc;
+	}
+
+	rc = pthread_attr_setstacksize(&pool->attr,
+				       params->thr_stack_size > 0 ?
+				       params->thr_stack_size :
+				       WORK_POOL_STACK_SIZE);
+	if (rc) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() can't set pthread's stack size: %s (%d)",
+			__func__, strerror(rc), rc);
+	}
+
+	if (pool->params.flags & WORK_POOL_FLAG_STEAL) {
+		/* one deque for every possible worker, never freed while
+		 * the pool runs, so that thieves need no reference
+		 */
+		pool->wpdq_max = pool->params.thrd_max;
+		pool->wpdq = mem_aligned(WORK_POOL_CACHE_LINE,
+					 pool->wpdq_max * sizeof(*pool->wpdq));
+		memset(pool->wpdq, 0, pool->wpdq_max * sizeof(*pool->wpdq));
+		for (ix = 0; ix < pool->wpdq_max; ix++)
+			pool->wpdq[ix].node = -1;
+	}
+
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT) {
+		if (!pool->params.adapt_ms)
+			pool->params.adapt_ms = WORK_POOL_ADAPT_MS;
+		if (!pool->params.adapt_wait_us)
+			pool->params.adapt_wait_us = WORK_POOL_ADAPT_WAIT_US;
+		pool->timeout_ms = WORK_POOL_ADAPT_IDLE * pool->params.adapt_ms;
+
+		pool->adapt.last_ms = work_pool_now_ns() / 1000000;
+		pool->adapt.next_ms = pool->adapt.last_ms
+				    + pool->params.adapt_ms;
+		pool->adapt.target = pool->params.thrd_min;
+
+		/* the controller adds more as needed */
+		pool->n_threads = pool->adapt.target;
+		for (ix = 0; ix < pool->adapt.target; ix++) {
+			rc = work_pool_spawn(pool);
+			if (rc)
+				return rc;
+		}
+		return (0);
+	}
+
+	/* initial spawn will spawn more threads as needed */
+	pool->n_threads = 1;
+	return work_pool_spawn(pool);
+}
+
+/**
+ * @brief Wake idle workers
+ *
+ * Called with qmutex held.
+ *
+ * @param[in] pool	work pool
+ * @param[in] count	maximum number of workers to wake
+ */
+static void
+work_pool_wakeup_locked(struct work_pool *pool, int count)
+{
+	struct work_pool_thread *wpt;
+
+	while (count-- > 0) {
+		wpt = TAILQ_LAST(&pool->wptqh, work_pool_s);
+		if (!wpt) {
+			assert(pool->pqh.qcount == 0);
+			break;
+		}
+		pool->pqh.qcount--;
+		TAILQ_REMOVE(&pool->wptqh, wpt, wptq);
+		assert(!wpt->wakeup);
+		wpt->wakeup = true;
+		if (pool->params.flags & WORK_POOL_FLAG_HANDOFF)
+			work_pool_unpark(wpt);
+		else
+			pthread_cond_signal(&wpt->pqcond);
+	}
+}
+
+/**
+ * @brief Hand entries straight to parked workers
+ *
+ * WORK_POOL_FLAG_HANDOFF, most recently parked (and likely spinning)
+ * first.  Called with qmutex held.
+ *
+ * @param[in] pool	work pool
+ * @param[in] works	vector of entries
+ * @param[in] count	number of entries
+ *
+ * @return number of entries handed.
+ */
+static int
+work_pool_handoff_locked(struct work_pool *pool,
+			 struct work_pool_entry **works, int count)
+{
+	struct work_pool_thread *wpt;
+	int ix;
+
+	for (ix = 0; ix < count; ix++) {
+		wpt = TAILQ_LAST(&pool->wptqh, work_pool_s);
+		if (!wpt)
+			break;
+		pool->pqh.qcount--;
+		TAILQ_REMOVE(&pool->wptqh, wpt, wptq);
+		assert(!wpt->wakeup);
+		wpt->wakeup = true;
+		wpt->work = works[ix];
+		work_pool_unpark(wpt);
+	}
+	return (ix);
+}
+
+/*
+ * Called with qmutex held.
+ */
+static inline void
+work_pool_enqueue_locked(struct work_pool *pool, struct work_pool_entry *work,
+			 enum work_pool_prio prio)
+{
+	TAILQ_INSERT_TAIL(&pool->wpc[prio].qh, &work->pqe, q);
+	atomic_inc_uint32_t(&pool->n_shared);
+	if (prio == WORK_POOL_PRIO_HIGH)
+		atomic_inc_uint32_t(&pool->n_high);
+}
+
+/*
+ * Called with qmutex held.  The highest class with work runs, unless
+ * it is weighted and has used its turn while lower classes wait.  When
+ * every waiting class has used its turn, all start another.
+ */
+static struct work_pool_entry *
+work_pool_dequeue_locked(struct work_pool *pool)
+{
+	struct work_pool_class *wpc;
+	struct poolq_entry *have;
+	int first = -1;
+	int prio;
+
+	for (prio = 0; prio < WORK_POOL_PRIO_MAX; prio++) {
+		wpc = &pool->wpc[prio];
+		if (TAILQ_EMPTY(&wpc->qh))
+			continue;
+		if (!wpc->weight || wpc->credit)
+			break;
+		if (first < 0)
+			first = prio;
+	}
+
+	if (prio >= WORK_POOL_PRIO_MAX) {
+		if (first < 0)
+			return (NULL);
+		for (prio = 0; prio < WORK_POOL_PRIO_MAX; prio++)
+			pool->wpc[prio].credit = pool->wpc[prio].weight;
+		prio = first;
+	}
+
+	wpc = &pool->wpc[prio];
+	if (wpc->credit)
+		wpc->credit--;
+
+	have = TAILQ_FIRST(&wpc->qh);
+	TAILQ_REMOVE(&wpc->qh, have, q);
+	atomic_dec_uint32_t(&pool->n_shared);
+	if (prio == WORK_POOL_PRIO_HIGH)
+		atomic_dec_uint32_t(&pool->n_high);
+	return ((struct work_pool_entry *)have);
+}
+
+/*
+ * Called with qmutex held.  Whether a worker starting a task should add
+ * another thread, counted here.
+ */
+static inline bool
+work_pool_grow_locked(struct work_pool *pool)
+{
+	bool spawn;
+
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+		spawn = pool->n_threads < pool->adapt.target;
+	else
+		spawn = pool->pqh.qcount < pool->params.thrd_min
+		      && pool->n_threads < pool->params.thrd_max;
+	if (spawn)
+		pool->n_threads++;
+	return spawn;
+}
+
+/*
+ * Called with qmutex held.  Whether a worker without work should exit
+ * at once, leaving the controller's target.
+ */
+static inline bool
+work_pool_retire_locked(struct work_pool *pool)
+{
+	return ((pool->params.flags & WORK_POOL_FLAG_ADAPT)
+		&& pool->n_threads > pool->adapt.target);
+}
+
+/*
+ * Called with qmutex held.  Whether a worker timed out waiting should
+ * remain.
+ */
+static inline bool
+work_pool_keep_locked(struct work_pool *pool)
+{
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+		return (pool->n_threads <= pool->adapt.target);
+	return (pool->pqh.qcount < pool->params.thrd_min);
+}
+
+/*
+ * Queued entries, shared and on the deques.  Approximate.
+ */
+static uint32_t
+work_pool_backlog(struct work_pool *pool)
+{
+	struct work_pool_deque *wpdq;
+	uint32_t backlog = atomic_fetch_uint32_t(&pool->n_shared);
+	uint32_t hw = atomic_fetch_uint32_t(&pool->wpdq_hw);
+	uint64_t bottom;
+	uint64_t top;
+	uint32_t ix;
+
+	for (ix = 0; ix < hw; ix++) {
+		wpdq = &pool->wpdq[ix];
+		top = atomic_fetch_uint64_t(&wpdq->top);
+		bottom = atomic_fetch_uint64_t(&wpdq->bottom);
+		if (bottom > top)
+			backlog += bottom - top;
+	}
+	return (backlog);
+}
+
+/*
+ * Stats
+ */
+
+static inline uint32_t
+work_pool_bucket(uint64_t ns)
+{
+	uint32_t b = 63 - __builtin_clzll(ns | 1);
+
+	return (MIN(b, WORK_POOL_HIST_BUCKETS - 1));
+}
+
+/*
+ * Slot of a task function, by open addressing; the last slot takes the
+ * functions beyond the table.
+ */
+static struct work_pool_fun_stats *
+work_pool_fun_slot(struct work_pool_counters *wpc, work_pool_fun_t fun)
+{
+	struct work_pool_fun_stats *wpf;
+	uint32_t hash = ((uintptr_t)fun >> 4) % WORK_POOL_STATS_FUNS;
+	uint32_t ix;
+
+	for (ix = 0; ix < WORK_POOL_STATS_FUNS; ix++) {
+		wpf = &wpc->funs[(hash + ix) % WORK_POOL_STATS_FUNS];
+		if (wpf->fun == fun)
+			return (wpf);
+		if (!wpf->fun) {
+			wpf->fun = fun;
+			return (wpf);
+		}
+	}
+	return (&wpc->funs[WORK_POOL_STATS_FUNS]);
+}
+
+/*
+ * Called by the worker owning the counters.
+ */
+static void
+work_pool_count(struct work_pool_counters *wpc, work_pool_fun_t fun,
+		uint64_t wait_ns, uint64_t run_ns)
+{
+	struct work_pool_fun_stats *wpf = work_pool_fun_slot(wpc, fun);
+
+	wpc->tasks++;
+	wpc->wait_ns += wait_ns;
+	wpc->run_ns += run_ns;
+
+	wpf->tasks++;
+	wpf->wait_ns += wait_ns;
+	wpf->run_ns += run_ns;
+	wpf->wait_hist[work_pool_bucket(wait_ns)]++;
+	wpf->run_hist[work_pool_bucket(run_ns)]++;
+}
+
+static void
+work_pool_merge(struct work_pool_counters *to,
+		struct work_pool_counters *from)
+{
+	struct work_pool_fun_stats *src;
+	struct work_pool_fun_stats *dst;
+	int ix;
+	int b;
+
+	to->tasks += from->tasks;
+	to->wait_ns += from->wait_ns;
+	to->run_ns += from->run_ns;
+	to->idle_ns += from->idle_ns;
+
+	for (ix = 0; ix <= WORK_POOL_STATS_FUNS; ix++) {
+		src = &from->funs[ix];
+		if (!src->tasks)
+			continue;
+		dst = (ix < WORK_POOL_STATS_FUNS)
+			? work_pool_fun_slot(to, src->fun)
+			: &to->funs[WORK_POOL_STATS_FUNS];
+		dst->tasks += src->tasks;
+		dst->wait_ns += src->wait_ns;
+		dst->run_ns += src->run_ns;
+		for (b = 0; b < WORK_POOL_HIST_BUCKETS; b++) {
+			dst->wait_hist[b] += src->wait_hist[b];
+			dst->run_hist[b] += src->run_hist[b];
+		}
+	}
+}
+
+/*
+ * Called with qmutex held.  Tasks run and idle time since init.
+ */
+static void
+work_pool_sum_locked(struct work_pool *pool, uint64_t *tasks,
+		     uint64_t *idle_ns)
+{
+	struct work_pool_thread *wpt;
+
+	*tasks = pool->counters.tasks;
+	*idle_ns = pool->counters.idle_ns;
+	TAILQ_FOREACH(wpt, &pool->wpt_all, wpt_allq) {
+		*tasks += wpt->counters.tasks;
+		*idle_ns += wpt->counters.idle_ns;
+	}
+}
+
+/*
+ * Called with qmutex held, as the worker starts and ends.
+ */
+static inline void
+work_pool_attach_locked(struct work_pool *pool, struct work_pool_thread *wpt)
+{
+	TAILQ_INSERT_TAIL(&pool->wpt_all, wpt, wpt_allq);
+}
+
+static inline void
+work_pool_detach_locked(struct work_pool *pool, struct work_pool_thread *wpt)
+{
+	TAILQ_REMOVE(&pool->wpt_all, wpt, wpt_allq);
+	work_pool_merge(&pool->counters, &wpt->counters);
+	pool->n_threads--;
+	pool->retired++;
+}
+
+/**
+ * @brief Read the pool statistics
+ *
+ * @param[in] pool	work pool
+ * @param[out] wps	counters since init, summed over all workers
+ */
+void
+work_pool_stats(struct work_pool *pool, struct work_pool_stats *wps)
+{
+	struct work_pool_thread *wpt;
+
+	memset(wps, 0, sizeof(*wps));
+
+	pthread_mutex_lock(&pool->pqh.qmutex);
+	wps->n_threads = pool->n_threads;
+	wps->n_waiting = pool->pqh.qcount;
+	wps->queued = work_pool_backlog(pool);
+	wps->flags = pool->params.flags;
+	wps->spawned = atomic_fetch_uint64_t(&pool->spawned);
+	wps->retired = pool->retired;
+	wps->adapt = pool->adapt;
+
+	work_pool_merge(&wps->counters, &pool->counters);
+	TAILQ_FOREACH(wpt, &pool->wpt_all, wpt_allq)
+		work_pool_merge(&wps->counters, &wpt->counters);
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+}
+
+/**
+ * @brief Size the pool for the last interval
+ *
+ * From the tasks run, the worker time spent waiting, and the queue
+ * left at the end of the interval:
+ *
+ * - When the estimated queue wait (by Little's law, the backlog over
+ *   the throughput) is above the budget, or the backlog is doubling on
+ *   the way there, the target grows.  The step doubles while it keeps
+ *   growing, so that a ramp is met ahead rather than one thread per
+ *   interval.
+ * - With no backlog and a quarter or more of the worker time idle, the
+ *   target shrinks by half the spare workers.  Surplus idle workers are
+ *   woken to retire, and busy ones retire as they run out of work.
+ * - Otherwise, with a backlog within budget, the last change is undone
+ *   when throughput fell after it, the hill climbing of the .NET thread
+ *   pool.
+ *
+ * Called with qmutex held.
+ *
+ * @param[in] pool	work pool
+ * @param[in] now_ms	monotonic
+ *
+ * @return number of threads to spawn, already counted in n_threads.
+ */
+static uint32_t
+work_pool_adapt(struct work_pool *pool, uint64_t now_ms)
+{
+	struct work_pool_adapt *wpa = &pool->adapt;
+	uint64_t done;
+	uint64_t idle;
+	uint64_t interval = now_ms - wpa->last_ms;
+	uint64_t capacity;
+	uint64_t wait_us;
+	uint32_t spare;
+	uint32_t spawn = 0;
+	int32_t target = wpa->target;
+	int32_t step = 0;
+
+	if (!pool->params.thrd_max) {
+		/* shutting down */
+		return (0);
+	}
+	if (!interval)
+		interval = 1;
+
+	work_pool_sum_locked(pool, &done, &idle);
+	wpa->last_ms = now_ms;
+	wpa->backlog = work_pool_backlog(pool);
+	wpa->throughput = (done - wpa->done_last) * 1000 / interval;
+
+	capacity = (uint64_t)pool->n_threads * interval * 1000000;
+	idle -= wpa->idle_last;
+	wpa->util = (idle < capacity) ? 100 - idle * 100 / capacity : 0;
+
+	wait_us = (uint64_t)wpa->backlog * interval * 1000
+		/ MAX(done - wpa->done_last, 1);
+	wpa->wait_us = MIN(wait_us, UINT32_MAX);
+
+	wpa->done_last = done;
+	wpa->idle_last += idle;
+
+	if (wpa->wait_us > pool->params.adapt_wait_us
+	 || (wpa->backlog > wpa->backlog_last * 2
+	  && wpa->wait_us > pool->params.adapt_wait_us / 4)) {
+		step = (wpa->step > 0)
+			? MIN(wpa->step * 2, WORK_POOL_ADAPT_STEP_MAX) : 1;
+		wpa->grows++;
+	} else if (!wpa->backlog && wpa->util < 75) {
+		spare = (100 - wpa->util) * pool->n_threads / 100;
+		step = -(int32_t)MAX(spare / 2, 1);
+		wpa->shrinks++;
+	} else if (wpa->backlog && wpa->step
+		&& wpa->throughput < wpa->throughput_last
+				     - wpa->throughput_last / 20) {
+		/* the last change cost throughput, more contention than
+		 * parallelism
+		 */
+		step = (wpa->step > 0) ? -1 : 1;
+		wpa->climbs++;
+	}
+
+	target += step;
+	if (target > pool->params.thrd_max)
+		target = pool->params.thrd_max;
+	if (target < pool->params.thrd_min)
+		target = pool->params.thrd_min;
+
+	wpa->step = target - (int32_t)wpa->target;
+	wpa->target = target;
+	wpa->backlog_last = wpa->backlog;
+	wpa->throughput_last = wpa->throughput;
+
+	if (wpa->step) {
+		__warnx(TIRPC_DEBUG_FLAG_WORKER,
+			"%s() \"%s\" target %" PRIu32 " (%+" PRId32
+			") threads %" PRIu32 " throughput %" PRIu32
+			" wait %" PRIu32 "us util %" PRIu32 "%% backlog %"
+			PRIu32,
+			__func__, pool->name, wpa->target, wpa->step,
+			pool->n_threads, wpa->throughput, wpa->wait_us,
+			wpa->util, wpa->backlog);
+	}
+
+	if (pool->n_threads < wpa->target) {
+		/* ahead of the workers noticing */
+		spawn = wpa->target - pool->n_threads;
+		pool->n_threads += spawn;
+	} else if (pool->n_threads > wpa->target) {
+		work_pool_wakeup_locked(pool,
+					pool->n_threads - wpa->target);
+	}
+	return (spawn);
+}
+
+/*
+ * Run the controller when its interval is over, by whichever thread
+ * notices first.  When locked, qmutex is released while spawning.
+ */
+static void
+work_pool_adapt_tick(struct work_pool *pool, bool locked)
+{
+	uint64_t now_ms = work_pool_now_ns() / 1000000;
+	uint64_t next_ms = atomic_fetch_uint64_t(&pool->adapt.next_ms);
+	uint32_t spawn;
+
+	if (now_ms < next_ms
+	 || !atomic_cas_uint64_t(&pool->adapt.next_ms, next_ms,
+				 now_ms + pool->params.adapt_ms))
+		return;
+
+	if (!locked)
+		pthread_mutex_lock(&pool->pqh.qmutex);
+	spawn = work_pool_adapt(pool, now_ms);
+	if (!spawn) {
+		if (!locked)
+			pthread_mutex_unlock(&pool->pqh.qmutex);
+		return;
+	}
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+
+	while (spawn--)
+		(void)work_pool_spawn(pool);
+
+	if (locked)
+		pthread_mutex_lock(&pool->pqh.qmutex);
+}
+
+/*
+ * Run a task, counting it for this worker.  The entry may be freed or
+ * submitted again by the task.
+ */
+static void
+work_pool_run(struct work_pool *pool, struct work_pool_thread *wpt,
+	      struct work_pool_entry *work)
+{
+	work_pool_fun_t fun = work->fun;
+	uint64_t start = work_pool_clock_ns();
+	uint64_t wait_ns = (start > work->submit_ns)
+			 ? start - work->submit_ns : 0;
+
+	work->wpt = wpt;
+	wpt->work = work;
+	__warnx(TIRPC_DEBUG_FLAG_WORKER,
+		"%s() %s task %p",
+		__func__, wpt->worker_name, work);
+	fun(work);
+	wpt->work = NULL;
+
+	work_pool_count(&wpt->counters, fun, wait_ns,
+			work_pool_clock_ns() - start);
+
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+		work_pool_adapt_tick(pool, false);
+}
+
+/*
+ * WORK_POOL_FLAG_STEAL
+ */
+
+static bool
+work_pool_deque_push(struct work_pool_deque *wpdq,
+		     struct work_pool_entry *work)
+{
+	uint64_t bottom = wpdq->bottom;
+
+	if (bottom - atomic_fetch_uint64_t(&wpdq->top) >= WORK_POOL_DEQUE_SIZE)
+		return false;
+
+	atomic_store_voidptr((void **)&wpdq->ring[bottom & WORK_POOL_DEQUE_MASK],
+			     work);
+	atomic_store_uint64_t(&wpdq->bottom, bottom + 1);
+	return true;
+}
+
+static struct work_pool_entry *
+work_pool_deque_take(struct work_pool_deque *wpdq)
+{
+	struct work_pool_entry *work;
+	uint64_t top;
+
+	do {
+		top = atomic_fetch_uint64_t(&wpdq->top);
+		if (top >= atomic_fetch_uint64_t(&wpdq->bottom))
+			return (NULL);
+		/* a slot reused by the owner fails the swap below */
+		work = atomic_fetch_voidptr(
+			(void **)&wpdq->ring[top & WORK_POOL_DEQUE_MASK]);
+	} while (!atomic_cas_uint64_t(&wpdq->top, top, top + 1));
+
+	return (work);
+}
+
+/*
+ * Called with qmutex held.
+ */
+static void
+work_pool_deque_attach(struct work_pool *pool, struct work_pool_thread *wpt)
+{
+	uint32_t ix;
+
+	for (ix = 0; ix < pool->wpdq_max; ix++) {
+		if (!pool->wpdq[ix].owner)
+			break;
+	}
+	if (ix >= pool->wpdq_max) {
+		/* only submits to the shared queue */
+		wpt->wpdq = NULL;
+		return;
+	}
+
+	wpt->wpdq = &pool->wpdq[ix];
+	wpt->wpdq->owner = wpt;
+	atomic_store_int32_t(&wpt->wpdq->node, -1);
+	if (ix >= pool->wpdq_hw)
+		atomic_store_uint32_t(&pool->wpdq_hw, ix + 1);
+}
+
+/*
+ * Called with qmutex held.  Normally empty, as the owner drains its
+ * deque before idling.
+ */
+static void
+work_pool_deque_detach(struct work_pool *pool, struct work_pool_thread *wpt)
+{
+	struct work_pool_entry *work;
+	int count = 0;
+
+	if (!wpt->wpdq)
+		return;
+
+	while ((work = work_pool_deque_take(wpt->wpdq))) {
+		work_pool_enqueue_locked(pool, work, WORK_POOL_PRIO_NORMAL);
+		count++;
+	}
+	work_pool_wakeup_locked(pool, count);
+
+	wpt->wpdq->owner = NULL;
+	wpt->wpdq = NULL;
+}
+
+/*
+ * NUMA node of the calling thread's cpu, or -1.  Only asked once some
+ * worker has pushed from a known node.
+ */
+static int
+work_pool_node(struct work_pool *pool)
+{
+#if defined(HAVE_GETCPU)
+	unsigned int cpu;
+	unsigned int node;
+
+	if (atomic_fetch_uint32_t(&pool->wpdq_numa)
+	    && !getcpu(&cpu, &node))
+		return (node);
+#endif
+	return (-1);
+}
+
+/*
+ * Own deque first, then the shared queue, then the other deques, those
+ * filled on this thread's node before the rest.  Queued high priority
+ * work goes before the own deque.
+ */
+static struct work_pool_entry *
+work_pool_take(struct work_pool *pool, struct work_pool_thread *wpt,
+	       bool locked)
+{
+	struct work_pool_entry *work = NULL;
+	struct work_pool_deque *wpdq;
+	bool urgent = atomic_fetch_uint32_t(&pool->n_high);
+	uint32_t start;
+	int node;
+	uint32_t hw;
+	uint32_t ix;
+
+	if (wpt->wpdq && !urgent) {
+		work = work_pool_deque_take(wpt->wpdq);
+		if (work)
+			return (work);
+	}
+
+	if (atomic_fetch_uint32_t(&pool->n_shared)) {
+		if (!locked)
+			pthread_mutex_lock(&pool->pqh.qmutex);
+		work = work_pool_dequeue_locked(pool);
+		if (!locked)
+			pthread_mutex_unlock(&pool->pqh.qmutex);
+		if (work)
+			return (work);
+	}
+
+	if (wpt->wpdq && urgent) {
+		work = work_pool_deque_take(wpt->wpdq);
+		if (work)
+			return (work);
+	}
+
+	hw = atomic_fetch_uint32_t(&pool->wpdq_hw);
+	start = wpt->wpdq ? wpt->wpdq - pool->wpdq : 0;
+	node = work_pool_node(pool);
+	for (ix = 1; node >= 0 && ix <= hw; ix++) {
+		wpdq = &pool->wpdq[(start + ix) % hw];
+		if (atomic_fetch_int32_t(&wpdq->node) != node)
+			continue;
+		work = work_pool_deque_take(wpdq);
+		if (work)
+			return (work);
+	}
+	for (ix = 1; ix <= hw; ix++) {
+		work = work_pool_deque_take(&pool->wpdq[(start + ix) % hw]);
+		if (work)
+			return (work);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Push onto the calling worker's own deque, without the queue lock
+ * unless there are idle workers to wake.
+ *
+ * @return number of entries pushed, the remainder go to the shared queue.
+ */
+static int
+work_pool_push(struct work_pool *pool, struct work_pool_entry **works,
+	       int count)
+{
+	struct work_pool_thread *wpt = work_pool_self;
+	int ix;
+
+	if (!wpt || wpt->pool != pool || !wpt->wpdq)
+		return (0);
+
+	for (ix = 0; ix < count; ix++) {
+		if (!work_pool_deque_push(wpt->wpdq, works[ix]))
+			break;
+	}
+
+	/* pairs with the recheck in work_pool_steal_wait() */
+	if (ix && atomic_fetch_uint32_t(&pool->n_idle)) {
+		pthread_mutex_lock(&pool->pqh.qmutex);
+		work_pool_wakeup_locked(pool, ix);
+		pthread_mutex_unlock(&pool->pqh.qmutex);
+	}
+	return (ix);
+}
+
+/**
+ * @brief Note the NUMA node of the calling worker's pushes
+ *
+ * Idle workers on that node steal them before those of other nodes.
+ * Ignored outside a stealing pool.
+ *
+ * @param[in] node	NUMA node, or -1 when unknown
+ */
+void
+work_pool_set_node(int node)
+{
+	struct work_pool_thread *wpt = work_pool_self;
+
+	if (!wpt || !wpt->wpdq)
+		return;
+
+	atomic_store_int32_t(&wpt->wpdq->node, node);
+	if (node >= 0 && !atomic_fetch_uint32_t(&wpt->pool->wpdq_numa))
+		atomic_store_uint32_t(&wpt->pool->wpdq_numa, 1);
+}
+
+/*
+ * Dynamically add another thread when all are busy.  The unlocked
+ * test keeps the queue lock out of the common path of the stealing and
+ * handoff workers.
+ */
+static void
+work_pool_spawn_unlocked(struct work_pool *pool)
+{
+	bool spawn;
+
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT) {
+		if (atomic_fetch_uint32_t(&pool->n_threads) >=
+		    atomic_fetch_uint32_t(&pool->adapt.target))
+			return;
+	} else if (atomic_fetch_uint32_t(&pool->n_idle) >=
+		   (uint32_t)pool->params.thrd_min
+		|| atomic_fetch_uint32_t(&pool->n_threads) >=
+		   (uint32_t)pool->params.thrd_max)
+		return;
+
+	pthread_mutex_lock(&pool->pqh.qmutex);
+	spawn = work_pool_grow_locked(pool);
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+
+	if (spawn)
+		(void)work_pool_spawn(pool);
+}
+
+/*
+ * Called with qmutex held, returns with it held.
+ *
+ * @return false when the thread should terminate.
+ */
+static bool
+work_pool_steal_wait(struct work_pool *pool, struct work_pool_thread *wpt,
+		     struct work_pool_entry **work)
+{
+	struct timespec ts;
+	uint64_t idle_ns;
+	int rc = 0;
+
+	*work = NULL;
+	if (work_pool_retire_locked(pool))
+		return false;
+
+	/*
+	 * Add myself to waiting queue.
+	 */
+	pool->pqh.qcount++;
+	TAILQ_INSERT_TAIL(&pool->wptqh, wpt, wptq);
+	wpt->wakeup = false;
+	atomic_inc_uint32_t(&pool->n_idle);
+
+	/* recheck after advertising, a push may have seen no idle workers */
+	*work = work_pool_take(pool, wpt, true);
+	if (!*work) {
+		__warnx(TIRPC_DEBUG_FLAG_WORKER,
+			"%s() %s waiting",
+			__func__, wpt->worker_name);
+
+		clock_gettime(CLOCK_REALTIME_FAST, &ts);
+		timespec_addms(&ts, pool->timeout_ms);
+
+		idle_ns = work_pool_now_ns();
+		rc = pthread_cond_timedwait(&wpt->pqcond, &pool->pqh.qmutex,
+					    &ts);
+		wpt->counters.idle_ns += work_pool_now_ns() - idle_ns;
+	}
+	atomic_dec_uint32_t(&pool->n_idle);
+
+	if (wpt->wakeup)
+		return true;
+
+	/* not woken by a submit, so still on the waiting queue */
+	pool->pqh.qcount--;
+	TAILQ_REMOVE(&pool->wptqh, wpt, wptq);
+
+	if (*work)
+		return true;
+
+	if (rc && rc != ETIMEDOUT) {
+		__warnx(TIRPC_DEBUG_FLAG_ERROR,
+			"%s() cond_timedwait failed (%d)\n",
+			__func__, rc);
+		return false;
+	}
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+		work_pool_adapt_tick(pool, true);
+	return (work_pool_keep_locked(pool));
+}
+
+/**
+ * @brief The worker thread, with work stealing
+ *
+ * Like work_pool_thread(), except that the queue lock is only taken
+ * to wait, to wake, and for submissions from outside the pool.
+ *
+ * @param[in] arg 	thread context
+ */
+
+static void *
+work_pool_steal_thread(void *arg)
+{
+	struct work_pool_thread *wpt = arg;
+	struct work_pool *pool = wpt->pool;
+	struct work_pool_entry *work;
 
-#include <sys/types.h>
-#if !defined(_WIN32)
-#include <netinet/in.h>
-#include <err.h>
-#endif
+	rcu_register_thread();
 
-#include <rpc/types.h>
-#include "rpc_com.h"
-#include <sys/types.h>
-#include <misc/abstract_atomic.h>
-#include <misc/portable.h>
-#include <assert.h>
-#include <stddef.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <intrinsic.h>
-#include <urcu-bp.h>
+	pthread_cond_init(&wpt->pqcond, NULL);
+	pthread_mutex_lock(&pool->pqh.qmutex);
 
-#include <rpc/work_pool.h>
+	wpt->worker_index = atomic_inc_uint32_t(&pool->worker_index);
+	snprintf(wpt->worker_name, sizeof(wpt->worker_name), "%.5s%" PRIu32,
+		 pool->name, wpt->worker_index);
+	__ntirpc_pkg_params.thread_name_(wpt->worker_name);
+	work_pool_attach_locked(pool, wpt);
 
-#define WORK_POOL_STACK_SIZE MAX(1 * 1024 * 1024, PTHREAD_STACK_MIN)
-#define WORK_POOL_TIMEOUT_MS (31 /* seconds (prime) */ * 1000)
+	work_pool_deque_attach(pool, wpt);
+	work_pool_self = wpt;
+	pthread_mutex_unlock(&pool->pqh.qmutex);
 
-/* forward declaration in lieu of moving code, was inline */
+	for (;;) {
+		work = work_pool_take(pool, wpt, false);
+		if (!work) {
+			bool more;
 
-static int work_pool_spawn(struct work_pool *pool);
+			pthread_mutex_lock(&pool->pqh.qmutex);
+			more = work_pool_steal_wait(pool, wpt, &work);
+			pthread_mutex_unlock(&pool->pqh.qmutex);
 
-int
-work_pool_init(struct work_pool *pool, const char *name,
-		struct work_pool_params *params)
+			if (!more)
+				break;
+			if (!work)
+				continue;
+		}
+
+		work_pool_spawn_unlocked(pool);
+		work_pool_run(pool, wpt, work);
+	}
+
+	pthread_mutex_lock(&pool->pqh.qmutex);
+	work_pool_self = NULL;
+	work_pool_deque_detach(pool, wpt);
+	work_pool_detach_locked(pool, wpt);
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+
+	__warnx(TIRPC_DEBUG_FLAG_WORKER,
+		"%s() %s terminating",
+		__func__, wpt->worker_name);
+	cond_destroy(&wpt->pqcond);
+	mem_free(wpt, sizeof(*wpt));
+	rcu_unregister_thread();
+
+	return (NULL);
+}
+
+/*
+ * WORK_POOL_FLAG_HANDOFF
+ */
+
+/*
+ * Spin for a handoff, within the adaptive budget.
+ */
+static bool
+work_pool_park_spin(struct work_pool *pool, struct work_pool_thread *wpt)
 {
-	int rc;
+	struct timespec ts;
+	uint64_t start;
+	uint64_t now;
+	uint32_t spins = 0;
 
-	memset(pool, 0, sizeof(*pool));
-	poolq_head_setup(&pool->pqh);
-	TAILQ_INIT(&pool->wptqh);
+	if (!wpt->spin_ns)
+		return false;
 
-	pool->timeout_ms = WORK_POOL_TIMEOUT_MS;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 
-	pool->name = mem_strdup(name);
-	pool->params = *params;
+	for (;;) {
+		if (atomic_fetch_uint32_t(&wpt->park) & WORK_POOL_PARK_WAKE) {
+			/* worth it, longer next time */
+			wpt->spin_ns = MIN(wpt->spin_ns * 2,
+					   pool->params.spin_us * 1000);
+			return true;
+		}
+		work_pool_cpu_relax();
 
-	if (pool->params.thrd_min < 1) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s() thrd_min (%d) < 1",
-			__func__, pool->params.thrd_min);
-		pool->params.thrd_min = 1;
-	};
+		if (++spins & 63)
+			continue;
+		(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		if (now - start > wpt->spin_ns)
+			break;
+	}
 
-	if (pool->params.thrd_max < pool->params.thrd_min) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s() thrd_max (%d) < thrd_min (%d)",
-			__func__, pool->params.thrd_max, pool->params.thrd_min);
-		pool->params.thrd_max = pool->params.thrd_min;
+	/* wasted, shorter next time */
+	wpt->spin_ns = MAX(wpt->spin_ns / 2, WORK_POOL_SPIN_MIN_NS);
+	return false;
+}
+
+/*
+ * Sleep until handed off, or timeout.  Setting the sleep bit and the
+ * wake bit are both atomic on the same word, so either the waker sees
+ * the sleeper, or the sleeper sees the wake.
+ */
+static bool
+work_pool_park_sleep(struct work_pool *pool, struct work_pool_thread *wpt)
+{
+#if defined(__linux__)
+	struct timespec ts = {
+		.tv_sec = pool->timeout_ms / 1000,
+		.tv_nsec = (pool->timeout_ms % 1000) * 1000000,
 	};
+	uint32_t park = atomic_postset_uint32_t_bits(&wpt->park,
+						     WORK_POOL_PARK_SLEEP);
 
-	rc = pthread_attr_init(&pool->attr);
-	if (rc) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s() can't init pthread's attributes: %s (%d)",
-			__func__, strerror(rc), rc);
-		return rc;
+	while (!(park & WORK_POOL_PARK_WAKE)) {
+		if (work_pool_futex(&wpt->park, FUTEX_WAIT_PRIVATE,
+				    park | WORK_POOL_PARK_SLEEP, &ts)
+		 && errno == ETIMEDOUT)
+			return (atomic_fetch_uint32_t(&wpt->park)
+				& WORK_POOL_PARK_WAKE);
+		park = atomic_fetch_uint32_t(&wpt->park);
 	}
+#endif
+	return true;
+}
 
-	rc = pthread_attr_setscope(&pool->attr, PTHREAD_SCOPE_SYSTEM);
-	if (rc) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s() can't set pthread's scope: %s (%d)",
-			__func__, strerror(rc), rc);
-		return rc;
+/*
+ * Called with qmutex held, returns with it released.
+ *
+ * @return false when the thread should terminate.
+ */
+static bool
+work_pool_park(struct work_pool *pool, struct work_pool_thread *wpt,
+	       struct work_pool_entry **work)
+{
+	bool keep;
+
+	*work = NULL;
+	if (work_pool_retire_locked(pool)) {
+		pthread_mutex_unlock(&pool->pqh.qmutex);
+		return false;
 	}
 
-	rc = pthread_attr_setdetachstate(&pool->attr, PTHREAD_CREATE_DETACHED);
-	if (rc) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s() can't set pthread's join state: %s (%d)",
-			__func__, strerror(rc), rc);
-		return rc;
+	/*
+	 * Add myself to waiting queue.
+	 */
+	pool->pqh.qcount++;
+	TAILQ_INSERT_TAIL(&pool->wptqh, wpt, wptq);
+	wpt->wakeup = false;
+	atomic_store_uint32_t(&wpt->park, WORK_POOL_PARK_SPIN);
+	atomic_inc_uint32_t(&pool->n_idle);
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+
+	__warnx(TIRPC_DEBUG_FLAG_WORKER,
+		"%s() %s waiting",
+		__func__, wpt->worker_name);
+
+	if (!work_pool_park_spin(pool, wpt)) {
+		uint64_t idle_ns = work_pool_now_ns();
+
+		if (!work_pool_park_sleep(pool, wpt)) {
+			atomic_dec_uint32_t(&pool->n_idle);
+			pthread_mutex_lock(&pool->pqh.qmutex);
+			wpt->counters.idle_ns += work_pool_now_ns() - idle_ns;
+
+			/* handed off while taking the lock? */
+			if (!(atomic_fetch_uint32_t(&wpt->park)
+			      & WORK_POOL_PARK_WAKE)) {
+				/* timed out, still on the waiting queue */
+				pool->pqh.qcount--;
+				TAILQ_REMOVE(&pool->wptqh, wpt, wptq);
+				atomic_store_uint32_t(&wpt->park, 0);
+
+				if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+					work_pool_adapt_tick(pool, true);
+				keep = work_pool_keep_locked(pool);
+				pthread_mutex_unlock(&pool->pqh.qmutex);
+				return keep;
+			}
+			pthread_mutex_unlock(&pool->pqh.qmutex);
+			goto handed;
+		}
+		wpt->counters.idle_ns += work_pool_now_ns() - idle_ns;
 	}
+	atomic_dec_uint32_t(&pool->n_idle);
 
-	rc = pthread_attr_setstacksize(&pool->attr,
-				       params->thr_stack_size > 0 ?
-				       params->thr_stack_size :
-				       WORK_POOL_STACK_SIZE);
-	if (rc) {
-		__warnx(TIRPC_DEBUG_FLAG_ERROR,
-			"%s() can't set pthread's stack size: %s (%d)",
-			__func__, strerror(rc), rc);
+handed:
+	/* no work when woken to retire or shut down */
+	*work = wpt->work;
+	wpt->work = NULL;
+	atomic_store_uint32_t(&wpt->park, 0);
+	return true;
+}
+
+/**
+ * @brief The worker thread, with direct handoff
+ *
+ * Like work_pool_thread(), except that idle workers spin, then park on
+ * a futex, and are woken with their next work in hand.
+ *
+ * @param[in] arg 	thread context
+ */
+
+static void *
+work_pool_park_thread(void *arg)
+{
+	struct work_pool_thread *wpt = arg;
+	struct work_pool *pool = wpt->pool;
+	struct work_pool_entry *work;
+
+	rcu_register_thread();
+
+	pthread_mutex_lock(&pool->pqh.qmutex);
+
+	wpt->worker_index = atomic_inc_uint32_t(&pool->worker_index);
+	snprintf(wpt->worker_name, sizeof(wpt->worker_name), "%.5s%" PRIu32,
+		 pool->name, wpt->worker_index);
+	__ntirpc_pkg_params.thread_name_(wpt->worker_name);
+	work_pool_attach_locked(pool, wpt);
+
+	if (pool->params.spin_us)
+		wpt->spin_ns = MAX(pool->params.spin_us * 1000 / 2,
+				   WORK_POOL_SPIN_MIN_NS);
+
+	for (;;) {
+		/*
+		 * Check for any queued work to avoid scheduling.
+		 */
+		work = work_pool_dequeue_locked(pool);
+		if (work) {
+			pthread_mutex_unlock(&pool->pqh.qmutex);
+		} else {
+			if (!work_pool_park(pool, wpt, &work))
+				break;
+			if (!work) {
+				pthread_mutex_lock(&pool->pqh.qmutex);
+				continue;
+			}
+		}
+
+		work_pool_spawn_unlocked(pool);
+		work_pool_run(pool, wpt, work);
+		pthread_mutex_lock(&pool->pqh.qmutex);
 	}
 
-	/* initial spawn will spawn more threads as needed */
-	pool->n_threads = 1;
-	return work_pool_spawn(pool);
+	pthread_mutex_lock(&pool->pqh.qmutex);
+	work_pool_detach_locked(pool, wpt);
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+
+	__warnx(TIRPC_DEBUG_FLAG_WORKER,
+		"%s() %s terminating",
+		__func__, wpt->worker_name);
+	mem_free(wpt, sizeof(*wpt));
+	rcu_unregister_thread();
+
+	return (NULL);
 }
 
 /**
@@ -149,8 +1410,8 @@ work_pool_thread(void *arg)
 {
 	struct work_pool_thread *wpt = arg;
 	struct work_pool *pool = wpt->pool;
-	struct poolq_entry *have;
 	struct timespec ts;
+	uint64_t idle_ns;
 	int rc;
 	bool spawn;
 
@@ -163,17 +1424,14 @@ work_pool_thread(void *arg)
 	snprintf(wpt->worker_name, sizeof(wpt->worker_name), "%.5s%" PRIu32,
 		 pool->name, wpt->worker_index);
 	__ntirpc_pkg_params.thread_name_(wpt->worker_name);
+	work_pool_attach_locked(pool, wpt);
 
 	do {
 		/* testing at top of loop allows pre-specification of work,
 		 * and thread termination after timeout with no work (below).
 		 */
 		if (wpt->work) {
-			wpt->work->wpt = wpt;
-			spawn = pool->pqh.qcount < pool->params.thrd_min
-			      && pool->n_threads < pool->params.thrd_max;
-			if (spawn)
-				pool->n_threads++;
+			spawn = work_pool_grow_locked(pool);
 			pthread_mutex_unlock(&pool->pqh.qmutex);
 
 			if (spawn) {
@@ -181,22 +1439,18 @@ work_pool_thread(void *arg)
 				(void)work_pool_spawn(pool);
 			}
 
-			__warnx(TIRPC_DEBUG_FLAG_WORKER,
-				"%s() %s task %p",
-				__func__, wpt->worker_name, wpt->work);
-			wpt->work->fun(wpt->work);
-			wpt->work = NULL;
+			work_pool_run(pool, wpt, wpt->work);
 			pthread_mutex_lock(&pool->pqh.qmutex);
 		}
 		/*
 		 * Check for any queued work to avoid scheduling.
 		 */
-		have = TAILQ_FIRST(&pool->pqh.qh);
-		if (have) {
-			TAILQ_REMOVE(&pool->pqh.qh, have, q);
-			wpt->work = (struct work_pool_entry *)have;
+		wpt->work = work_pool_dequeue_locked(pool);
+		if (wpt->work)
 			continue;
-		}
+
+		if (work_pool_retire_locked(pool))
+			break;
 
 		/*
 		 * Add myself to waiting queue.
@@ -213,6 +1467,8 @@ work_pool_thread(void *arg)
 
 		wpt->wakeup = false;
 
+		idle_ns = work_pool_now_ns();
+
 		/* Note: the mutex is the pool _head,
 		 * but the condition is per worker,
 		 * making the signal efficient!
@@ -220,6 +1476,8 @@ work_pool_thread(void *arg)
 		rc = pthread_cond_timedwait(&wpt->pqcond, &pool->pqh.qmutex,
 					    &ts);
 
+		wpt->counters.idle_ns += work_pool_now_ns() - idle_ns;
+
 		/*
 		 * Wokeup after work submit.
 		 * It could be shutdown also.
@@ -247,10 +1505,12 @@ work_pool_thread(void *arg)
 				__func__, rc);
 			break;
 		}
-	} while (wpt->work || wpt->wakeup ||
-		 pool->pqh.qcount < pool->params.thrd_min);
 
-	pool->n_threads--;
+		if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+			work_pool_adapt_tick(pool, true);
+	} while (wpt->work || wpt->wakeup || work_pool_keep_locked(pool));
+
+	work_pool_detach_locked(pool, wpt);
 	pthread_mutex_unlock(&pool->pqh.qmutex);
 
 	__warnx(TIRPC_DEBUG_FLAG_WORKER,
@@ -271,7 +1531,12 @@ work_pool_spawn(struct work_pool *pool)
 
 	wpt->pool = pool;
 
-	rc = pthread_create(&wpt->pt, &pool->attr, work_pool_thread, wpt);
+	rc = pthread_create(&wpt->pt, &pool->attr,
+			    (pool->params.flags & WORK_POOL_FLAG_STEAL)
+			    ? work_pool_steal_thread
+			    : (pool->params.flags & WORK_POOL_FLAG_HANDOFF)
+			    ? work_pool_park_thread : work_pool_thread,
+			    wpt);
 	if (rc) {
 		__warnx(TIRPC_DEBUG_FLAG_ERROR,
 			"%s() pthread_create failed (%d)\n",
@@ -279,11 +1544,13 @@ work_pool_spawn(struct work_pool *pool)
 		return rc;
 	}
 
+	atomic_inc_uint64_t(&pool->spawned);
 	return (0);
 }
 
 int
-work_pool_submit(struct work_pool *pool, struct work_pool_entry *work)
+work_pool_submit(struct work_pool *pool, struct work_pool_entry *work,
+		 enum work_pool_prio prio)
 {
 	int rc = 0;
 
@@ -292,26 +1559,84 @@ work_pool_submit(struct work_pool *pool, struct work_pool_entry *work)
 		return (0);
 	}
 
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT) {
+		/* also when every worker is in a long running task */
+		work_pool_adapt_tick(pool, false);
+	}
+
+	work->submit_ns = work_pool_clock_ns();
+
+	if (prio == WORK_POOL_PRIO_NORMAL && work_pool_push(pool, &work, 1))
+		return rc;
+
 	pthread_mutex_lock(&pool->pqh.qmutex);
-	/*
-	 * Insert in work queue so that running thread can
-	 * pickup without scheduling.
-	 */
-	TAILQ_INSERT_TAIL(&pool->pqh.qh, &work->pqe, q);
-	struct work_pool_thread *wpt = TAILQ_LAST(&pool->wptqh, work_pool_s);
-	if (wpt) {
-		pool->pqh.qcount--;
-		TAILQ_REMOVE(&pool->wptqh, wpt, wptq);
-		assert(!wpt->wakeup);
-		wpt->wakeup = true;
-		pthread_cond_signal(&wpt->pqcond);
-	} else {
-		assert(pool->pqh.qcount == 0);
+	if (!(pool->params.flags & WORK_POOL_FLAG_HANDOFF)
+	 || !work_pool_handoff_locked(pool, &work, 1)) {
+		/*
+		 * Insert in work queue so that running thread can
+		 * pickup without scheduling.
+		 */
+		work_pool_enqueue_locked(pool, work, prio);
+		work_pool_wakeup_locked(pool, 1);
 	}
 	pthread_mutex_unlock(&pool->pqh.qmutex);
 	return rc;
 }
 
+/**
+ * @brief Submit several entries at once
+ *
+ * All entries are queued in order under a single acquisition of the
+ * queue mutex, then one idle worker is woken per entry, until there
+ * are no more idle workers.  Busy workers pick up the remainder from
+ * the queue without scheduling.  With WORK_POOL_FLAG_HANDOFF, the first
+ * entries go straight to the parked workers instead.
+ *
+ * @param[in] pool	work pool
+ * @param[in] works	vector of entries
+ * @param[in] count	number of entries
+ * @param[in] prio	class of all the entries
+ */
+int
+work_pool_submit_batch(struct work_pool *pool, struct work_pool_entry **works,
+		       int count, enum work_pool_prio prio)
+{
+	uint64_t now_ns;
+	int ix;
+	int pushed = 0;
+	int handed;
+
+	if (unlikely(!pool->params.thrd_max)) {
+		/* queue is draining */
+		return (0);
+	}
+	if (count < 1)
+		return (0);
+
+	now_ns = work_pool_clock_ns();
+	for (ix = 0; ix < count; ix++)
+		works[ix]->submit_ns = now_ns;
+
+	if (pool->params.flags & WORK_POOL_FLAG_ADAPT)
+		work_pool_adapt_tick(pool, false);
+
+	if (prio == WORK_POOL_PRIO_NORMAL)
+		pushed = work_pool_push(pool, works, count);
+	if (pushed == count)
+		return (0);
+
+	pthread_mutex_lock(&pool->pqh.qmutex);
+	handed = pushed;
+	if (pool->params.flags & WORK_POOL_FLAG_HANDOFF)
+		handed += work_pool_handoff_locked(pool, &works[pushed],
+						   count - pushed);
+	for (ix = handed; ix < count; ix++)
+		work_pool_enqueue_locked(pool, works[ix], prio);
+	work_pool_wakeup_locked(pool, count - handed);
+	pthread_mutex_unlock(&pool->pqh.qmutex);
+	return (0);
+}
+
 int
 work_pool_shutdown(struct work_pool *pool)
 {
@@ -325,6 +1650,12 @@ work_pool_shutdown(struct work_pool *pool)
 	pool->timeout_ms = 1;
 	pool->params.thrd_max =
 	pool->params.thrd_min = 0;
+	pool->adapt.target = 0;
+
+	if (pool->params.flags & WORK_POOL_FLAG_HANDOFF) {
+		/* off the waiting queue, to time out again promptly */
+		work_pool_wakeup_locked(pool, pool->pqh.qcount);
+	}
 
 	wpt = TAILQ_FIRST(&pool->wptqh);
 	while (wpt) {
@@ -342,6 +1673,10 @@ work_pool_shutdown(struct work_pool *pool)
 	}
 	pthread_mutex_unlock(&pool->pqh.qmutex);
 
+	if (pool->wpdq) {
+		mem_free(pool->wpdq, pool->wpdq_max * sizeof(*pool->wpdq));
+		pool->wpdq = NULL;
+	}
 	mem_free(pool->name, 0);
 	poolq_head_destroy(&pool->pqh);
 
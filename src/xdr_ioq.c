@@ -56,6 +56,7 @@
 #endif
 
 #include <rpc/xdr_ioq.h>
+#include "xdr_ioq_pool.h"
 
 #define VREC_MAXBUFS 24
 
@@ -861,6 +862,14 @@ xdr_ioq_putbufs(XDR *xdrs, xdr_uio *uio, u_int flags)
 		uv->u.uio_flags = UIO_FLAG_REFER;
 		uv->v = *v;
 
+		if (uio->uio_flags & UIO_FLAG_FILE) {
+			/* offsets, not addresses; the sender finds uio_fd
+			 * through vio_base.
+			 */
+			uv->v.vio_base = (uint8_t *)uio;
+			uv->v.vio_type = VIO_FILE;
+		}
+
 		/* save original buffer sequence for rele */
 		uv->u.uio_refer = uio;
 		(uio->uio_references)++;
@@ -1041,6 +1050,11 @@ xdr_ioq_destroy(struct xdr_ioq *xioq, size_t qsize)
 	poolq_head_destroy(&xioq->ioq_uv.uvqh);
 	pthread_cond_destroy(&xioq->ioq_cond);
 
+	if (xioq->ioq_s.qflags & IOQ_FLAG_POOLED) {
+		xdr_ioq_pool_put(xioq);
+		return;
+	}
+
 	if (xioq->xdrs[0].x_flags & XDR_FLAG_FREE) {
 		mem_free(xioq, qsize);
 	}
@@ -1103,8 +1117,12 @@ xdr_ioq_newbuf(XDR *xdrs)
 	return true;
 }
 
-static int
-xdr_ioq_iovcount(XDR *xdrs, u_int start, u_int datalen)
+/*
+ * Count the buffers of datalen bytes at start.  File ranges are not in
+ * memory, so they are only counted for the sender (files true).
+ */
+int
+xdr_ioq_vcount(XDR *xdrs, u_int start, u_int datalen, bool files)
 {
 	/* Buffers starts at -1 to indicate start has not yet been found */
 	int buffers = -1;
@@ -1144,6 +1162,13 @@ xdr_ioq_iovcount(XDR *xdrs, u_int start, u_int datalen)
 			start -= len;
 		}
 		if (buffers > 0) {
+			if (unlikely(!files && uv->v.vio_type == VIO_FILE)) {
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s uv %p is a file range",
+					__func__, uv);
+				return -1;
+			}
+
 			/* Now we need to decrement the datalen to see if we're
 			 * done. Note the first time we come in, start may not
 			 * be zero, which represents the fact that start was in
@@ -1182,8 +1207,19 @@ xdr_ioq_iovcount(XDR *xdrs, u_int start, u_int datalen)
 	return buffers;
 }
 
-static bool
-xdr_ioq_fillbufs(XDR *xdrs, u_int start, xdr_vio *vector, u_int datalen)
+static int
+xdr_ioq_iovcount(XDR *xdrs, u_int start, u_int datalen)
+{
+	return xdr_ioq_vcount(xdrs, start, datalen, false);
+}
+
+/*
+ * Fill vector with the buffers of datalen bytes at start.  File ranges
+ * keep VIO_FILE, and only the sender (files true) may be given them.
+ */
+bool
+xdr_ioq_vfill(XDR *xdrs, u_int start, xdr_vio *vector, u_int datalen,
+	      bool files)
 {
 	bool found = false;
 	struct poolq_entry *have;
@@ -1222,8 +1258,17 @@ xdr_ioq_fillbufs(XDR *xdrs, u_int start, xdr_vio *vector, u_int datalen)
 		}
 
 		if (found) {
-			vector[idx] = uv->v;
-			vector[idx].vio_type = VIO_DATA;
+			if (uv->v.vio_type != VIO_FILE) {
+				vector[idx] = uv->v;
+				vector[idx].vio_type = VIO_DATA;
+			} else if (likely(files)) {
+				vector[idx] = uv->v;
+			} else {
+				__warnx(TIRPC_DEBUG_FLAG_ERROR,
+					"%s uv %p is a file range",
+					__func__, uv);
+				return false;
+			}
 
 			if (start > 0) {
 				/* The start position wasn't at the start of
@@ -1276,6 +1321,12 @@ xdr_ioq_fillbufs(XDR *xdrs, u_int start, xdr_vio *vector, u_int datalen)
 	return found;
 }
 
+static bool
+xdr_ioq_fillbufs(XDR *xdrs, u_int start, xdr_vio *vector, u_int datalen)
+{
+	return xdr_ioq_vfill(xdrs, start, vector, datalen, false);
+}
+
 static struct xdr_ioq_uv *
 xdr_ioq_use_or_allocate(struct xdr_ioq *xioq, xdr_vio *v, struct xdr_ioq_uv *uv)
 {
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2018 Red Hat, Inc. and/or its affiliates.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR `AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file xdr_ioq_pool.c
+ * @brief Size-class pools of receive buffers and xdr_ioq headers
+ *
+ * @section DESCRIPTION
+ *
+ * With SVC_INIT_BUF_POOL, each received fragment is a single chunk from
+ * a power of two size class (its xdr_ioq_uv followed by the data), and
+ * each received record an xdr_ioq from a class of its own.  Released
+ * chunks go first to a small cache of the releasing thread, then to a
+ * shared list for the class, and back to the allocator once the thread
+ * caches and shared lists together hold max bytes.  Fragments beyond the
+ * largest class are still allocated to size.
+ *
+ * A chunk is returned through its uio_release (with uio_p1 its class),
+ * and an xdr_ioq through IOQ_FLAG_POOLED in xdr_ioq_destroy(), so the
+ * consumers need not know.  Chunks released after shutdown are freed.
+ *
+ * Thread cache hits are added to the class statistics whenever that
+ * thread next takes the class lock, so they lag somewhat.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <rpc/types.h>
+#include <misc/portable.h>
+#include <misc/abstract_atomic.h>
+#include <rpc/rpc.h>
+#include <rpc/xdr_ioq.h>
+#include "xdr_ioq_pool.h"
+
+#define XDR_IOQ_POOL_SHIFT (9)		/* smallest buffers, 512 bytes */
+#define XDR_IOQ_POOL_MAX (64 * 1024 * 1024)
+#define XDR_IOQ_POOL_CACHE (8)
+
+/* class 0 holds the headers, the others buffers */
+#define XDR_IOQ_POOL_HDR (0)
+#define XDR_IOQ_POOL_BUF_MAX \
+	((size_t)1 << (XDR_IOQ_POOL_SHIFT + XDR_IOQ_POOL_CLASSES - 2))
+
+struct xdr_ioq_pool_obj {
+	struct xdr_ioq_pool_obj *next;
+};
+
+struct xdr_ioq_pool_class {
+	mutex_t lock;
+	struct xdr_ioq_pool_obj *free;
+	size_t chunk;		/* allocated size of each */
+	uint32_t size;
+	uint32_t idle;
+	uint64_t allocs;
+	uint64_t reuses;
+	uint64_t cached;
+	uint64_t frees;
+};
+
+static struct xdr_ioq_pool {
+	struct xdr_ioq_pool_class cls[XDR_IOQ_POOL_CLASSES];
+	pthread_key_t key;
+	uint64_t held;		/* atomic, in the caches and shared lists */
+	uint64_t max;
+	uint32_t cache;
+	bool keyed;
+	bool enabled;
+} xdr_ioq_pool;
+
+struct xdr_ioq_pool_cache {
+	struct xdr_ioq_pool_obj *free[XDR_IOQ_POOL_CLASSES];
+	uint32_t count[XDR_IOQ_POOL_CLASSES];
+	uint32_t hits[XDR_IOQ_POOL_CLASSES];	/* not yet in cached */
+	bool keyed;
+};
+
+static __thread struct xdr_ioq_pool_cache xdr_ioq_pool_tc;
+
+static inline int
+xdr_ioq_pool_class(size_t size)
+{
+	if (size <= ((size_t)1 << XDR_IOQ_POOL_SHIFT))
+		return (1);
+	return (1 + (64 - __builtin_clzll(size - 1)) - XDR_IOQ_POOL_SHIFT);
+}
+
+/*
+ * To the shared list, or the allocator when over the bound.
+ */
+static void
+xdr_ioq_pool_release(int ix, struct xdr_ioq_pool_obj *obj,
+		     struct xdr_ioq_pool_cache *tc)
+{
+	struct xdr_ioq_pool_class *c = &xdr_ioq_pool.cls[ix];
+
+	mutex_lock(&c->lock);
+	c->cached += tc->hits[ix];
+	tc->hits[ix] = 0;
+	if (xdr_ioq_pool.enabled
+	 && atomic_fetch_uint64_t(&xdr_ioq_pool.held) + c->chunk
+	    <= xdr_ioq_pool.max) {
+		obj->next = c->free;
+		c->free = obj;
+		c->idle++;
+		atomic_add_uint64_t(&xdr_ioq_pool.held, c->chunk);
+		obj = NULL;
+	} else {
+		c->frees++;
+	}
+	mutex_unlock(&c->lock);
+
+	if (obj)
+		mem_free(obj, c->chunk);
+}
+
+static void *
+xdr_ioq_pool_get(int ix)
+{
+	struct xdr_ioq_pool_cache *tc = &xdr_ioq_pool_tc;
+	struct xdr_ioq_pool_class *c = &xdr_ioq_pool.cls[ix];
+	struct xdr_ioq_pool_obj *obj = tc->free[ix];
+
+	if (obj) {
+		tc->free[ix] = obj->next;
+		tc->count[ix]--;
+		tc->hits[ix]++;
+		atomic_sub_uint64_t(&xdr_ioq_pool.held, c->chunk);
+		return (obj);
+	}
+
+	mutex_lock(&c->lock);
+	c->cached += tc->hits[ix];
+	tc->hits[ix] = 0;
+	obj = c->free;
+	if (obj) {
+		c->free = obj->next;
+		c->idle--;
+		c->reuses++;
+		atomic_sub_uint64_t(&xdr_ioq_pool.held, c->chunk);
+	} else {
+		c->allocs++;
+	}
+	mutex_unlock(&c->lock);
+
+	if (!obj)
+		obj = mem_alloc(c->chunk);
+	return (obj);
+}
+
+static void
+xdr_ioq_pool_put_obj(int ix, void *p)
+{
+	struct xdr_ioq_pool_cache *tc = &xdr_ioq_pool_tc;
+	struct xdr_ioq_pool_class *c = &xdr_ioq_pool.cls[ix];
+	struct xdr_ioq_pool_obj *obj = p;
+
+	if (tc->count[ix] >= xdr_ioq_pool.cache || !xdr_ioq_pool.enabled) {
+		xdr_ioq_pool_release(ix, obj, tc);
+		return;
+	}
+
+	/* counted against max as if shared */
+	if (atomic_add_uint64_t(&xdr_ioq_pool.held, c->chunk)
+	    > xdr_ioq_pool.max) {
+		atomic_sub_uint64_t(&xdr_ioq_pool.held, c->chunk);
+		xdr_ioq_pool_release(ix, obj, tc);
+		return;
+	}
+
+	if (unlikely(!tc->keyed)) {
+		/* flushed when the thread exits */
+		(void)pthread_setspecific(xdr_ioq_pool.key, tc);
+		tc->keyed = true;
+	}
+	obj->next = tc->free[ix];
+	tc->free[ix] = obj;
+	tc->count[ix]++;
+}
+
+static void
+xdr_ioq_pool_flush(void *arg)
+{
+	struct xdr_ioq_pool_cache *tc = arg;
+	struct xdr_ioq_pool_obj *obj;
+	int ix;
+
+	for (ix = 0; ix < XDR_IOQ_POOL_CLASSES; ix++) {
+		while ((obj = tc->free[ix])) {
+			tc->free[ix] = obj->next;
+			tc->count[ix]--;
+			atomic_sub_uint64_t(&xdr_ioq_pool.held,
+					    xdr_ioq_pool.cls[ix].chunk);
+			xdr_ioq_pool_release(ix, obj, tc);
+		}
+	}
+	tc->keyed = false;
+}
+
+static void
+xdr_ioq_pool_uv_release(struct xdr_uio *uio, u_int flags)
+{
+	struct xdr_ioq_pool_class *c = uio->uio_p1;
+
+	xdr_ioq_pool_put_obj(c - xdr_ioq_pool.cls, IOQU(uio));
+}
+
+/**
+ * @brief Set up the pools
+ *
+ * @param[in] max	bytes kept in the thread caches and shared lists,
+ *			0 for the default
+ * @param[in] cache	chunks kept per thread and class, 0 for the default
+ */
+bool
+xdr_ioq_pool_init(uint64_t max, uint32_t cache)
+{
+	struct xdr_ioq_pool_class *c;
+	int ix;
+
+	if (!xdr_ioq_pool.keyed) {
+		if (pthread_key_create(&xdr_ioq_pool.key, xdr_ioq_pool_flush)) {
+			__warnx(TIRPC_DEBUG_FLAG_ERROR,
+				"%s() pthread_key_create failed",
+				__func__);
+			return false;
+		}
+		xdr_ioq_pool.keyed = true;
+	}
+
+	xdr_ioq_pool.max = max ? max : XDR_IOQ_POOL_MAX;
+	xdr_ioq_pool.cache = cache ? cache : XDR_IOQ_POOL_CACHE;
+
+	for (ix = 0; ix < XDR_IOQ_POOL_CLASSES; ix++) {
+		c = &xdr_ioq_pool.cls[ix];
+		mutex_init(&c->lock, NULL);
+		if (ix == XDR_IOQ_POOL_HDR) {
+			c->size = sizeof(struct xdr_ioq);
+			c->chunk = sizeof(struct xdr_ioq);
+		} else {
+			c->size = 1 << (XDR_IOQ_POOL_SHIFT + ix - 1);
+			c->chunk = sizeof(struct xdr_ioq_uv) + c->size;
+		}
+	}
+	xdr_ioq_pool.enabled = true;
+	return true;
+}
+
+/**
+ * @brief A buffer for size bytes, pooled when it fits a class
+ */
+struct xdr_ioq_uv *
+xdr_ioq_pool_uv_create(size_t size, u_int uio_flags)
+{
+	struct xdr_ioq_uv *uv;
+	int ix;
+
+	if (!xdr_ioq_pool.enabled || !size || size > XDR_IOQ_POOL_BUF_MAX)
+		return (xdr_ioq_uv_create(size, uio_flags));
+
+	ix = xdr_ioq_pool_class(size);
+	uv = xdr_ioq_pool_get(ix);
+	memset(uv, 0, sizeof(*uv));
+
+	/* the data follows */
+	uv->v.vio_base = (uint8_t *)(uv + 1);
+	uv->v.vio_head = uv->v.vio_base;
+	uv->v.vio_tail = uv->v.vio_base;
+	uv->v.vio_wrap = uv->v.vio_base + size;
+	uv->u.uio_release = xdr_ioq_pool_uv_release;
+	uv->u.uio_p1 = &xdr_ioq_pool.cls[ix];
+	uv->u.uio_flags = uio_flags;
+	uv->u.uio_references = 1;	/* starting one */
+
+	return (uv);
+}
+
+/**
+ * @brief Like xdr_ioq_create(), pooled
+ */
+struct xdr_ioq *
+xdr_ioq_pool_create(size_t min_bsize, size_t max_bsize, u_int uio_flags)
+{
+	struct xdr_ioq *xioq;
+
+	if (!xdr_ioq_pool.enabled)
+		return (xdr_ioq_create(min_bsize, max_bsize, uio_flags));
+
+	xioq = xdr_ioq_pool_get(XDR_IOQ_POOL_HDR);
+	memset(xioq, 0, sizeof(*xioq));
+	xdr_ioq_setup(xioq);
+	xioq->ioq_s.qflags |= IOQ_FLAG_POOLED;
+	xioq->ioq_uv.min_bsize = min_bsize;
+	xioq->ioq_uv.max_bsize = max_bsize;
+
+	if (!(uio_flags & UIO_FLAG_BUFQ)) {
+		struct xdr_ioq_uv *uv = xdr_ioq_pool_uv_create(min_bsize,
+							       uio_flags);
+		xioq->ioq_uv.uvqh.qcount = 1;
+		TAILQ_INSERT_HEAD(&xioq->ioq_uv.uvqh.qh, &uv->uvq, q);
+		xdr_ioq_reset(xioq, 0);
+	}
+
+	return (xioq);
+}
+
+/*
+ * From xdr_ioq_destroy(), with its buffers released and its locks
+ * destroyed.
+ */
+void
+xdr_ioq_pool_put(struct xdr_ioq *xioq)
+{
+	xdr_ioq_pool_put_obj(XDR_IOQ_POOL_HDR, xioq);
+}
+
+/**
+ * @brief Read the pool statistics
+ *
+ * @return false when not in use.
+ */
+bool
+xdr_ioq_pool_stats(struct xdr_ioq_pool_stats *xps)
+{
+	struct xdr_ioq_pool_class *c;
+	int ix;
+
+	memset(xps, 0, sizeof(*xps));
+	if (!xdr_ioq_pool.enabled)
+		return false;
+
+	xps->held = atomic_fetch_uint64_t(&xdr_ioq_pool.held);
+	xps->max = xdr_ioq_pool.max;
+	for (ix = 0; ix < XDR_IOQ_POOL_CLASSES; ix++) {
+		c = &xdr_ioq_pool.cls[ix];
+		mutex_lock(&c->lock);
+		xps->cls[ix].size = c->size;
+		xps->cls[ix].idle = c->idle;
+		xps->cls[ix].allocs = c->allocs;
+		xps->cls[ix].reuses = c->reuses;
+		xps->cls[ix].cached = c->cached;
+		xps->cls[ix].frees = c->frees;
+		mutex_unlock(&c->lock);
+	}
+	return true;
+}
+
+/*
+ * Frees the shared lists.  Thread caches are flushed as their threads
+ * exit, and thereafter to the allocator.
+ */
+void
+xdr_ioq_pool_shutdown(void)
+{
+	struct xdr_ioq_pool_class *c;
+	struct xdr_ioq_pool_obj *obj;
+	int ix;
+
+	if (!xdr_ioq_pool.enabled)
+		return;
+	xdr_ioq_pool.enabled = false;
+
+	for (ix = 0; ix < XDR_IOQ_POOL_CLASSES; ix++) {
+		c = &xdr_ioq_pool.cls[ix];
+		mutex_lock(&c->lock);
+		while ((obj = c->free)) {
+			c->free = obj->next;
+			c->idle--;
+			atomic_sub_uint64_t(&xdr_ioq_pool.held, c->chunk);
+			mem_free(obj, c->chunk);
+		}
+		mutex_unlock(&c->lock);
+	}
+}
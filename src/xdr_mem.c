@@ -48,6 +48,7 @@
 #endif
 
 #include <string.h>
+#include <unistd.h>
 
 #include <rpc/types.h>
 #include <misc/portable.h>
@@ -183,7 +184,15 @@ xdrmem_putbufs(XDR *xdrs, xdr_uio *uio, u_int flags)
 	for (ix = 0; ix < uio->uio_count; ++ix) {
 		xdr_vio *v = &(uio->uio_vio[ix]);
 
-		if (!XDR_PUTBYTES(xdrs, v->vio_head, v->vio_length))
+		if (uio->uio_flags & UIO_FLAG_FILE) {
+			/* read straight into the stream */
+			if (xdrs->x_data + v->vio_length > xdrs->x_v.vio_wrap
+			 || pread(uio->uio_fd, xdrs->x_data, v->vio_length,
+				  (off_t)(uintptr_t)v->vio_head)
+			    != v->vio_length)
+				return (FALSE);
+			xdrs->x_data += v->vio_length;
+		} else if (!XDR_PUTBYTES(xdrs, v->vio_head, v->vio_length))
 			return (FALSE);
 
 		__warnx(TIRPC_DEBUG_FLAG_XDR,
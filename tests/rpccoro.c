@@ -0,0 +1,291 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpccoro.c
+ * @brief svc_suspend() and svc_resume() check
+ *
+ * @section DESCRIPTION
+ *
+ * Runs a NULL procedure server with requests on coroutines
+ * (SVC_INIT_CORO) over loopback TCP, with a few workers.
+ *
+ * First, pipelined calls whose handler replies without suspending.
+ * Then --suspended calls sent at once, each handler suspending until
+ * all of them are suspended together, when another thread resumes them
+ * and they reply.  The replies of both are checked.
+ *
+ * Each suspended request holds a stack of two memory mappings, so
+ * 100k needs vm.max_map_count above 200k; exits 77 (skipped) when the
+ * limit is too low for --suspended.
+ *
+ *	rpccoro --count=10000 --depth=16 --suspended=10000
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+
+#include "rpctest.h"
+
+#define RPCCORO_PROC_SUSPEND (1)
+#define RPCCORO_WAIT_SEC (60)
+
+static pthread_mutex_t rpccoro_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rpccoro_cond = PTHREAD_COND_INITIALIZER;
+static struct svc_req **rpccoro_suspended;
+static int rpccoro_n_suspended;
+static int rpccoro_want;
+static uint32_t rpccoro_not_coro;
+
+static enum xprt_stat
+coro_dispatch(struct svc_req *req)
+{
+	if (req->rq_msg.cb_proc == RPCCORO_PROC_SUSPEND) {
+		pthread_mutex_lock(&rpccoro_lock);
+		rpccoro_suspended[rpccoro_n_suspended++] = req;
+		if (rpccoro_n_suspended == rpccoro_want)
+			pthread_cond_signal(&rpccoro_cond);
+		pthread_mutex_unlock(&rpccoro_lock);
+
+		/* on return, resumed by main() */
+		if (!svc_suspend(req))
+			atomic_inc_uint32_t(&rpccoro_not_coro);
+	}
+	return null_dispatch(req);
+}
+
+static enum xprt_stat
+coro_rendezvous(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = coro_dispatch;
+	return XPRT_IDLE;
+}
+
+/* two mappings a stack, with room for the rest of the process */
+static int
+map_count_ok(int suspended)
+{
+	FILE *f = fopen("/proc/sys/vm/max_map_count", "r");
+	long max = 0;
+
+	if (!f)
+		return (1);
+	if (fscanf(f, "%ld", &max) != 1)
+		max = 0;
+	fclose(f);
+	return (!max || max > 2L * suspended + 4096);
+}
+
+static void usage(void)
+{
+	printf("Usage: rpccoro [--count=<n>] [--depth=<n>] [--suspended=<n>]"
+	       " [--clients=<n>] [--workers=<n>]\n");
+}
+
+static struct option long_options[] =
+{
+	{"clients", required_argument, NULL, 'l'},
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"suspended", required_argument, NULL, 's'},
+	{"workers", required_argument, NULL, 'w'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	struct timespec ts;
+	SVCXPRT *xprt;
+	char *calls;
+	char *replies;
+	uint32_t xid = 1;
+	int *fds;
+	int nclients = 8;
+	int count = 10000;
+	int depth = 16;
+	int suspended = 10000;
+	int nworkers = 4;
+	int per_client;
+	int done;
+	int lfd;
+	int opt;
+	int rc = 0;
+	int i;
+
+	while ((opt = getopt_long(argc, argv, "c:d:l:s:w:",
+				  long_options, NULL)) != -1) {
+		switch (opt)
+		{
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'l':
+			nclients = atoi(optarg);
+			break;
+		case 's':
+			suspended = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+			break;
+		};
+	}
+	if (depth < 1 || count < depth || nclients < 1
+	 || suspended < nclients || nworkers < 1) {
+		usage();
+		exit(1);
+	}
+	if (!map_count_ok(suspended)) {
+		fprintf(stdout,
+			"rpccoro: vm.max_map_count too low for %d suspended\n",
+			suspended);
+		exit(RPCTEST_SKIP);
+	}
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.alloc_cb = alloc_request;
+	svc_params.free_cb = free_request;
+	svc_params.flags = SVC_INIT_EPOLL | SVC_INIT_CORO;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = nworkers;
+	svc_params.coro_cache = 64;
+
+	if (!svc_init(&svc_params)) {
+		fail("svc_init failed", 1);
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0
+	 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(lfd, (struct sockaddr *)&sin, &slen)) {
+		fail("loopback listener failed", 2);
+	}
+
+	xprt = svc_vc_ncreatef(lfd, 0, 0, SVC_CREATE_FLAG_LISTEN);
+	if (!xprt) {
+		fail("svc_vc_ncreatef failed", 2);
+	}
+	xprt->xp_dispatch.rendezvous_cb = coro_rendezvous;
+
+	fds = calloc(nclients, sizeof(int));
+	for (i = 0; i < nclients; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if (fds[i] < 0
+		 || connect(fds[i], (struct sockaddr *)&sin, sizeof(sin))) {
+			fail("connect failed", 3);
+		}
+	}
+
+	/* handlers that never suspend, round robin over the clients */
+	calls = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ));
+	replies = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_REPLY_SZ));
+	for (done = 0; done + depth <= count; done += depth) {
+		int fd = fds[(done / depth) % nclients];
+
+		encode_calls((uint32_t *)calls, depth, xid, NULLPROC);
+		if (full_write(fd, calls, depth * (BYTES_PER_XDR_UNIT
+						   + RPCTEST_CALL_SZ))
+		 || full_read(fd, replies, depth * (BYTES_PER_XDR_UNIT
+						    + RPCTEST_REPLY_SZ))) {
+			fail("call failed", 4);
+		}
+		if (check_replies((uint32_t *)replies, depth, xid)) {
+			fail("bad reply", 5);
+		}
+		xid += depth;
+	}
+	free(calls);
+	free(replies);
+
+	/* all of them suspended at once, on far fewer workers */
+	per_client = suspended / nclients;
+	suspended = per_client * nclients;
+	rpccoro_want = suspended;
+	rpccoro_suspended = calloc(suspended, sizeof(struct svc_req *));
+
+	calls = malloc(per_client * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ));
+	replies = malloc(per_client * (BYTES_PER_XDR_UNIT + RPCTEST_REPLY_SZ));
+	for (i = 0; i < nclients; i++) {
+		encode_calls((uint32_t *)calls, per_client,
+			     xid + i * per_client, RPCCORO_PROC_SUSPEND);
+		if (full_write(fds[i], calls,
+			       per_client * (BYTES_PER_XDR_UNIT
+					     + RPCTEST_CALL_SZ))) {
+			fail("suspended call failed", 4);
+		}
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += RPCCORO_WAIT_SEC;
+	pthread_mutex_lock(&rpccoro_lock);
+	while (rpccoro_n_suspended < rpccoro_want && !rc)
+		rc = pthread_cond_timedwait(&rpccoro_cond, &rpccoro_lock, &ts);
+	pthread_mutex_unlock(&rpccoro_lock);
+	if (rc) {
+		fprintf(stderr, "rpccoro: %d of %d suspended\n",
+			rpccoro_n_suspended, rpccoro_want);
+		fail("requests not suspended", 6);
+	}
+
+	/* from outside the work pool */
+	for (i = 0; i < suspended; i++)
+		svc_resume(rpccoro_suspended[i]);
+
+	for (i = 0; i < nclients; i++) {
+		if (full_read(fds[i], replies,
+			      per_client * (BYTES_PER_XDR_UNIT
+					    + RPCTEST_REPLY_SZ))) {
+			fail("suspended reply failed", 4);
+		}
+		if (check_replies((uint32_t *)replies, per_client,
+				  xid + i * per_client)) {
+			fail("bad suspended reply", 5);
+		}
+	}
+	if (atomic_fetch_uint32_t(&rpccoro_not_coro)) {
+		fail("handler not on a coroutine", 7);
+	}
+
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+
+	for (i = 0; i < nclients; i++)
+		close(fds[i]);
+	free(fds);
+	free(calls);
+	free(replies);
+	free(rpccoro_suspended);
+
+	fprintf(stdout,
+		"rpccoro count=%d depth=%d suspended=%d workers=%d: ok\n",
+		done, depth, suspended, nworkers);
+	return (0);
+}
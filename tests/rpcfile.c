@@ -0,0 +1,350 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpcfile.c
+ * @brief file range (UIO_FLAG_FILE) encoding check
+ *
+ * @section DESCRIPTION
+ *
+ * Encodes ranges of a temporary file with XDR_PUTBUFS on a memory stream,
+ * which pread()s them in, and decodes them back, comparing them with the
+ * file.  Checks that xdr_vio_file() refuses offsets a pointer cannot hold.
+ *
+ * Then runs a server over loopback TCP replying with the same ranges,
+ * which are sent by sendfile(), and checks every reply byte.
+ *
+ *	rpcfile --count=1000 --depth=4
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+#include <rpc/svc_auth.h>
+#include <rpc/xdr_inline.h>
+
+#include "rpctest.h"
+
+#define RPCFILE_REPLY_SZ (RPCTEST_REPLY_SZ + BYTES_PER_XDR_UNIT)
+#define RPCFILE_FILE_SZ (192 * 1024)
+#define RPCFILE_NRANGES 2
+
+/* not aligned to pages, and not to each other */
+static const struct {
+	off_t offset;
+	uint32_t length;
+} rpcfile_ranges[RPCFILE_NRANGES] = {
+	{ 100, 5000 },
+	{ 70001, 65536 },
+};
+
+#define RPCFILE_DATA_SZ (5000 + 65536)
+
+static int rpcfile_fd;
+static char *rpcfile_data;	/* the ranges, as they should arrive */
+
+/* xdr_ioq releases each vector; the last frees it */
+static void
+rpcfile_uio_release(struct xdr_uio *uio, u_int flags)
+{
+	if (!(--uio->uio_references))
+		free(uio);
+}
+
+static xdr_uio *
+rpcfile_uio(int32_t references, xdr_uio_release release)
+{
+	xdr_uio *uio = calloc(1, sizeof(*uio)
+				 + RPCFILE_NRANGES * sizeof(xdr_vio));
+	int i;
+
+	uio->uio_release = release;
+	uio->uio_count = RPCFILE_NRANGES;
+	uio->uio_flags = UIO_FLAG_FILE;
+	uio->uio_references = references;
+	uio->uio_fd = rpcfile_fd;
+	for (i = 0; i < RPCFILE_NRANGES; i++) {
+		if (!xdr_vio_file(&uio->uio_vio[i], rpcfile_ranges[i].offset,
+				  rpcfile_ranges[i].length))
+			fail("xdr_vio_file refused a range", 6);
+	}
+	return (uio);
+}
+
+/* the length, then the ranges */
+static bool
+xdr_rpcfile_data(XDR *xdrs, void *where)
+{
+	xdr_uio *uio = rpcfile_uio(0, rpcfile_uio_release);
+
+	return (XDR_PUTUINT32(xdrs, RPCFILE_DATA_SZ)
+	     && XDR_PUTBUFS(xdrs, uio, XDR_PUTBUFS_FLAG_NONE));
+}
+
+static bool rpcfile_released;
+
+/* xdrmem releases the uio once, after its last reference */
+static void
+rpcfile_mem_release(struct xdr_uio *uio, u_int flags)
+{
+	rpcfile_released = true;
+	free(uio);
+}
+
+static bool
+xdr_rpcfile_data_mem(XDR *xdrs)
+{
+	xdr_uio *uio = rpcfile_uio(1, rpcfile_mem_release);
+
+	rpcfile_released = false;
+	if (XDR_PUTUINT32(xdrs, RPCFILE_DATA_SZ)
+	 && XDR_PUTBUFS(xdrs, uio, XDR_PUTBUFS_FLAG_NONE))
+		return (true);
+	if (!rpcfile_released)
+		free(uio);
+	return (false);
+}
+
+static void
+check_xdrmem(void)
+{
+	char *buf = malloc(RPCFILE_DATA_SZ + BYTES_PER_XDR_UNIT);
+	char *data = malloc(RPCFILE_DATA_SZ);
+	xdr_vio v;
+	XDR xdrs;
+	uint32_t len;
+
+	xdrmem_ncreate(&xdrs, buf, RPCFILE_DATA_SZ + BYTES_PER_XDR_UNIT,
+		       XDR_ENCODE);
+	if (!xdr_rpcfile_data_mem(&xdrs)
+	 || XDR_GETPOS(&xdrs) != RPCFILE_DATA_SZ + BYTES_PER_XDR_UNIT
+	 || !rpcfile_released) {
+		fail("xdrmem encode failed", 6);
+	}
+	XDR_DESTROY(&xdrs);
+
+	xdrmem_ncreate(&xdrs, buf, RPCFILE_DATA_SZ + BYTES_PER_XDR_UNIT,
+		       XDR_DECODE);
+	if (!XDR_GETUINT32(&xdrs, &len)
+	 || len != RPCFILE_DATA_SZ
+	 || !xdr_opaque_decode(&xdrs, data, len)
+	 || memcmp(data, rpcfile_data, len)) {
+		fail("xdrmem round trip differs", 6);
+	}
+	XDR_DESTROY(&xdrs);
+
+	/* no room left for the last range */
+	xdrmem_ncreate(&xdrs, buf, RPCFILE_DATA_SZ, XDR_ENCODE);
+	if (xdr_rpcfile_data_mem(&xdrs)) {
+		fail("xdrmem overran its buffer", 6);
+	}
+	XDR_DESTROY(&xdrs);
+
+	if (xdr_vio_file(&v, -1, BYTES_PER_XDR_UNIT)) {
+		fail("xdr_vio_file took a negative offset", 6);
+	}
+	if (xdr_vio_file(&v, (off_t)1 << 32, BYTES_PER_XDR_UNIT)
+	    != (sizeof(uintptr_t) > 4)) {
+		fail("xdr_vio_file mishandled an offset above 4GB", 6);
+	}
+
+	free(buf);
+	free(data);
+}
+
+static enum xprt_stat
+file_dispatch(struct svc_req *req)
+{
+	bool no_dispatch;
+
+	if (svc_auth_authenticate(req, &no_dispatch) != AUTH_OK
+	 || no_dispatch)
+		return svcerr_auth(req, AUTH_FAILED);
+
+	req->rq_msg.RPCM_ack.ar_results.where = NULL;
+	req->rq_msg.RPCM_ack.ar_results.proc = (xdrproc_t) xdr_rpcfile_data;
+	return svc_sendreply(req);
+}
+
+static enum xprt_stat
+file_rendezvous(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = file_dispatch;
+	return XPRT_IDLE;
+}
+
+/* the ranges after the data length */
+static int
+check_file_reply(int fd, uint32_t xid, int depth, char *seen, char *buf)
+{
+	uint32_t hdr[8];
+
+	if (full_read(fd, (char *)hdr, sizeof(hdr)))
+		return (-1);
+	if (hdr[0] != htonl(0x80000000 | (RPCFILE_REPLY_SZ
+					  + RPCFILE_DATA_SZ))
+	 || check_reply(hdr + 1, depth, xid, seen)
+	 || hdr[7] != htonl(RPCFILE_DATA_SZ)
+	 || full_read(fd, buf, RPCFILE_DATA_SZ)
+	 || memcmp(buf, rpcfile_data, RPCFILE_DATA_SZ))
+		return (-1);
+	return (0);
+}
+
+static void usage(void)
+{
+	printf("Usage: rpcfile [--count=<n>] [--depth=<n>] [--workers=<n>]\n");
+}
+
+static struct option long_options[] =
+{
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"workers", required_argument, NULL, 'w'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	SVCXPRT *xprt;
+	char path[] = "/tmp/rpcfileXXXXXX";
+	char *contents;
+	char *reply;
+	char *seen;
+	uint32_t *calls;
+	uint32_t xid = 1;
+	int count = 1000;
+	int depth = 4;
+	int nworkers = 5;
+	int done;
+	int lfd;
+	int fd;
+	int opt;
+	int i;
+
+	while ((opt = getopt_long(argc, argv, "c:d:w:",
+				  long_options, NULL)) != -1) {
+		switch (opt)
+		{
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+			break;
+		};
+	}
+	if (depth < 1 || count < depth) {
+		usage();
+		exit(1);
+	}
+
+	rpcfile_fd = mkstemp(path);
+	if (rpcfile_fd < 0) {
+		fail("mkstemp failed", 2);
+	}
+	(void)unlink(path);
+
+	contents = malloc(RPCFILE_FILE_SZ);
+	for (i = 0; i < RPCFILE_FILE_SZ; i++)
+		contents[i] = i * 7 + (i >> 8);
+	if (full_write(rpcfile_fd, contents, RPCFILE_FILE_SZ)) {
+		fail("file write failed", 2);
+	}
+
+	rpcfile_data = malloc(RPCFILE_DATA_SZ);
+	for (done = 0, i = 0; i < RPCFILE_NRANGES; i++) {
+		memcpy(rpcfile_data + done,
+		       contents + rpcfile_ranges[i].offset,
+		       rpcfile_ranges[i].length);
+		done += rpcfile_ranges[i].length;
+	}
+	free(contents);
+
+	check_xdrmem();
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.alloc_cb = alloc_request;
+	svc_params.free_cb = free_request;
+	svc_params.flags = SVC_INIT_EPOLL;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = nworkers;
+
+	if (!svc_init(&svc_params)) {
+		fail("svc_init failed", 1);
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0
+	 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(lfd, (struct sockaddr *)&sin, &slen)) {
+		fail("loopback listener failed", 2);
+	}
+
+	xprt = svc_vc_ncreatef(lfd, 0, 0, SVC_CREATE_FLAG_LISTEN);
+	if (!xprt) {
+		fail("svc_vc_ncreatef failed", 2);
+	}
+	xprt->xp_dispatch.rendezvous_cb = file_rendezvous;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+		fail("connect failed", 3);
+	}
+
+	calls = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ));
+	reply = malloc(RPCFILE_DATA_SZ);
+	seen = malloc(depth);
+
+	for (done = 0; done + depth <= count; done += depth) {
+		encode_calls(calls, depth, xid, 1);
+		if (full_write(fd, (char *)calls,
+			       depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ))) {
+			fail("call failed", 4);
+		}
+		memset(seen, 0, depth);
+		for (i = 0; i < depth; i++) {
+			if (check_file_reply(fd, xid, depth, seen, reply)) {
+				fail("bad reply", 5);
+			}
+		}
+		xid += depth;
+	}
+
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+	close(fd);
+	close(rpcfile_fd);
+	free(calls);
+	free(reply);
+	free(seen);
+	free(rpcfile_data);
+
+	fprintf(stdout, "rpcfile count=%d depth=%d: ok\n", done, depth);
+	return (0);
+}
@@ -0,0 +1,285 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpcsyscall.c
+ * @brief RPC server syscalls per request
+ *
+ * @section DESCRIPTION
+ *
+ * Runs a NULL procedure server on a loopback TCP port, and drives it
+ * with pipelined calls from a raw socket client in the same process.
+ * The event loop syscalls are interposed and counted for the server
+ * threads only, then reported per request.
+ *
+ * Compare the default EPOLLONESHOT arming with --edge:
+ *	rpcsyscall --count=100000 --depth=16
+ *	rpcsyscall --count=100000 --depth=16 --edge
+ *
+ * and with an adaptive busy poll budget of 50us, --busy=50 (ignored on a
+ * single cpu).
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+
+#include "rpctest.h"
+
+enum rpcsyscall_kind {
+	RPCSYSCALL_EPOLL_WAIT,
+	RPCSYSCALL_EPOLL_CTL,
+	RPCSYSCALL_RECV,
+	RPCSYSCALL_SENDMSG,
+	RPCSYSCALL_COUNT
+};
+
+static const char *rpcsyscall_names[RPCSYSCALL_COUNT] = {
+	"epoll_wait",
+	"epoll_ctl",
+	"recv",
+	"sendmsg",
+};
+
+static uint64_t rpcsyscall_counts[RPCSYSCALL_COUNT];
+
+/* the client thread is not counted */
+static __thread bool rpcsyscall_client;
+
+static inline void
+rpcsyscall_count(enum rpcsyscall_kind kind)
+{
+	if (!rpcsyscall_client)
+		atomic_inc_uint64_t(&rpcsyscall_counts[kind]);
+}
+
+/*
+ * Interposed on libntirpc, which resolves these through the executable.
+ */
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	static int (*next)(int, struct epoll_event *, int, int);
+
+	if (!next)
+		next = dlsym(RTLD_NEXT, "epoll_wait");
+	rpcsyscall_count(RPCSYSCALL_EPOLL_WAIT);
+	return next(epfd, events, maxevents, timeout);
+}
+
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	static int (*next)(int, int, int, struct epoll_event *);
+
+	if (!next)
+		next = dlsym(RTLD_NEXT, "epoll_ctl");
+	rpcsyscall_count(RPCSYSCALL_EPOLL_CTL);
+	return next(epfd, op, fd, event);
+}
+
+ssize_t
+recv(int fd, void *buf, size_t len, int flags)
+{
+	static ssize_t (*next)(int, void *, size_t, int);
+
+	if (!next)
+		next = dlsym(RTLD_NEXT, "recv");
+	rpcsyscall_count(RPCSYSCALL_RECV);
+	return next(fd, buf, len, flags);
+}
+
+ssize_t
+sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	static ssize_t (*next)(int, const struct msghdr *, int);
+
+	if (!next)
+		next = dlsym(RTLD_NEXT, "sendmsg");
+	rpcsyscall_count(RPCSYSCALL_SENDMSG);
+	return next(fd, msg, flags);
+}
+
+static void usage(void)
+{
+	printf("Usage: rpcsyscall [--edge] [--busy=<us>] [--count=<n>]"
+	       " [--depth=<n>] [--workers=<n>]\n");
+}
+
+static struct option long_options[] =
+{
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"workers", required_argument, NULL, 'w'},
+	{"edge", no_argument, NULL, 'e'},
+	{"busy", required_argument, NULL, 'b'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	struct timespec starting;
+	struct timespec stopping;
+	uint64_t before[RPCSYSCALL_COUNT];
+	SVCXPRT *xprt;
+	char *calls;
+	char *replies;
+	double elapsed;
+	double total = 0.0;
+	uint32_t xid = 1;
+	int count = 100000;
+	int depth = 16;
+	int nworkers = 5;
+	int busy_us = 0;
+	int done;
+	int lfd;
+	int fd;
+	int opt;
+	int i;
+	bool edge = false;
+
+	while ((opt = getopt_long(argc, argv, "b:c:d:ew:",
+				  long_options, NULL)) != -1) {
+		switch (opt)
+		{
+		case 'b':
+			busy_us = atoi(optarg);
+			break;
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'e':
+			edge = true;
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+			break;
+		};
+	}
+	if (depth < 1 || count < depth) {
+		usage();
+		exit(1);
+	}
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.alloc_cb = alloc_request;
+	svc_params.free_cb = free_request;
+	svc_params.flags = SVC_INIT_EPOLL;
+	if (edge)
+		svc_params.flags |= SVC_INIT_EPOLL_ET;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = nworkers;
+	svc_params.channels = 1;
+	svc_params.busy_poll_us = busy_us;
+
+	if (!svc_init(&svc_params)) {
+		perror("svc_init failed");
+		exit(1);
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0
+	 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(lfd, (struct sockaddr *)&sin, &slen)) {
+		perror("loopback listener failed");
+		exit(2);
+	}
+
+	xprt = svc_vc_ncreatef(lfd, 0, 0, SVC_CREATE_FLAG_LISTEN);
+	if (!xprt) {
+		fprintf(stderr, "svc_vc_ncreatef failed\n");
+		exit(2);
+	}
+	xprt->xp_dispatch.rendezvous_cb = null_rendezvous;
+
+	rpcsyscall_client = true;
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+		perror("connect failed");
+		exit(3);
+	}
+
+	calls = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ));
+	replies = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_REPLY_SZ));
+
+	/* warm up: accept, hook, first buffers */
+	encode_calls((uint32_t *)calls, depth, xid, NULLPROC);
+	xid += depth;
+	if (full_write(fd, calls, depth * (BYTES_PER_XDR_UNIT
+					   + RPCTEST_CALL_SZ))
+	 || full_read(fd, replies, depth * (BYTES_PER_XDR_UNIT
+					    + RPCTEST_REPLY_SZ))) {
+		perror("warm up failed");
+		exit(4);
+	}
+
+	for (i = 0; i < RPCSYSCALL_COUNT; i++)
+		before[i] = atomic_fetch_uint64_t(&rpcsyscall_counts[i]);
+	clock_gettime(CLOCK_MONOTONIC, &starting);
+
+	for (done = 0; done + depth <= count; done += depth) {
+		encode_calls((uint32_t *)calls, depth, xid, NULLPROC);
+		xid += depth;
+		if (full_write(fd, calls, depth * (BYTES_PER_XDR_UNIT
+						   + RPCTEST_CALL_SZ))
+		 || full_read(fd, replies, depth * (BYTES_PER_XDR_UNIT
+						    + RPCTEST_REPLY_SZ))) {
+			perror("call failed");
+			exit(5);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stopping);
+	elapsed = (stopping.tv_sec - starting.tv_sec)
+		+ (stopping.tv_nsec - starting.tv_nsec) / 1000000000.0;
+
+	fprintf(stdout, "rpcsyscall %s count=%d depth=%d workers=%d busy=%d:"
+		" %2.4lf calls/sec\n",
+		edge ? "edge" : "oneshot", done, depth, nworkers, busy_us,
+		done / elapsed);
+	for (i = 0; i < RPCSYSCALL_COUNT; i++) {
+		double per = (double)(atomic_fetch_uint64_t(
+					&rpcsyscall_counts[i]) - before[i])
+			   / done;
+
+		total += per;
+		fprintf(stdout, "\t%-12s %2.4lf per call\n",
+			rpcsyscall_names[i], per);
+	}
+	fprintf(stdout, "\t%-12s %2.4lf per call\n", "total", total);
+	fflush(stdout);
+
+	close(fd);
+	free(calls);
+	free(replies);
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+	return (0);
+}
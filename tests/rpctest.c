@@ -0,0 +1,160 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpctest.c
+ * @brief Helpers shared by the loopback server tests
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <rpc/rpc.h>
+
+#include "rpctest.h"
+
+void
+fail(const char *what, int code)
+{
+	fprintf(stderr, "%s: %s\n", program_invocation_short_name, what);
+	_exit(code);
+}
+
+struct svc_req *
+alloc_request(SVCXPRT *xprt, XDR *xdrs)
+{
+	struct svc_req *req = calloc(1, sizeof(*req));
+
+	SVC_REF(xprt, SVC_REF_FLAG_NONE);
+	req->rq_xprt = xprt;
+	req->rq_xdrs = xdrs;
+	req->rq_refcnt = 1;
+
+	return req;
+}
+
+void
+free_request(struct svc_req *req, enum xprt_stat stat)
+{
+	SVC_RELEASE(req->rq_xprt, SVC_RELEASE_FLAG_NONE);
+	free(req);
+}
+
+enum xprt_stat
+null_dispatch(struct svc_req *req)
+{
+	req->rq_msg.RPCM_ack.ar_results.where = NULL;
+	req->rq_msg.RPCM_ack.ar_results.proc = (xdrproc_t) xdr_void;
+	return svc_sendreply(req);
+}
+
+enum xprt_stat
+null_rendezvous(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = null_dispatch;
+	return XPRT_IDLE;
+}
+
+int
+full_write(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n <= 0)
+			return (-1);
+		buf += n;
+		len -= n;
+	}
+	return (0);
+}
+
+int
+full_read(int fd, char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = read(fd, buf, len);
+
+		if (n <= 0)
+			return (-1);
+		buf += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/* one call, RPCTEST_CALL_SZ without a record mark */
+void
+encode_call(uint32_t *p, uint32_t xid, uint32_t proc)
+{
+	*p++ = htonl(xid);
+	*p++ = htonl(CALL);
+	*p++ = htonl(RPC_MSG_VERSION);
+	*p++ = htonl(RPCTEST_PROG);
+	*p++ = htonl(1);		/* version */
+	*p++ = htonl(proc);
+	*p++ = htonl(AUTH_NONE);
+	*p++ = 0;
+	*p++ = htonl(AUTH_NONE);
+	*p++ = 0;
+}
+
+/* pipelined calls, one record each */
+void
+encode_calls(uint32_t *p, int depth, uint32_t xid, uint32_t proc)
+{
+	int i;
+
+	for (i = 0; i < depth; i++) {
+		*p++ = htonl(0x80000000 | RPCTEST_CALL_SZ);
+		encode_call(p, xid++, proc);
+		p += RPCTEST_CALL_SZ / BYTES_PER_XDR_UNIT;
+	}
+}
+
+/*
+ * One reply, without its record mark: accepted, AUTH_NONE verifier,
+ * SUCCESS.  Replies are not in call order, but each xid of the batch
+ * from xid comes once, as marked in seen.
+ */
+int
+check_reply(const uint32_t *p, int depth, uint32_t xid, char *seen)
+{
+	uint32_t n = ntohl(p[0]) - xid;
+
+	if (n >= depth || seen[n]++
+	 || p[1] != htonl(REPLY)
+	 || p[2] != htonl(MSG_ACCEPTED)
+	 || p[3] != htonl(AUTH_NONE)
+	 || p[4] != 0
+	 || p[5] != htonl(SUCCESS))
+		return (-1);
+	return (0);
+}
+
+/* depth pipelined replies without results, one record each */
+int
+check_replies(const uint32_t *p, int depth, uint32_t xid)
+{
+	char *seen = calloc(depth, 1);
+	int i;
+
+	/* record mark, then the reply */
+	for (i = 0; i < depth; i++, p += 7) {
+		if (p[0] != htonl(0x80000000 | RPCTEST_REPLY_SZ)
+		 || check_reply(p + 1, depth, xid, seen))
+			break;
+	}
+	free(seen);
+	return (i < depth ? -1 : 0);
+}
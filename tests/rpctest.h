@@ -0,0 +1,49 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpctest.h
+ * @brief Helpers shared by the loopback server tests
+ *
+ * @section DESCRIPTION
+ *
+ * Request allocation for svc_init(), a NULL procedure dispatcher, and a
+ * raw socket client: calls encoded by hand, and replies checked word by
+ * word.  Calls and replies carry AUTH_NONE.
+ */
+#ifndef RPCTEST_H
+#define RPCTEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <rpc/rpc.h>
+
+#define RPCTEST_PROG (0x20000099)
+#define RPCTEST_CALL_SZ (10 * BYTES_PER_XDR_UNIT)
+#define RPCTEST_REPLY_SZ (6 * BYTES_PER_XDR_UNIT)	/* without results */
+#define RPCTEST_SKIP 77
+
+/* without waiting for the server threads */
+void fail(const char *what, int code);
+
+struct svc_req *alloc_request(SVCXPRT *, XDR *);
+void free_request(struct svc_req *, enum xprt_stat);
+
+/* replies without results; rendezvous_cb of a listener */
+enum xprt_stat null_dispatch(struct svc_req *);
+enum xprt_stat null_rendezvous(SVCXPRT *);
+
+int full_write(int fd, const char *buf, size_t len);
+int full_read(int fd, char *buf, size_t len);
+
+void encode_call(uint32_t *p, uint32_t xid, uint32_t proc);
+void encode_calls(uint32_t *p, int depth, uint32_t xid, uint32_t proc);
+
+int check_reply(const uint32_t *p, int depth, uint32_t xid, char *seen);
+int check_replies(const uint32_t *p, int depth, uint32_t xid);
+
+#endif				/* RPCTEST_H */
@@ -0,0 +1,313 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpcudp.c
+ * @brief UDP GRO receive and GSO reply check
+ *
+ * @section DESCRIPTION
+ *
+ * Runs a NULL procedure server over loopback UDP, with replies batched
+ * by sendmmsg() and GSO (SVC_INIT_DG_SENDMMSG | SVC_INIT_UDP_GSO), and
+ * coalesced receives (SVC_INIT_UDP_GRO).
+ *
+ * The client sends each batch of --depth calls as one UDP_SEGMENT send,
+ * which loopback delivers to the server still coalesced, so a reply is
+ * missing for every call the server does not split out.  The client
+ * socket also has UDP_GRO, so replies the server sent as one GSO batch
+ * arrive together, and are split here.  Every reply is checked, and the
+ * number that arrived in GSO batches reported.
+ *
+ * With --single, the calls are sent one datagram each instead, and with
+ * --fair they are scheduled per client (SVC_INIT_FAIR).
+ *
+ * Exits 77 (skipped) when the kernel has no UDP GSO or GRO.
+ *
+ *	rpcudp --count=10000 --depth=16
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+
+#include "rpctest.h"
+
+#define RPCUDP_DEPTH_MAX (64)	/* UDP_MAX_SEGMENTS of older kernels */
+#define RPCUDP_WAIT_MS (5000)
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+/* each datagram */
+static enum xprt_stat
+dg_rendezvous(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = null_dispatch;
+	return SVC_RECV(xprt);
+}
+
+/* NULL calls back to back */
+static void
+encode_dg_calls(uint32_t *p, int depth, uint32_t xid)
+{
+	int i;
+
+	for (i = 0; i < depth; i++, p += 10)
+		encode_call(p, xid++, NULLPROC);
+}
+
+static int
+send_calls(int fd, char *calls, int depth, bool single)
+{
+	char control[CMSG_SPACE(sizeof(uint16_t))];
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int i;
+
+	if (single) {
+		for (i = 0; i < depth; i++) {
+			if (send(fd, calls + i * RPCTEST_CALL_SZ,
+				 RPCTEST_CALL_SZ, 0) != RPCTEST_CALL_SZ)
+				return (-1);
+		}
+		return (0);
+	}
+
+	iov.iov_base = calls;
+	iov.iov_len = depth * RPCTEST_CALL_SZ;
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*(uint16_t *)CMSG_DATA(cmsg) = RPCTEST_CALL_SZ;
+
+	return (sendmsg(fd, &msg, 0) == iov.iov_len ? 0 : -1);
+}
+
+/*
+ * Read depth replies, a coalesced read split by its segment size.
+ *
+ * @return replies that arrived in GSO batches, or -1.
+ */
+static int
+recv_replies(int fd, uint32_t *replies, int depth)
+{
+	char buf[RPCUDP_DEPTH_MAX * RPCTEST_REPLY_SZ];
+	char control[CMSG_SPACE(sizeof(int))];
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	struct msghdr msg;
+	ssize_t len;
+	int batched = 0;
+	int seg;
+	int n = 0;
+
+	while (n < depth) {
+		if (poll(&pfd, 1, RPCUDP_WAIT_MS) != 1)
+			return (-1);
+
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		len = recvmsg(fd, &msg, 0);
+		if (len <= 0)
+			return (-1);
+
+		seg = len;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_UDP
+			 && cmsg->cmsg_type == UDP_GRO)
+				seg = *(int *)CMSG_DATA(cmsg);
+		}
+		if (seg != RPCTEST_REPLY_SZ || len % seg
+		 || n + len / seg > depth)
+			return (-1);
+
+		memcpy(&replies[n * 6], buf, len);
+		if (len > seg)
+			batched += len / seg;
+		n += len / seg;
+	}
+	return (batched);
+}
+
+/* each xid once in any order */
+static int
+check_dg_replies(const uint32_t *p, int depth, uint32_t xid)
+{
+	char seen[RPCUDP_DEPTH_MAX];
+	int i;
+
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < depth; i++, p += 6) {
+		if (check_reply(p, depth, xid, seen))
+			return (-1);
+	}
+	return (0);
+}
+#endif /* UDP_SEGMENT && UDP_GRO */
+
+static void usage(void)
+{
+	printf("Usage: rpcudp [--count=<n>] [--depth=<n>] [--workers=<n>]"
+	       " [--single] [--fair]\n");
+}
+
+static struct option long_options[] =
+{
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"workers", required_argument, NULL, 'w'},
+	{"single", no_argument, NULL, 's'},
+	{"fair", no_argument, NULL, 'f'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	SVCXPRT *xprt;
+	uint32_t calls[RPCUDP_DEPTH_MAX * 10];
+	uint32_t replies[RPCUDP_DEPTH_MAX * 6];
+	uint32_t xid = 1;
+	int count = 10000;
+	int depth = 16;
+	int nworkers = 5;
+	int batched = 0;
+	int on = 1;
+	int done;
+	int sfd;
+	int fd;
+	int opt;
+	int n;
+	bool single = false;
+	bool fair = false;
+
+	while ((opt = getopt_long(argc, argv, "c:d:w:sf",
+				  long_options, NULL)) != -1) {
+		switch (opt)
+		{
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 's':
+			single = true;
+			break;
+		case 'f':
+			fair = true;
+			break;
+		default:
+			usage();
+			exit(1);
+			break;
+		};
+	}
+	if (depth < 1 || depth > RPCUDP_DEPTH_MAX || count < depth) {
+		usage();
+		exit(1);
+	}
+
+	sfd = socket(AF_INET, SOCK_DGRAM, 0);
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sfd < 0 || fd < 0) {
+		fail("socket failed", 2);
+	}
+	if (setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on))) {
+		fprintf(stdout, "rpcudp: no UDP_GRO\n");
+		exit(RPCTEST_SKIP);
+	}
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.alloc_cb = alloc_request;
+	svc_params.free_cb = free_request;
+	svc_params.flags = SVC_INIT_EPOLL | SVC_INIT_DG_SENDMMSG
+			 | SVC_INIT_UDP_GSO | SVC_INIT_UDP_GRO
+			 | (fair ? SVC_INIT_FAIR : 0);
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = nworkers;
+
+	if (!svc_init(&svc_params)) {
+		fail("svc_init failed", 1);
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(sfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(sfd, (struct sockaddr *)&sin, &slen)
+	 || connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+		fail("loopback socket failed", 2);
+	}
+
+	xprt = svc_dg_ncreatef(sfd, 0, 0, SVC_CREATE_FLAG_CLOSE);
+	if (!xprt) {
+		fail("svc_dg_ncreatef failed", 2);
+	}
+	xprt->xp_dispatch.rendezvous_cb = dg_rendezvous;
+
+	for (done = 0; done + depth <= count; done += depth) {
+		encode_dg_calls(calls, depth, xid);
+		if (send_calls(fd, (char *)calls, depth, single)) {
+			if (!done && !single) {
+				fprintf(stdout, "rpcudp: no UDP_SEGMENT\n");
+				exit(RPCTEST_SKIP);
+			}
+			fail("call failed", 4);
+		}
+		n = recv_replies(fd, replies, depth);
+		if (n < 0) {
+			fail("replies lost", 4);
+		}
+		if (check_dg_replies(replies, depth, xid)) {
+			fail("bad reply", 5);
+		}
+		batched += n;
+		xid += depth;
+	}
+
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+	close(fd);
+
+	fprintf(stdout, "rpcudp count=%d depth=%d: ok, %d replies by GSO\n",
+		done, depth, batched);
+	return (0);
+#else
+	fprintf(stdout, "rpcudp: no UDP_SEGMENT or UDP_GRO\n");
+	return (RPCTEST_SKIP);
+#endif
+}
@@ -0,0 +1,203 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpcuring.c
+ * @brief io_uring event channel check
+ *
+ * @section DESCRIPTION
+ *
+ * Runs a NULL procedure server on io_uring event channels (SVC_INIT_IOURING)
+ * over loopback TCP, and checks the replies of pipelined calls from several
+ * raw socket clients.  Half the clients hang up while the server runs, the
+ * rest are still connected at svc_shutdown(), so their xprts are unhooked
+ * from channels whose loops have already finished.
+ *
+ * Exits 77 (skipped) when the channels fell back to epoll.
+ *
+ *	rpcuring --clients=8 --count=10000 --depth=16
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+#include <rpc/svc_auth.h>
+
+#include "rpctest.h"
+
+static uint32_t rpcuring_epoll_waits;
+
+/*
+ * Interposed on libntirpc; an io_uring channel never waits in epoll.
+ */
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	static int (*next)(int, struct epoll_event *, int, int);
+
+	if (!next)
+		next = dlsym(RTLD_NEXT, "epoll_wait");
+	atomic_inc_uint32_t(&rpcuring_epoll_waits);
+	return next(epfd, events, maxevents, timeout);
+}
+
+static void usage(void)
+{
+	printf("Usage: rpcuring [--clients=<n>] [--count=<n>] [--depth=<n>]"
+	       " [--workers=<n>]\n");
+}
+
+static struct option long_options[] =
+{
+	{"clients", required_argument, NULL, 'l'},
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"workers", required_argument, NULL, 'w'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	SVCXPRT *xprt;
+	char *calls;
+	char *replies;
+	uint32_t xid = 1;
+	int *fds;
+	int nclients = 8;
+	int count = 10000;
+	int depth = 16;
+	int nworkers = 5;
+	int done;
+	int lfd;
+	int opt;
+	int i;
+
+	while ((opt = getopt_long(argc, argv, "c:d:l:w:",
+				  long_options, NULL)) != -1) {
+		switch (opt)
+		{
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'l':
+			nclients = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+			break;
+		};
+	}
+	if (depth < 1 || count < depth || nclients < 1) {
+		usage();
+		exit(1);
+	}
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.alloc_cb = alloc_request;
+	svc_params.free_cb = free_request;
+	svc_params.flags = SVC_INIT_IOURING;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = nworkers;
+	svc_params.channels = 2;
+
+	if (!svc_init(&svc_params)) {
+		fail("svc_init failed", 1);
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0
+	 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(lfd, (struct sockaddr *)&sin, &slen)) {
+		fail("loopback listener failed", 2);
+	}
+
+	xprt = svc_vc_ncreatef(lfd, 0, 0, SVC_CREATE_FLAG_LISTEN);
+	if (!xprt) {
+		fail("svc_vc_ncreatef failed", 2);
+	}
+	xprt->xp_dispatch.rendezvous_cb = null_rendezvous;
+
+	fds = calloc(nclients, sizeof(int));
+	for (i = 0; i < nclients; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if (fds[i] < 0
+		 || connect(fds[i], (struct sockaddr *)&sin, sizeof(sin))) {
+			fail("connect failed", 3);
+		}
+	}
+
+	calls = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ));
+	replies = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_REPLY_SZ));
+
+	/* round robin over the clients, each batch checked in order */
+	for (done = 0; done + depth <= count; done += depth) {
+		int fd = fds[(done / depth) % nclients];
+
+		encode_calls((uint32_t *)calls, depth, xid, NULLPROC);
+		if (full_write(fd, calls, depth * (BYTES_PER_XDR_UNIT
+						   + RPCTEST_CALL_SZ))
+		 || full_read(fd, replies, depth * (BYTES_PER_XDR_UNIT
+						    + RPCTEST_REPLY_SZ))) {
+			fail("call failed", 4);
+		}
+		if (check_replies((uint32_t *)replies, depth, xid)) {
+			fail("bad reply", 5);
+		}
+		xid += depth;
+
+		/* hang up half the clients midway */
+		if (done < count / 2 && done + depth >= count / 2) {
+			for (i = 0; i < nclients / 2; i++) {
+				close(fds[i]);
+				fds[i] = fds[nclients - 1 - i];
+			}
+			nclients -= nclients / 2;
+		}
+	}
+
+	if (atomic_fetch_uint32_t(&rpcuring_epoll_waits)) {
+		fprintf(stdout, "rpcuring: io_uring unavailable, epoll used\n");
+		(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+		exit(RPCTEST_SKIP);
+	}
+
+	/* the remaining clients are hooked at shutdown */
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+
+	for (i = 0; i < nclients; i++)
+		close(fds[i]);
+	free(fds);
+	free(calls);
+	free(replies);
+
+	fprintf(stdout, "rpcuring count=%d depth=%d: ok\n", done, depth);
+	return (0);
+}
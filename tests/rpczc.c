@@ -0,0 +1,271 @@
+/*
+ * This code is released into the "public domain" by its author(s).
+ * Anybody may use, alter, and distribute the code without restriction.
+ * The author(s) make no guarantees, and take no liability of any kind
+ * for use of this code.
+ */
+
+/**
+ * @file rpczc.c
+ * @brief MSG_ZEROCOPY reply check
+ *
+ * @section DESCRIPTION
+ *
+ * Runs a server over loopback TCP with large replies sent by MSG_ZEROCOPY
+ * (SVC_INIT_ZEROCOPY).  Procedure 1 replies with --size bytes of a pattern,
+ * above zerocopy_min, and NULLPROC with none, below it; the client pipelines
+ * both kinds, and checks every reply byte.  Loopback always copies, so the
+ * completions report SO_EE_CODE_ZEROCOPY_COPIED, and the server stops
+ * asking for them.
+ *
+ * Then more clients each pipeline --depth large calls, and hang up without
+ * reading a reply, so their xprts are destroyed with zerocopy replies still
+ * unreaped, or still being sent.
+ *
+ * Exits 77 (skipped) when built without MSG_ZEROCOPY.
+ *
+ *	rpczc --count=2000 --depth=8 --size=65536
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <rpc/rpc.h>
+#include <rpc/svc_auth.h>
+#include <rpc/xdr_inline.h>
+
+#include "rpctest.h"
+
+#define RPCZC_ZEROCOPY_MIN (4096)
+
+static u_int rpczc_size = 65536;
+static char *rpczc_data;
+
+#ifdef HAVE_MSG_ZEROCOPY
+static bool
+xdr_rpczc_data(XDR *xdrs, void *where)
+{
+	return (xdr_opaque_encode(xdrs, rpczc_data, rpczc_size));
+}
+
+/* AUTH_NONE; results are encoded by its wrap */
+static enum xprt_stat
+zc_dispatch(struct svc_req *req)
+{
+	bool no_dispatch;
+
+	if (svc_auth_authenticate(req, &no_dispatch) != AUTH_OK
+	 || no_dispatch)
+		return svcerr_auth(req, AUTH_FAILED);
+
+	req->rq_msg.RPCM_ack.ar_results.where = NULL;
+	req->rq_msg.RPCM_ack.ar_results.proc = req->rq_msg.cb_proc
+					     ? (xdrproc_t) xdr_rpczc_data
+					     : (xdrproc_t) xdr_void;
+	return svc_sendreply(req);
+}
+
+static enum xprt_stat
+zc_rendezvous(SVCXPRT *xprt)
+{
+	xprt->xp_dispatch.process_cb = zc_dispatch;
+	return XPRT_IDLE;
+}
+
+/* pipelined calls, one record each; odd xids are large */
+static void
+encode_zc_calls(uint32_t *p, int depth, uint32_t xid)
+{
+	int i;
+
+	for (i = 0; i < depth; i++, xid++, p += 11) {
+		p[0] = htonl(0x80000000 | RPCTEST_CALL_SZ);
+		encode_call(p + 1, xid, xid & 1);
+	}
+}
+
+/* the next reply, whose length depends on its xid */
+static int
+check_zc_reply(int fd, uint32_t xid, int depth, char *seen, char *buf)
+{
+	uint32_t hdr[7];
+	u_int len;
+
+	if (full_read(fd, (char *)hdr, sizeof(hdr)))
+		return (-1);
+	len = (ntohl(hdr[1]) & 1) ? rpczc_size : 0;
+	if (hdr[0] != htonl(0x80000000 | (RPCTEST_REPLY_SZ + len))
+	 || check_reply(hdr + 1, depth, xid, seen))
+		return (-1);
+	if (len && (full_read(fd, buf, len) || memcmp(buf, rpczc_data, len)))
+		return (-1);
+	return (0);
+}
+#endif /* HAVE_MSG_ZEROCOPY */
+
+static void usage(void)
+{
+	printf("Usage: rpczc [--count=<n>] [--depth=<n>] [--size=<n>]"
+	       " [--clients=<n>] [--workers=<n>]\n");
+}
+
+static struct option long_options[] =
+{
+	{"count", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"size", required_argument, NULL, 's'},
+	{"clients", required_argument, NULL, 'l'},
+	{"workers", required_argument, NULL, 'w'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+#ifdef HAVE_MSG_ZEROCOPY
+	svc_init_params svc_params;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	SVCXPRT *xprt;
+	uint32_t *calls;
+	char *reply;
+	char *seen;
+	uint32_t xid = 1;
+	int nclients = 8;
+	int count = 2000;
+	int depth = 8;
+	int nworkers = 5;
+	int done;
+	int lfd;
+	int fd;
+	int opt;
+	int i;
+
+	while ((opt = getopt_long(argc, argv, "c:d:l:s:w:",
+				  long_options, NULL)) != -1) {
+		switch (opt)
+		{
+		case 'c':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'l':
+			nclients = atoi(optarg);
+			break;
+		case 's':
+			rpczc_size = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+			break;
+		};
+	}
+	if (depth < 1 || count < depth || nclients < 0
+	 || rpczc_size < RPCZC_ZEROCOPY_MIN || rpczc_size % BYTES_PER_XDR_UNIT) {
+		usage();
+		exit(1);
+	}
+
+	rpczc_data = malloc(rpczc_size);
+	for (i = 0; i < rpczc_size; i++)
+		rpczc_data[i] = i * 7 + (i >> 8);
+
+	memset(&svc_params, 0, sizeof(svc_params));
+	svc_params.alloc_cb = alloc_request;
+	svc_params.free_cb = free_request;
+	svc_params.flags = SVC_INIT_EPOLL | SVC_INIT_ZEROCOPY;
+	svc_params.max_events = 512;
+	svc_params.ioq_thrd_max = nworkers;
+	svc_params.zerocopy_min = RPCZC_ZEROCOPY_MIN;
+
+	if (!svc_init(&svc_params)) {
+		fail("svc_init failed", 1);
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0
+	 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin))
+	 || getsockname(lfd, (struct sockaddr *)&sin, &slen)) {
+		fail("loopback listener failed", 2);
+	}
+
+	xprt = svc_vc_ncreatef(lfd, 0, 0, SVC_CREATE_FLAG_LISTEN);
+	if (!xprt) {
+		fail("svc_vc_ncreatef failed", 2);
+	}
+	xprt->xp_dispatch.rendezvous_cb = zc_rendezvous;
+
+	calls = malloc(depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ));
+	reply = malloc(rpczc_size);
+	seen = malloc(depth);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+		fail("connect failed", 3);
+	}
+
+	for (done = 0; done + depth <= count; done += depth) {
+		encode_zc_calls(calls, depth, xid);
+		if (full_write(fd, (char *)calls,
+			       depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ))) {
+			fail("call failed", 4);
+		}
+		memset(seen, 0, depth);
+		for (i = 0; i < depth; i++) {
+			if (check_zc_reply(fd, xid, depth, seen, reply)) {
+				fail("bad reply", 5);
+			}
+		}
+		xid += depth;
+	}
+	close(fd);
+
+	/* large replies outstanding, none read */
+	for (i = 0; i < nclients; i++) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0
+		 || connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+			fail("connect failed", 3);
+		}
+		encode_calls(calls, depth, 1, 1);
+		if (full_write(fd, (char *)calls,
+			       depth * (BYTES_PER_XDR_UNIT + RPCTEST_CALL_SZ))) {
+			fail("call failed", 4);
+		}
+		/* the first reply is on its way */
+		if (read(fd, reply, 1) != 1) {
+			fail("no reply", 4);
+		}
+		close(fd);
+	}
+
+	(void)svc_shutdown(SVC_SHUTDOWN_FLAG_NONE);
+	free(calls);
+	free(reply);
+	free(seen);
+	free(rpczc_data);
+
+	fprintf(stdout, "rpczc count=%d depth=%d size=%u: ok\n",
+		done, depth, rpczc_size);
+	return (0);
+#else
+	fprintf(stdout, "rpczc: no MSG_ZEROCOPY\n");
+	return (RPCTEST_SKIP);
+#endif
+}